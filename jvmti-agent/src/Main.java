@@ -1,5 +1,22 @@
 // javac -d bin *.java
 // java -cp bin -agentpath:bin/agent.so=classes_dir=bin Main
+// or attach to running JVM: jcmd <pid> JVMTI.agent_load $PWD/bin/agent.so classes_dir=bin
+// sampling cpu profiler: -agentpath:bin/agent.so=classes_dir=bin,cpu_profiler=100,cpu_profile_file=cpu.collapsed
+// dump collapsed stacks on demand: jcmd <pid> JVMTI.agent_load $PWD/bin/agent.so command=cpu_profile_dump
+// allocation sampling heap profiler: -agentpath:bin/agent.so=classes_dir=bin,heap_profiler=524288
+// dump allocation and live heap profiles: jcmd <pid> JVMTI.agent_load $PWD/bin/agent.so command=heap_profile_dump
+// monitor contention profiler: -agentpath:bin/agent.so=classes_dir=bin,monitor_profiler=1
+// dump blocked time profile and histograms: jcmd <pid> JVMTI.agent_load $PWD/bin/agent.so command=monitor_profile_dump
+// binary trace of redefinition cost: -agentpath:bin/agent.so=classes_dir=bin,reload_trace_file=reload.trace,reload_trace_window_ms=10000
+// method latency probes: -agentpath:bin/agent.so=classes_dir=bin,probe_methods=Service.get*,method_timing_file=method_timing.tsv
+// dump latency histograms, remove or install probes: jcmd <pid> JVMTI.agent_load $PWD/bin/agent.so command=method_timing_dump|probes_remove|probes_install
+// one reload daemon per host for many JVMs: bin/reloadd bin /jvmti-reload & then -agentpath:bin/agent.so=shm_ring=/jvmti-reload
+// heap histogram, diffed with the previous one or the one taken before reload with heap_histogram_reload=1: jcmd <pid> JVMTI.agent_load $PWD/bin/agent.so command=heap_histogram
+// hot threads report rewritten every second: -agentpath:bin/agent.so=classes_dir=bin,thread_cpu_sampler=1000,thread_cpu_top=10,thread_cpu_report_file=thread_cpu_top.txt
+// dump cpu time of hot thread stacks: jcmd <pid> JVMTI.agent_load $PWD/bin/agent.so command=thread_cpu_dump
+// class loading timeline of the first 30 seconds in chrome trace format: -agentpath:bin/agent.so=classes_dir=bin,class_load_timeline=30,class_load_trace_file=class_load_trace.json
+// report classes referencing what a reload changed: -agentpath:bin/agent.so=classes_dir=bin,dependency_index=1,dependents_report_file=reload_dependents.tsv
+// and detach later: jcmd <pid> JVMTI.agent_load $PWD/bin/agent.so command=detach
 import static java.lang.System.out;
 
 public class Main {
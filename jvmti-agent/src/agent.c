@@ -7,325 +7,1901 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <errno.h>
 
+#include <sched.h>
 #include <pthread.h>
+#include <dirent.h>
 #include <sys/stat.h>
 #include <sys/inotify.h>
 
 #include <jvmti.h>
 
+#include "agent.h"
 #include "hashmap.h"
+#include "strarena.h"
 #include "classload.h"
+#include "stacktable.h"
+#include "cpuprof.h"
+#include "tlbuf.h"
+#include "heapprof.h"
+#include "monprof.h"
+#include "reloadtrace.h"
+#include "methodprobe.h"
+#include "shmring.h"
+#include "classread.h"
+#include "heaphisto.h"
+#include "threadcpu.h"
+#include "loadtimeline.h"
+#include "patchtable.h"
+#include "depindex.h"
 
 const char* const DEFAULT_CLASSES_DIR = "bin";
+const char* const DEFAULT_CPU_PROFILE_FILE = "cpu_profile.collapsed";
+const char* const DEFAULT_HEAP_PROFILE_FILE = "heap_profile.collapsed";
+const char* const DEFAULT_HEAP_LIVE_PROFILE_FILE = "heap_live_profile.collapsed";
+const char* const DEFAULT_MONITOR_PROFILE_FILE = "monitor_profile.collapsed";
+const char* const DEFAULT_MONITOR_HISTOGRAMS_FILE = "monitor_histograms.tsv";
+const int DEFAULT_RELOAD_TRACE_WINDOW_MS = 10000;
+const char* const DEFAULT_METHOD_TIMING_FILE = "method_timing.tsv";
+const char* const DEFAULT_HEAP_HISTOGRAM_FILE = "heap_histogram.tsv";
+const char* const DEFAULT_HEAP_HISTOGRAM_DIFF_FILE = "heap_histogram_diff.tsv";
+const int DEFAULT_THREAD_CPU_TOP = 10;
+const char* const DEFAULT_THREAD_CPU_REPORT_FILE = "thread_cpu_top.txt";
+const char* const DEFAULT_THREAD_CPU_PROFILE_FILE = "thread_cpu_profile.collapsed";
+const char* const DEFAULT_CLASS_LOAD_TRACE_FILE = "class_load_trace.json";
+const char* const DEFAULT_CLASS_LOAD_SUMMARY_FILE = "class_load_summary.tsv";
+const char* const DEFAULT_DEPENDENTS_REPORT_FILE = "reload_dependents.tsv";
+// ring consumer wakes up this often to check whether it should stop
+const int RING_WAIT_TIMEOUT_MS = 500;
+
+// class files changed at once are read into registered buffers, larger files are read separately
+#define MAX_BATCH_CLASS_FILES 64
+#define CLASS_FILE_BUFFER_SIZE (64 * 1024)
 
 typedef struct {
 	JavaVM* jvm;
 	jvmtiEnv* jvmti;
 	FILE* log_file;
-	HashMap* classes;
+	// class names in internal form are interned, class index is keyed by their handles
+	StrArena* class_names;
+	SymbolMap* classes;
 	int inotify_fd;
+	int inotify_watch_fd;
 	char* classes_dir;
+	pthread_t redefine_class_thread;
+	atomic_bool watching;
+	char* shm_ring_name;
+	// only ring of this user is consumed, it's the user agent runs as unless configured
+	uid_t shm_ring_owner_uid;
+	int cpu_sampling_rate;
+	char* cpu_profile_file;
+	CpuProfiler* cpu_profiler;
+	int heap_sampling_interval;
+	char* heap_profile_file;
+	char* heap_live_profile_file;
+	HeapProfiler* heap_profiler;
+	bool monitor_profiling;
+	char* monitor_profile_file;
+	char* monitor_histograms_file;
+	MonitorProfiler* monitor_profiler;
+	char* reload_trace_file;
+	ReloadTrace* reload_trace;
+	char* probe_methods;
+	char* method_timing_file;
+	// class file load hook loads it once, it's stopped only once no hook uses it
+	_Atomic(MethodProbes*) method_probes;
+	char* heap_histogram_file;
+	char* heap_histogram_diff_file;
+	// heap histogram taken right before classes are redefined becomes baseline of the next dump
+	bool heap_histogram_reload;
+	// histogram is created on first use, either by a command or by a reload
+	HeapHistogram* heap_histogram;
+	pthread_mutex_t heap_histogram_mutex;
+	int thread_cpu_sampling_period_ms;
+	int thread_cpu_top;
+	char* thread_cpu_report_file;
+	char* thread_cpu_profile_file;
+	ThreadCpuSampler* thread_cpu_sampler;
+	int class_load_timeline_s;
+	char* class_load_trace_file;
+	char* class_load_summary_file;
+	// class load events load it once each, it's freed only once none of them uses it
+	_Atomic(ClassLoadTimeline*) class_load_timeline;
+	// classes which aren't loaded get the latest bytes from the watcher when they are defined
+	PatchTable* patch_table;
+	// set before the first patch is kept, patches are never removed so it's never cleared
+	atomic_bool patching;
+	pthread_mutex_t class_file_load_hook_mutex;
+	// classes of classes dir indexed by what their constant pools reference, so dependents of reloaded classes are reported
+	bool dependency_indexing;
+	char* dependents_report_file;
+	DependencyIndex* dependency_index;
 } AgentData;
 
+static AgentData agent_data;
+
+typedef struct {
+	const char* class_name;
+	const uint8_t* class_bytes;
+	jint class_bytes_count;
+	// NULL if batch wasn't parsed
+	const JClass* loaded_class;
+} ClassUpdate;
+
 static atomic_uintptr_t agent_data_ref = ATOMIC_VAR_INIT(0);
 
-static void log_debug(const char* format, ...) {
-	va_list args;
-	va_start(args, format);
+// event handlers which may still use agent state, detached agent frees it once none is left
+static atomic_uint event_handlers_in_flight = ATOMIC_VAR_INIT(0);
+// cleared on detach, handler which was already dispatched returns without touching agent state
+static atomic_bool event_handlers_active = ATOMIC_VAR_INIT(false);
+
+// class load event handlers which may still use the timeline they loaded
+static atomic_uint timeline_handlers_in_flight = ATOMIC_VAR_INIT(0);
+// class file load hooks which may still be probing classes with the probes they loaded
+static atomic_uint probe_hooks_in_flight = ATOMIC_VAR_INIT(0);
+
+void log_debug(const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+
+	AgentData* agent_data = (AgentData*)atomic_load(&agent_data_ref);
+	FILE* log_file = agent_data->log_file;
+
+	vfprintf(log_file, format, args);
+	va_end(args);
+
+	fprintf(log_file, "\n");
+
+	fflush(log_file);
+}
+
+// returns NULL if agent is being detached, otherwise handler has to call leave_event_handler() when it's done
+static AgentData* enter_event_handler(void) {
+	atomic_fetch_add(&event_handlers_in_flight, 1);
+
+	if (!atomic_load(&event_handlers_active)) {
+		atomic_fetch_sub(&event_handlers_in_flight, 1);
+		return NULL;
+	}
+
+	return (AgentData*)atomic_load(&agent_data_ref);
+}
+
+static void leave_event_handler(void) {
+	atomic_fetch_sub(&event_handlers_in_flight, 1);
+}
+
+static void* retain_class_ref(void* class_ref, void* jni) {
+	return (*(JNIEnv*)jni)->NewGlobalRef((JNIEnv*)jni, class_ref);
+}
+
+// looking up indexed class by internal form name, e.g. "com/acme/Service", class of the same name defined
+// by another loader replaces indexed one and its ref is deleted, so caller gets its own global ref to delete
+static jclass find_class(AgentData* agent_data, JNIEnv* jni, const char* class_name) {
+	StrHandle class_name_handle = str_arena_find(agent_data->class_names, class_name, strnlen(class_name, PATH_MAX));
+	if (class_name_handle == 0) {
+		return NULL;
+	}
+
+	return symbol_map_get_retained(agent_data->classes, class_name_handle, retain_class_ref, jni);
+}
+
+// heap histogram uses its own environment, so it's created on first use only
+static HeapHistogram* get_heap_histogram(AgentData* agent_data) {
+	pthread_mutex_lock(&agent_data->heap_histogram_mutex);
+
+	if (agent_data->heap_histogram == NULL) {
+		agent_data->heap_histogram = heap_histogram_new(agent_data->jvm, agent_data->class_names, agent_data->classes);
+		if (agent_data->heap_histogram == NULL) {
+			log_debug("failed to create heap histogram");
+		}
+	}
+
+	HeapHistogram* heap_histogram = agent_data->heap_histogram;
+
+	pthread_mutex_unlock(&agent_data->heap_histogram_mutex);
+
+	return heap_histogram;
+}
+
+static void mark_heap_histogram_baseline(AgentData* agent_data) {
+	JNIEnv* jni = NULL;
+	if ((*agent_data->jvm)->GetEnv(agent_data->jvm, (void**)&jni, JNI_VERSION_1_6) != JNI_OK) {
+		return;
+	}
+
+	HeapHistogram* heap_histogram = get_heap_histogram(agent_data);
+	if (heap_histogram != NULL && !heap_histogram_mark_baseline(heap_histogram, jni)) {
+		log_debug("failed to take heap histogram before reload");
+	}
+}
+
+static bool is_class_load_timeline_recording(AgentData* agent_data) {
+	ClassLoadTimeline* class_load_timeline = atomic_load(&agent_data->class_load_timeline);
+	return class_load_timeline != NULL && class_load_timeline_recording(class_load_timeline);
+}
+
+// class file load hook is shared by method probes, class load timeline and pending patches,
+// it's enabled while any of them needs it
+static bool update_class_file_load_hook_mode(AgentData* agent_data) {
+	pthread_mutex_lock(&agent_data->class_file_load_hook_mutex);
+
+	bool hook_needed = atomic_load(&agent_data->method_probes) != NULL || is_class_load_timeline_recording(agent_data)
+			|| atomic_load(&agent_data->patching);
+
+	jvmtiError error = (*agent_data->jvmti)->SetEventNotificationMode(agent_data->jvmti,
+			hook_needed ? JVMTI_ENABLE : JVMTI_DISABLE, JVMTI_EVENT_CLASS_FILE_LOAD_HOOK, NULL);
+
+	pthread_mutex_unlock(&agent_data->class_file_load_hook_mutex);
+
+	if (error != JVMTI_ERROR_NONE) {
+		log_debug("failed to set 'CLASS_FILE_LOAD_HOOK' event notification mode - error: %d", error);
+		return false;
+	}
+
+	return true;
+}
+
+// dependents are reported before classes are redefined, they need recompiled bytes whether redefinition succeeds or not
+static void report_dependents(AgentData* agent_data, const ClassUpdate* class_updates, size_t class_updates_count) {
+	if (class_updates_count == 0) {
+		return;
+	}
+
+	const JClass* loaded_classes[class_updates_count];
+	size_t loaded_classes_count = 0;
+
+	for (size_t class_idx = 0;class_idx < class_updates_count;class_idx++) {
+		if (class_updates[class_idx].loaded_class != NULL) {
+			loaded_classes[loaded_classes_count++] = class_updates[class_idx].loaded_class;
+		}
+	}
+
+	size_t dependents_count = dependency_index_prepare_batch(agent_data->dependency_index, loaded_classes,
+			loaded_classes_count, agent_data->dependents_report_file);
+	if (dependents_count > 0) {
+		log_debug("%zu dependent classes outside of the batch need recompiled bytes", dependents_count);
+	}
+}
+
+// redefining classes of the batch in a single call, classes which aren't loaded are patched once they are defined
+static void redefine_classes(AgentData* agent_data, const ClassUpdate* class_updates, size_t class_updates_count) {
+	if (agent_data->dependency_index != NULL) {
+		report_dependents(agent_data, class_updates, class_updates_count);
+	}
+
+	JNIEnv* jni = NULL;
+	if ((*agent_data->jvm)->GetEnv(agent_data->jvm, (void**)&jni, JNI_VERSION_1_6) != JNI_OK) {
+		log_debug("failed to get JNI environment - classes aren't redefined");
+		return;
+	}
+
+	jvmtiClassDefinition class_definitions[class_updates_count];
+	const char* class_names[class_updates_count];
+	jint classes_count = 0;
+
+	// class file load hook is enabled before the first patch is kept, so class defined right after it gets the patch
+	if (!atomic_load(&agent_data->patching)) {
+		atomic_store(&agent_data->patching, true);
+		update_class_file_load_hook_mode(agent_data);
+	}
+
+	for (size_t class_idx = 0;class_idx < class_updates_count;class_idx++) {
+		const ClassUpdate* class_update = &class_updates[class_idx];
+
+		// loaded classes are patched too, so class loaders created later define the latest version
+		if (!patch_table_put(agent_data->patch_table, class_update->class_name, class_update->class_bytes,
+				class_update->class_bytes_count)) {
+			log_debug("failed to keep patch of class: %s", class_update->class_name);
+		}
+
+		jclass klass = find_class(agent_data, jni, class_update->class_name);
+		if (klass == NULL) {
+			log_debug("class is not loaded, patch is pending: %s", class_update->class_name);
+			continue;
+		}
+
+		class_definitions[classes_count].klass = klass;
+		class_definitions[classes_count].class_byte_count = class_update->class_bytes_count;
+		class_definitions[classes_count].class_bytes = class_update->class_bytes;
+		class_names[classes_count] = class_update->class_name;
+		classes_count += 1;
+
+		log_debug("redefining class: %s", class_update->class_name);
+	}
+
+	if (classes_count == 0) {
+		return;
+	}
+
+	if (agent_data->heap_histogram_reload) {
+		mark_heap_histogram_baseline(agent_data);
+	}
+
+	if (agent_data->reload_trace != NULL) {
+		reload_trace_begin(agent_data->reload_trace, class_names, classes_count);
+	}
+
+	jvmtiError error = (*agent_data->jvmti)->RedefineClasses(agent_data->jvmti, classes_count, class_definitions);
+
+	if (agent_data->reload_trace != NULL) {
+		reload_trace_end(agent_data->reload_trace, error);
+	}
+
+	if (error != JVMTI_ERROR_NONE) {
+		log_debug("failed to redefine classes - error code: %d", error);
+	} else {
+		log_debug("%d classes redefined", classes_count);
+	}
+
+	for (jint class_idx = 0;class_idx < classes_count;class_idx++) {
+		(*jni)->DeleteGlobalRef(jni, class_definitions[class_idx].klass);
+	}
+}
+
+static bool is_class_file_name(const char* file_name) {
+	size_t file_name_len = strnlen(file_name, NAME_MAX);
+
+	return file_name_len > 6 && strcmp(file_name + file_name_len - 6, ".class") == 0;
+}
+
+static char* new_class_file_path(AgentData* agent_data, const char* file_name) {
+	// class dir path + '/' + class file name + '\0'
+	size_t class_file_path_size = strnlen(agent_data->classes_dir, PATH_MAX) + 1 + strnlen(file_name, NAME_MAX) + 1;
+	char* class_file_path = malloc(class_file_path_size);
+	if (class_file_path == NULL) {
+		return NULL;
+	}
+
+	snprintf(class_file_path, class_file_path_size, "%s/%s", agent_data->classes_dir, file_name);
+
+	return class_file_path;
+}
+
+// collecting class files changed according to events of a single read, duplicates are dropped
+// once max_class_files are collected, event position is left at the first event of the next chunk
+static size_t collect_class_files(AgentData* agent_data, const char** event_pos, const char* events_end,
+		char** class_file_paths, size_t max_class_files) {
+	size_t class_files_count = 0;
+
+	while (*event_pos < events_end) {
+		const struct inotify_event* event = (const struct inotify_event*)*event_pos;
+		if (event->len == 0 || !is_class_file_name(event->name)) {
+			*event_pos += sizeof(struct inotify_event) + event->len;
+			continue;
+		}
+
+		char* class_file_path = new_class_file_path(agent_data, event->name);
+		if (class_file_path == NULL) {
+			*event_pos += sizeof(struct inotify_event) + event->len;
+			continue;
+		}
+
+		bool duplicate = false;
+		for (size_t file_idx = 0;file_idx < class_files_count && !duplicate;file_idx++) {
+			duplicate = strcmp(class_file_paths[file_idx], class_file_path) == 0;
+		}
+
+		if (!duplicate && class_files_count == max_class_files) {
+			free(class_file_path);
+			break;
+		}
+
+		*event_pos += sizeof(struct inotify_event) + event->len;
+
+		if (duplicate) {
+			free(class_file_path);
+			continue;
+		}
+
+		log_debug("class file %s changed", class_file_path);
+
+		class_file_paths[class_files_count++] = class_file_path;
+	}
+
+	return class_files_count;
+}
+
+static bool is_class_file_bytes(const uint8_t* class_bytes, size_t class_bytes_count) {
+	return class_bytes_count >= 10 && class_bytes[0] == 0xCA && class_bytes[1] == 0xFE
+			&& class_bytes[2] == 0xBA && class_bytes[3] == 0xBE;
+}
+
+// files of the batch are read with a single io_uring submission when available, then parsed
+// for class names and redefined all at once
+static void redefine_class_files(AgentData* agent_data, ClassFileReader* class_file_reader, char** class_file_paths,
+		size_t class_files_count) {
+	ClassFileRead class_files[class_files_count];
+	for (size_t file_idx = 0;file_idx < class_files_count;file_idx++) {
+		class_files[file_idx].path = class_file_paths[file_idx];
+	}
+
+	class_file_reader_read(class_file_reader, class_files, class_files_count);
+
+	ClassUpdate class_updates[class_files_count];
+	JClass* loaded_classes[class_files_count];
+	size_t class_updates_count = 0;
+
+	for (size_t file_idx = 0;file_idx < class_files_count;file_idx++) {
+		const ClassFileRead* class_file = &class_files[file_idx];
+		if (class_file->error != 0) {
+			log_debug("failed to read class file %s - error: %d", class_file->path, class_file->error);
+			continue;
+		}
+
+		const uint8_t* class_bytes = class_file->bytes;
+		if (!is_class_file_bytes(class_bytes, class_file->bytes_count)) {
+			log_debug("invalid class file: %s", class_file->path);
+			continue;
+		}
+
+		JClass* loaded_class = jclass_load(class_bytes, class_file->bytes_count);
+		if (loaded_class == NULL) {
+			log_debug("failed to parse class file: %s", class_file->path);
+			continue;
+		}
+
+		loaded_classes[class_updates_count] = loaded_class;
+		class_updates[class_updates_count].class_name = loaded_class->name;
+		class_updates[class_updates_count].class_bytes = class_bytes;
+		class_updates[class_updates_count].class_bytes_count = class_file->bytes_count;
+		class_updates[class_updates_count].loaded_class = loaded_class;
+		class_updates_count += 1;
+	}
+
+	redefine_classes(agent_data, class_updates, class_updates_count);
+
+	for (size_t class_idx = 0;class_idx < class_updates_count;class_idx++) {
+		jclass_free(loaded_classes[class_idx]);
+	}
+}
+
+static void index_class_files(AgentData* agent_data, ClassFileReader* class_file_reader, char** class_file_paths,
+		size_t class_files_count) {
+	ClassFileRead class_files[class_files_count];
+	for (size_t file_idx = 0;file_idx < class_files_count;file_idx++) {
+		class_files[file_idx].path = class_file_paths[file_idx];
+	}
+
+	class_file_reader_read(class_file_reader, class_files, class_files_count);
+
+	for (size_t file_idx = 0;file_idx < class_files_count;file_idx++) {
+		const ClassFileRead* class_file = &class_files[file_idx];
+		if (class_file->error != 0 || !is_class_file_bytes(class_file->bytes, class_file->bytes_count)) {
+			continue;
+		}
+
+		JClass* loaded_class = jclass_load(class_file->bytes, class_file->bytes_count);
+		if (loaded_class == NULL) {
+			log_debug("failed to parse class file: %s", class_file->path);
+			continue;
+		}
+
+		dependency_index_add(agent_data->dependency_index, loaded_class);
+		jclass_free(loaded_class);
+	}
+}
+
+// class files which are in classes dir already are indexed once on service thread, batches keep index up to date
+static void build_dependency_index(AgentData* agent_data) {
+	DIR* classes_dir = opendir(agent_data->classes_dir);
+	if (classes_dir == NULL) {
+		log_debug("failed to open classes dir, dependency index starts empty: %s", agent_data->classes_dir);
+		return;
+	}
+
+	ClassFileReader* class_file_reader = class_file_reader_new(MAX_BATCH_CLASS_FILES, CLASS_FILE_BUFFER_SIZE);
+	if (class_file_reader == NULL) {
+		log_debug("failed to create class file reader, dependency index starts empty");
+		closedir(classes_dir);
+		return;
+	}
+
+	char* class_file_paths[MAX_BATCH_CLASS_FILES];
+	size_t class_files_count = 0;
+	bool listed = false;
+
+	while (!listed) {
+		struct dirent* dir_entry = readdir(classes_dir);
+		listed = dir_entry == NULL;
+
+		if (!listed && is_class_file_name(dir_entry->d_name)) {
+			char* class_file_path = new_class_file_path(agent_data, dir_entry->d_name);
+			if (class_file_path != NULL) {
+				class_file_paths[class_files_count++] = class_file_path;
+			}
+		}
+
+		if (class_files_count == MAX_BATCH_CLASS_FILES || (listed && class_files_count > 0)) {
+			index_class_files(agent_data, class_file_reader, class_file_paths, class_files_count);
+
+			for (size_t file_idx = 0;file_idx < class_files_count;file_idx++) {
+				free(class_file_paths[file_idx]);
+			}
+
+			class_files_count = 0;
+		}
+	}
+
+	class_file_reader_free(class_file_reader);
+	closedir(classes_dir);
+
+	log_debug("dependency index: %zu classes", dependency_index_count(agent_data->dependency_index));
+}
+
+static void* redefine_class_activity(void* arg) {
+	AgentData* agent_data = (AgentData*)atomic_load(&agent_data_ref);
+
+	JNIEnv* jni = NULL;
+	jint attach_thread_status = (*agent_data->jvm)->AttachCurrentThreadAsDaemon(agent_data->jvm, (void**)&jni, NULL);
+	if (attach_thread_status != JNI_OK) {
+		log_debug("failed to attach 'redefine class' thread");
+		return NULL;
+	}
+
+	ClassFileReader* class_file_reader = class_file_reader_new(MAX_BATCH_CLASS_FILES, CLASS_FILE_BUFFER_SIZE);
+	if (class_file_reader == NULL) {
+		log_debug("failed to create class file reader");
+		(*agent_data->jvm)->DetachCurrentThread(agent_data->jvm);
+		return NULL;
+	}
+
+	log_debug("'redefine class' thread is running - io_uring reads: %s",
+			class_file_reader_uses_io_uring(class_file_reader) ? "enabled" : "disabled");
+
+	if (agent_data->dependency_index != NULL) {
+		build_dependency_index(agent_data);
+	}
+
+	// single read returns all queued events that fit the buffer, they make up one batch
+	char event_buf[MAX_BATCH_CLASS_FILES * (sizeof(struct inotify_event) + NAME_MAX + 1)]
+			__attribute__((aligned(__alignof__(struct inotify_event))));
+
+	for (;;) {
+		log_debug("watching classes directory: %s", agent_data->classes_dir);
+
+		ssize_t events_size = read(agent_data->inotify_fd, event_buf, sizeof(event_buf));
+		if (events_size == 0 || events_size == -1) {
+			log_debug("failed to read event - stopping 'redefine class' thread");
+			break;
+		}
+
+		// removing the watch on detach wakes us up with IN_IGNORED event
+		if (!atomic_load(&agent_data->watching)) {
+			break;
+		}
+
+		// rebuild may change more classes than a batch holds, they are redefined in chunks of a batch size
+		const char* event_pos = event_buf;
+		while (event_pos < event_buf + events_size) {
+			char* class_file_paths[MAX_BATCH_CLASS_FILES];
+			size_t class_files_count = collect_class_files(agent_data, &event_pos, event_buf + events_size,
+					class_file_paths, MAX_BATCH_CLASS_FILES);
+
+			if (class_files_count > 0) {
+				redefine_class_files(agent_data, class_file_reader, class_file_paths, class_files_count);
+			}
+
+			for (size_t file_idx = 0;file_idx < class_files_count;file_idx++) {
+				free(class_file_paths[file_idx]);
+			}
+		}
+	}
+
+	log_debug("'redefine class' thread stopping...");
+
+	class_file_reader_free(class_file_reader);
+
+	(*agent_data->jvm)->DetachCurrentThread(agent_data->jvm);
+
+	return NULL;
+}
+
+// batch classes are parsed only to keep dependency index up to date, daemon resolved their names already
+static void redefine_ring_batch(AgentData* agent_data, const ShmRingBatch* batch) {
+	ClassUpdate class_updates[batch->classes_count];
+	JClass* loaded_classes[batch->classes_count];
+
+	for (uint32_t class_idx = 0;class_idx < batch->classes_count;class_idx++) {
+		class_updates[class_idx].class_name = batch->classes[class_idx].class_name;
+		class_updates[class_idx].class_bytes = batch->classes[class_idx].class_bytes;
+		class_updates[class_idx].class_bytes_count = batch->classes[class_idx].class_bytes_count;
+
+		loaded_classes[class_idx] = NULL;
+		if (agent_data->dependency_index != NULL
+				&& is_class_file_bytes(class_updates[class_idx].class_bytes, class_updates[class_idx].class_bytes_count)) {
+			loaded_classes[class_idx] = jclass_load(class_updates[class_idx].class_bytes,
+					class_updates[class_idx].class_bytes_count);
+		}
+
+		class_updates[class_idx].loaded_class = loaded_classes[class_idx];
+	}
+
+	log_debug("redefining batch %llu", (unsigned long long)batch->batch_id);
+
+	redefine_classes(agent_data, class_updates, batch->classes_count);
+
+	for (uint32_t class_idx = 0;class_idx < batch->classes_count;class_idx++) {
+		if (loaded_classes[class_idx] != NULL) {
+			jclass_free(loaded_classes[class_idx]);
+		}
+	}
+}
+
+// classes dir is watched by reload daemon, agent only redefines batches it publishes to shared memory ring
+static void* ring_redefine_class_activity(void* arg) {
+	AgentData* agent_data = (AgentData*)atomic_load(&agent_data_ref);
+
+	JNIEnv* jni = NULL;
+	jint attach_thread_status = (*agent_data->jvm)->AttachCurrentThreadAsDaemon(agent_data->jvm, (void**)&jni, NULL);
+	if (attach_thread_status != JNI_OK) {
+		log_debug("failed to attach 'redefine class' thread");
+		return NULL;
+	}
+
+	log_debug("'redefine class' thread is running");
+
+	if (agent_data->dependency_index != NULL) {
+		build_dependency_index(agent_data);
+	}
+
+	ShmRing* ring = NULL;
+	uint64_t cursor = 0;
+	bool untrusted_ring_logged = false;
+
+	while (atomic_load(&agent_data->watching)) {
+		// daemon may be started after the agent, or restarted with a new ring
+		if (ring == NULL) {
+			ring = shm_ring_open(agent_data->shm_ring_name, agent_data->shm_ring_owner_uid);
+			if (ring == NULL) {
+				if (errno == EPERM && !untrusted_ring_logged) {
+					log_debug("ring %s isn't owned by uid %u or is writable by others - ignoring it",
+							agent_data->shm_ring_name, (unsigned)agent_data->shm_ring_owner_uid);
+					untrusted_ring_logged = true;
+				}
+
+				struct timespec retry_period = { RING_WAIT_TIMEOUT_MS / 1000, (RING_WAIT_TIMEOUT_MS % 1000) * 1000000L };
+				nanosleep(&retry_period, NULL);
+				continue;
+			}
+
+			// only batches published from now on are redefined
+			cursor = shm_ring_head(ring);
+
+			log_debug("consuming shared memory ring: %s", agent_data->shm_ring_name);
+		}
+
+		ShmRingBatch batch;
+		ShmRingStatus status = shm_ring_wait_batch(ring, &cursor, RING_WAIT_TIMEOUT_MS, &batch);
+		if (status == ShmRingBatchReady) {
+			redefine_ring_batch(agent_data, &batch);
+			shm_ring_batch_free(&batch);
+		} else if (status == ShmRingOverrun) {
+			log_debug("reload batches lost - ring was overwritten");
+		} else if (status == ShmRingError) {
+			log_debug("ring was replaced or can't be waited on - reopening ring");
+			shm_ring_close(ring);
+			ring = NULL;
+		}
+	}
+
+	if (ring != NULL) {
+		shm_ring_close(ring);
+	}
+
+	log_debug("'redefine class' thread stopping...");
+
+	(*agent_data->jvm)->DetachCurrentThread(agent_data->jvm);
+
+	return NULL;
+}
+
+static void index_class(jvmtiEnv* jvmti, JNIEnv* jni, jclass klass) {
+	char* class_signature;
+	jvmtiError error = (*jvmti)->GetClassSignature(jvmti, klass, &class_signature, NULL);
+	if (error != JVMTI_ERROR_NONE) {
+		log_debug("failed to get class signature");
+	} else {
+		log_debug("class loaded: %s", class_signature);
+
+		AgentData* agent_data = (AgentData*)atomic_load(&agent_data_ref);
+
+		// "Lcom/acme/Service;" signature is indexed as "com/acme/Service"
+		size_t class_signature_len = strlen(class_signature);
+		StrHandle class_name_handle = 0;
+		if (class_signature_len > 2 && class_signature[0] == 'L') {
+			class_name_handle = str_arena_intern(agent_data->class_names, class_signature + 1, class_signature_len - 2);
+		}
+
+		if (class_name_handle != 0) {
+			jclass class_ref = (*jni)->NewGlobalRef(jni, klass);
+
+			// class of the same name defined by another class loader replaces the previous one,
+			// readers of the index hold their own refs, so the previous one can be deleted right away
+			void* previous_class_ref = NULL;
+			if (!symbol_map_put(agent_data->classes, class_name_handle, class_ref, &previous_class_ref)) {
+				log_debug("failed to index class: %s", class_signature);
+				(*jni)->DeleteGlobalRef(jni, class_ref);
+			} else if (previous_class_ref != NULL) {
+				(*jni)->DeleteGlobalRef(jni, previous_class_ref);
+			}
+		}
+
+		(*jvmti)->Deallocate(jvmti, (unsigned char*)class_signature);
+	}
+}
+
+static void JNICALL ClassPreparedHandler(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread, jclass klass) {
+	AgentData* agent_data = enter_event_handler();
+	if (agent_data == NULL) {
+		return;
+	}
+
+	index_class(jvmti, jni, klass);
+
+	atomic_fetch_add(&timeline_handlers_in_flight, 1);
+	ClassLoadTimeline* class_load_timeline = atomic_load(&agent_data->class_load_timeline);
+	if (class_load_timeline != NULL) {
+		class_load_timeline_class_prepared(class_load_timeline, jvmti, jni, klass);
+	}
+	atomic_fetch_sub(&timeline_handlers_in_flight, 1);
+
+	leave_event_handler();
+}
+
+static void JNICALL ClassLoadHandler(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread, jclass klass) {
+	AgentData* agent_data = enter_event_handler();
+	if (agent_data == NULL) {
+		return;
+	}
+
+	atomic_fetch_add(&timeline_handlers_in_flight, 1);
+	ClassLoadTimeline* class_load_timeline = atomic_load(&agent_data->class_load_timeline);
+	if (class_load_timeline != NULL) {
+		class_load_timeline_class_loaded(class_load_timeline, jvmti, jni, klass);
+	}
+	atomic_fetch_sub(&timeline_handlers_in_flight, 1);
+
+	leave_event_handler();
+}
+
+// building class index from already loaded classes when agent is attached to running VM
+static bool index_loaded_classes(jvmtiEnv* jvmti, JNIEnv* jni) {
+	jint classes_count = 0;
+	jclass* classes = NULL;
+	jvmtiError error = (*jvmti)->GetLoadedClasses(jvmti, &classes_count, &classes);
+	if (error != JVMTI_ERROR_NONE) {
+		log_debug("failed to get loaded classes - error: %d", error);
+		return false;
+	}
+
+	log_debug("indexing %d loaded classes", classes_count);
+
+	for (jint class_idx = 0;class_idx < classes_count;class_idx++) {
+		jint class_status = 0;
+		error = (*jvmti)->GetClassStatus(jvmti, classes[class_idx], &class_status);
+
+		// array and primitive classes can't be redefined, not prepared classes will be reported by 'CLASS_PREPARE' event
+		if (error == JVMTI_ERROR_NONE && (class_status & JVMTI_CLASS_STATUS_PREPARED) != 0
+				&& (class_status & (JVMTI_CLASS_STATUS_ARRAY | JVMTI_CLASS_STATUS_PRIMITIVE)) == 0) {
+			index_class(jvmti, jni, classes[class_idx]);
+		}
+
+		(*jni)->DeleteLocalRef(jni, classes[class_idx]);
+	}
+
+	(*jvmti)->Deallocate(jvmti, (unsigned char*)classes);
+
+	AgentData* agent_data = (AgentData*)atomic_load(&agent_data_ref);
+	log_debug("class index: %zu interned names, %zu bytes", str_arena_count(agent_data->class_names),
+			str_arena_size_bytes(agent_data->class_names));
+
+	return true;
+}
+
+static bool start_redefine_class_thread(AgentData* agent_data) {
+	atomic_store(&agent_data->watching, true);
+
+	void* (*activity)(void*) = agent_data->shm_ring_name != NULL ? ring_redefine_class_activity : redefine_class_activity;
+
+	int thread_create_status = pthread_create(&agent_data->redefine_class_thread, NULL, activity, NULL);
+	if (thread_create_status != 0) {
+		atomic_store(&agent_data->watching, false);
+
+		log_debug("failed to start 'redefine class' service thread");
+		return false;
+	}
+
+	log_debug("'redefine class' service thread started");
+
+	return true;
+}
+
+static void stop_redefine_class_thread(AgentData* agent_data) {
+	if (!atomic_exchange(&agent_data->watching, false)) {
+		return;
+	}
+
+	// ring consumer notices stop on its next wait timeout
+	if (agent_data->shm_ring_name == NULL) {
+		inotify_rm_watch(agent_data->inotify_fd, agent_data->inotify_watch_fd);
+	}
+
+	pthread_join(agent_data->redefine_class_thread, NULL);
+
+	log_debug("'redefine class' service thread stopped");
+}
+
+static void JNICALL SampledObjectAllocHandler(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread, jobject object,
+		jclass object_class, jlong size) {
+	AgentData* agent_data = enter_event_handler();
+	if (agent_data == NULL) {
+		return;
+	}
+	if (agent_data->heap_profiler != NULL) {
+		heap_profiler_record_alloc(agent_data->heap_profiler, jvmti, object, object_class, size);
+	}
+
+	leave_event_handler();
+}
+
+static void JNICALL ObjectFreeHandler(jvmtiEnv* jvmti, jlong tag) {
+	AgentData* agent_data = enter_event_handler();
+	if (agent_data == NULL) {
+		return;
+	}
+	if (agent_data->heap_profiler != NULL) {
+		heap_profiler_record_free(agent_data->heap_profiler, tag);
+	}
+
+	leave_event_handler();
+}
+
+static bool set_heap_profiler_events_mode(jvmtiEnv* jvmti, jvmtiEventMode mode) {
+	jvmtiError error = (*jvmti)->SetEventNotificationMode(jvmti, mode, JVMTI_EVENT_SAMPLED_OBJECT_ALLOC, NULL);
+	if (error != JVMTI_ERROR_NONE) {
+		log_debug("failed to change 'SAMPLED_OBJECT_ALLOC' event notification mode - error: %d", error);
+		return false;
+	}
+
+	error = (*jvmti)->SetEventNotificationMode(jvmti, mode, JVMTI_EVENT_OBJECT_FREE, NULL);
+	if (error != JVMTI_ERROR_NONE) {
+		log_debug("failed to change 'OBJECT_FREE' event notification mode - error: %d", error);
+		return false;
+	}
+
+	return true;
+}
+
+static void JNICALL MonitorContendedEnterHandler(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread, jobject monitor) {
+	AgentData* agent_data = enter_event_handler();
+	if (agent_data == NULL) {
+		return;
+	}
+	if (agent_data->monitor_profiler != NULL) {
+		monitor_profiler_contended_enter(agent_data->monitor_profiler);
+	}
+
+	leave_event_handler();
+}
+
+static void JNICALL MonitorContendedEnteredHandler(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread, jobject monitor) {
+	AgentData* agent_data = enter_event_handler();
+	if (agent_data == NULL) {
+		return;
+	}
+	if (agent_data->monitor_profiler != NULL) {
+		monitor_profiler_contended_entered(agent_data->monitor_profiler, jvmti, jni, monitor);
+	}
+
+	leave_event_handler();
+}
+
+static bool set_monitor_profiler_events_mode(jvmtiEnv* jvmti, jvmtiEventMode mode) {
+	jvmtiError error = (*jvmti)->SetEventNotificationMode(jvmti, mode, JVMTI_EVENT_MONITOR_CONTENDED_ENTER, NULL);
+	if (error != JVMTI_ERROR_NONE) {
+		log_debug("failed to change 'MONITOR_CONTENDED_ENTER' event notification mode - error: %d", error);
+		return false;
+	}
+
+	error = (*jvmti)->SetEventNotificationMode(jvmti, mode, JVMTI_EVENT_MONITOR_CONTENDED_ENTERED, NULL);
+	if (error != JVMTI_ERROR_NONE) {
+		log_debug("failed to change 'MONITOR_CONTENDED_ENTERED' event notification mode - error: %d", error);
+		return false;
+	}
+
+	return true;
+}
+
+static void JNICALL GarbageCollectionStartHandler(jvmtiEnv* jvmti) {
+	AgentData* agent_data = enter_event_handler();
+	if (agent_data == NULL) {
+		return;
+	}
+	if (agent_data->reload_trace != NULL) {
+		reload_trace_gc_start(agent_data->reload_trace);
+	}
+
+	leave_event_handler();
+}
+
+static void JNICALL GarbageCollectionFinishHandler(jvmtiEnv* jvmti) {
+	AgentData* agent_data = enter_event_handler();
+	if (agent_data == NULL) {
+		return;
+	}
+	if (agent_data->reload_trace != NULL) {
+		reload_trace_gc_finish(agent_data->reload_trace);
+	}
+
+	leave_event_handler();
+}
+
+static void JNICALL CompiledMethodLoadHandler(jvmtiEnv* jvmti, jmethodID method, jint code_size, const void* code_addr,
+		jint map_length, const jvmtiAddrLocationMap* map, const void* compile_info) {
+	AgentData* agent_data = enter_event_handler();
+	if (agent_data == NULL) {
+		return;
+	}
+	if (agent_data->reload_trace != NULL) {
+		reload_trace_method_load(agent_data->reload_trace, jvmti, method);
+	}
+
+	leave_event_handler();
+}
+
+static void JNICALL CompiledMethodUnloadHandler(jvmtiEnv* jvmti, jmethodID method, const void* code_addr) {
+	AgentData* agent_data = enter_event_handler();
+	if (agent_data == NULL) {
+		return;
+	}
+	if (agent_data->reload_trace != NULL) {
+		reload_trace_method_unload(agent_data->reload_trace);
+	}
+
+	leave_event_handler();
+}
+
+static const jvmtiEvent RELOAD_TRACE_EVENTS[] = {
+	JVMTI_EVENT_GARBAGE_COLLECTION_START,
+	JVMTI_EVENT_GARBAGE_COLLECTION_FINISH,
+	JVMTI_EVENT_COMPILED_METHOD_LOAD,
+	JVMTI_EVENT_COMPILED_METHOD_UNLOAD
+};
+
+static bool set_reload_trace_events_mode(jvmtiEnv* jvmti, jvmtiEventMode mode) {
+	size_t events_count = sizeof(RELOAD_TRACE_EVENTS) / sizeof(jvmtiEvent);
+	for (size_t event_idx = 0;event_idx < events_count;event_idx++) {
+		jvmtiError error = (*jvmti)->SetEventNotificationMode(jvmti, mode, RELOAD_TRACE_EVENTS[event_idx], NULL);
+		if (error != JVMTI_ERROR_NONE) {
+			log_debug("failed to change event %d notification mode - error: %d", RELOAD_TRACE_EVENTS[event_idx], error);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void start_reload_trace(AgentData* agent_data, int window_ms) {
+	agent_data->reload_trace = reload_trace_start(agent_data->reload_trace_file, window_ms > 0 ? window_ms : 0);
+	if (agent_data->reload_trace == NULL) {
+		log_debug("failed to start reload trace: %s", agent_data->reload_trace_file);
+	} else if (!set_reload_trace_events_mode(agent_data->jvmti, JVMTI_ENABLE)) {
+		reload_trace_stop(agent_data->reload_trace);
+		agent_data->reload_trace = NULL;
+	} else {
+		log_debug("reload trace started: %s", agent_data->reload_trace_file);
+	}
+}
+
+static void stop_reload_trace(AgentData* agent_data) {
+	if (agent_data->reload_trace != NULL) {
+		set_reload_trace_events_mode(agent_data->jvmti, JVMTI_DISABLE);
+
+		reload_trace_stop(agent_data->reload_trace);
+		agent_data->reload_trace = NULL;
+	}
+}
+
+static void JNICALL ClassFileLoadHookHandler(jvmtiEnv* jvmti, JNIEnv* jni, jclass class_being_redefined, jobject loader,
+		const char* name, jobject protection_domain, jint class_data_len, const unsigned char* class_data,
+		jint* new_class_data_len, unsigned char** new_class_data) {
+	AgentData* agent_data = enter_event_handler();
+	if (agent_data == NULL) {
+		return;
+	}
+
+	// timeline covers class definitions, redefinitions are not recorded
+	if (class_being_redefined == NULL) {
+		atomic_fetch_add(&timeline_handlers_in_flight, 1);
+		ClassLoadTimeline* class_load_timeline = atomic_load(&agent_data->class_load_timeline);
+		if (class_load_timeline != NULL) {
+			class_load_timeline_hook(class_load_timeline, jvmti, jni, loader, name, class_data_len);
+		}
+		atomic_fetch_sub(&timeline_handlers_in_flight, 1);
+	}
+
+	// redefined classes already get the bytes of the patch
+	const unsigned char* class_bytes = class_data;
+	jint class_bytes_count = class_data_len;
+	if (class_being_redefined == NULL
+			&& patch_table_apply(agent_data->patch_table, jvmti, name, new_class_data_len, new_class_data)) {
+		log_debug("pending patch applied: %s", name);
+
+		class_bytes = *new_class_data;
+		class_bytes_count = *new_class_data_len;
+	}
+
+	// patched class is probed as if it was loaded from the patched class file
+	atomic_fetch_add(&probe_hooks_in_flight, 1);
+	MethodProbes* method_probes = atomic_load(&agent_data->method_probes);
+	if (method_probes != NULL) {
+		unsigned char* patched_class_bytes = class_bytes != class_data ? *new_class_data : NULL;
+		if (method_probes_transform(method_probes, jvmti, name, class_bytes_count, class_bytes,
+				new_class_data_len, new_class_data) && patched_class_bytes != NULL) {
+			(*jvmti)->Deallocate(jvmti, patched_class_bytes);
+		}
+	}
+	atomic_fetch_sub(&probe_hooks_in_flight, 1);
+
+	leave_event_handler();
+}
+
+static void dump_method_timing(AgentData* agent_data) {
+	MethodProbes* method_probes = atomic_load(&agent_data->method_probes);
+	if (method_probes == NULL) {
+		log_debug("method probes are not running");
+		return;
+	}
+
+	if (!method_probes_dump(method_probes, agent_data->method_timing_file)) {
+		log_debug("failed to write method timing: %s", agent_data->method_timing_file);
+	} else {
+		log_debug("method timing written: %s", agent_data->method_timing_file);
+	}
+}
+
+// hook which loaded probes right before they were cleared may still be transforming a class with them
+static void release_method_probes(AgentData* agent_data) {
+	MethodProbes* method_probes = atomic_exchange(&agent_data->method_probes, NULL);
+	if (method_probes == NULL) {
+		return;
+	}
+
+	update_class_file_load_hook_mode(agent_data);
+
+	while (atomic_load(&probe_hooks_in_flight) > 0) {
+		sched_yield();
+	}
+
+	method_probes_stop(method_probes);
+}
+
+static void stop_method_probes(AgentData* agent_data) {
+	if (atomic_load(&agent_data->method_probes) != NULL) {
+		dump_method_timing(agent_data);
+
+		release_method_probes(agent_data);
+	}
+}
+
+// probe class has to be defined before the first probed class is loaded, so class file load hook is enabled last
+static void start_method_probes(AgentData* agent_data, JNIEnv* jni) {
+	MethodProbes* method_probes = method_probes_start(agent_data->jvm, agent_data->jvmti, agent_data->probe_methods);
+	if (method_probes == NULL) {
+		log_debug("failed to start method probes");
+		return;
+	}
+
+	if (!method_probes_define_helper(method_probes, jni)) {
+		method_probes_stop(method_probes);
+		return;
+	}
+
+	// hook may already be enabled for patches or timeline, it probes classes as soon as probes are published
+	atomic_store(&agent_data->method_probes, method_probes);
+
+	if (!update_class_file_load_hook_mode(agent_data)) {
+		release_method_probes(agent_data);
+		return;
+	}
+
+	log_debug("method probes started - pattern: %s", agent_data->probe_methods);
+}
+
+static void redefine_original_class(const char* class_name, const unsigned char* class_bytes, jint class_bytes_count, void* arg) {
+	AgentData* agent_data = arg;
+
+	JNIEnv* jni = NULL;
+	if ((*agent_data->jvm)->GetEnv(agent_data->jvm, (void**)&jni, JNI_VERSION_1_6) != JNI_OK) {
+		log_debug("failed to get JNI environment - class isn't redefined: %s", class_name);
+		return;
+	}
+
+	jclass klass = find_class(agent_data, jni, class_name);
+	if (klass == NULL) {
+		log_debug("class is not loaded: %s", class_name);
+		return;
+	}
+
+	jvmtiClassDefinition class_definitions[] = {
+			{ klass, class_bytes_count, class_bytes }
+	};
+
+	jvmtiError error = (*agent_data->jvmti)->RedefineClasses(agent_data->jvmti, 1, class_definitions);
+	if (error != JVMTI_ERROR_NONE) {
+		log_debug("failed to redefine class %s - error code: %d", class_name, error);
+	}
+
+	(*jni)->DeleteGlobalRef(jni, klass);
+}
+
+// redefining probed classes with their original bytes, class file load hook probes them again when probes are installed
+static void set_method_probes_installed(AgentData* agent_data, bool installed) {
+	MethodProbes* method_probes = atomic_load(&agent_data->method_probes);
+	if (method_probes == NULL) {
+		log_debug("method probes are not running");
+		return;
+	}
+
+	method_probes_set_enabled(method_probes, installed);
+	method_probes_for_each_original(method_probes, redefine_original_class, agent_data);
+
+	log_debug("method probes %s", installed ? "installed" : "removed");
+}
+
+static bool set_class_load_timeline_events_mode(AgentData* agent_data, jvmtiEventMode mode) {
+	jvmtiEnv* jvmti = agent_data->jvmti;
+
+	jvmtiError error = (*jvmti)->SetEventNotificationMode(jvmti, mode, JVMTI_EVENT_CLASS_LOAD, NULL);
+	if (error != JVMTI_ERROR_NONE) {
+		log_debug("failed to set 'CLASS_LOAD' event notification mode - error: %d", error);
+		return false;
+	}
+
+	return update_class_file_load_hook_mode(agent_data);
+}
+
+// called on timeline thread once recording period is over
+static void class_load_timeline_finished(void* arg) {
+	set_class_load_timeline_events_mode(arg, JVMTI_DISABLE);
+}
+
+// handler which loaded the timeline right before it was cleared may still be recording to it
+static void stop_class_load_timeline(AgentData* agent_data) {
+	ClassLoadTimeline* class_load_timeline = atomic_exchange(&agent_data->class_load_timeline, NULL);
+	if (class_load_timeline != NULL) {
+		set_class_load_timeline_events_mode(agent_data, JVMTI_DISABLE);
+
+		while (atomic_load(&timeline_handlers_in_flight) > 0) {
+			sched_yield();
+		}
+
+		class_load_timeline_stop(class_load_timeline);
+	}
+}
+
+// recording starts as early as possible, its period is counted from VM initialization
+static void start_class_load_timeline(AgentData* agent_data, bool live_phase) {
+	ClassLoadTimeline* class_load_timeline = class_load_timeline_start(agent_data->jvm, agent_data->class_load_timeline_s,
+			agent_data->class_load_trace_file, agent_data->class_load_summary_file, class_load_timeline_finished, agent_data);
+	if (class_load_timeline == NULL) {
+		log_debug("failed to start class load timeline");
+		return;
+	}
+
+	// handlers can see the timeline as soon as events are enabled
+	atomic_store(&agent_data->class_load_timeline, class_load_timeline);
+
+	if (!set_class_load_timeline_events_mode(agent_data, JVMTI_ENABLE)) {
+		stop_class_load_timeline(agent_data);
+		return;
+	}
+
+	if (live_phase) {
+		class_load_timeline_vm_initialized(class_load_timeline);
+	}
+
+	log_debug("class load timeline started - period: %d s", agent_data->class_load_timeline_s);
+}
+
+
+static void start_profilers(AgentData* agent_data) {
+	if (agent_data->cpu_sampling_rate > 0) {
+		agent_data->cpu_profiler = cpu_profiler_start(agent_data->jvm, agent_data->jvmti, agent_data->cpu_sampling_rate);
+		if (agent_data->cpu_profiler == NULL) {
+			log_debug("failed to start cpu profiler");
+		} else {
+			log_debug("cpu profiler started - sampling rate: %d Hz", agent_data->cpu_sampling_rate);
+		}
+	}
+
+	if (agent_data->heap_sampling_interval > 0) {
+		agent_data->heap_profiler = heap_profiler_start(agent_data->jvm, agent_data->jvmti, agent_data->heap_sampling_interval);
+		if (agent_data->heap_profiler == NULL) {
+			log_debug("failed to start heap profiler");
+		} else if (!set_heap_profiler_events_mode(agent_data->jvmti, JVMTI_ENABLE)) {
+			heap_profiler_stop(agent_data->heap_profiler);
+			agent_data->heap_profiler = NULL;
+		} else {
+			log_debug("heap profiler started - sampling interval: %d bytes", agent_data->heap_sampling_interval);
+		}
+	}
+
+	if (agent_data->monitor_profiling) {
+		agent_data->monitor_profiler = monitor_profiler_start(agent_data->jvm, agent_data->jvmti);
+		if (agent_data->monitor_profiler == NULL) {
+			log_debug("failed to start monitor profiler");
+		} else if (!set_monitor_profiler_events_mode(agent_data->jvmti, JVMTI_ENABLE)) {
+			monitor_profiler_stop(agent_data->monitor_profiler);
+			agent_data->monitor_profiler = NULL;
+		} else {
+			log_debug("monitor profiler started");
+		}
+	}
+
+	if (agent_data->thread_cpu_sampling_period_ms > 0) {
+		agent_data->thread_cpu_sampler = thread_cpu_sampler_start(agent_data->jvm, agent_data->jvmti,
+				agent_data->thread_cpu_sampling_period_ms, agent_data->thread_cpu_top, agent_data->thread_cpu_report_file);
+		if (agent_data->thread_cpu_sampler == NULL) {
+			log_debug("failed to start thread cpu sampler");
+		} else {
+			log_debug("thread cpu sampler started - sampling period: %d ms, top threads: %d",
+					agent_data->thread_cpu_sampling_period_ms, agent_data->thread_cpu_top);
+		}
+	}
+}
+
+static void dump_cpu_profile(AgentData* agent_data) {
+	if (agent_data->cpu_profiler == NULL) {
+		log_debug("cpu profiler is not running");
+		return;
+	}
+
+	if (!cpu_profiler_dump(agent_data->cpu_profiler, agent_data->cpu_profile_file)) {
+		log_debug("failed to write cpu profile: %s", agent_data->cpu_profile_file);
+	} else {
+		log_debug("cpu profile written: %s", agent_data->cpu_profile_file);
+	}
+}
 
-	AgentData* agent_data = (AgentData*)atomic_load(&agent_data_ref);
-	FILE* log_file = agent_data->log_file;
+static void dump_heap_profile(AgentData* agent_data) {
+	if (agent_data->heap_profiler == NULL) {
+		log_debug("heap profiler is not running");
+		return;
+	}
 
-	vfprintf(log_file, format, args);
-	va_end(args);
+	if (!heap_profiler_dump(agent_data->heap_profiler, agent_data->heap_profile_file, agent_data->heap_live_profile_file)) {
+		log_debug("failed to write heap profiles: %s, %s", agent_data->heap_profile_file, agent_data->heap_live_profile_file);
+	} else {
+		log_debug("heap profiles written: %s, %s", agent_data->heap_profile_file, agent_data->heap_live_profile_file);
+	}
+}
 
-	fprintf(log_file, "\n");
+static void dump_monitor_profile(AgentData* agent_data) {
+	if (agent_data->monitor_profiler == NULL) {
+		log_debug("monitor profiler is not running");
+		return;
+	}
 
-	fflush(log_file);
+	if (!monitor_profiler_dump(agent_data->monitor_profiler, agent_data->monitor_profile_file, agent_data->monitor_histograms_file)) {
+		log_debug("failed to write monitor profiles: %s, %s", agent_data->monitor_profile_file, agent_data->monitor_histograms_file);
+	} else {
+		log_debug("monitor profiles written: %s, %s", agent_data->monitor_profile_file, agent_data->monitor_histograms_file);
+	}
 }
 
-static void redefine_class(AgentData* agent_data, FILE* class_file, jint class_bytes_count) {
-	JNIEnv* jni = NULL;
-	jint attach_thread_status = (*agent_data->jvm)->AttachCurrentThread(agent_data->jvm, (void**)&jni, NULL);
-	if (attach_thread_status != JNI_OK) {
-		log_debug("failed to attach 'redefine class' thread");
+static void dump_thread_cpu_profile(AgentData* agent_data) {
+	if (agent_data->thread_cpu_sampler == NULL) {
+		log_debug("thread cpu sampler is not running");
 		return;
 	}
 
-	log_debug("reading class file bytes");
+	if (!thread_cpu_sampler_dump(agent_data->thread_cpu_sampler, agent_data->thread_cpu_profile_file)) {
+		log_debug("failed to write thread cpu profile: %s", agent_data->thread_cpu_profile_file);
+	} else {
+		log_debug("thread cpu profile written: %s", agent_data->thread_cpu_profile_file);
+	}
+}
+
+// diff is written when there is a previous histogram or one taken before reload
+static void dump_heap_histogram(AgentData* agent_data, JNIEnv* jni) {
+	HeapHistogram* heap_histogram = get_heap_histogram(agent_data);
+	if (heap_histogram == NULL) {
+		return;
+	}
 
-	uint8_t class_file_bytes[class_bytes_count];
-	size_t blocks_read = fread(class_file_bytes, class_bytes_count, 1, class_file);
-	if (blocks_read < 1) {
-		log_debug("failed to read class file bytes");
+	bool diff_written = false;
+	if (!heap_histogram_dump(heap_histogram, jni, agent_data->heap_histogram_file, agent_data->heap_histogram_diff_file,
+			&diff_written)) {
+		log_debug("failed to write heap histogram: %s", agent_data->heap_histogram_file);
+	} else if (diff_written) {
+		log_debug("heap histogram written: %s, %s", agent_data->heap_histogram_file, agent_data->heap_histogram_diff_file);
 	} else {
-		JClass* loaded_class = jclass_load(class_file_bytes);
+		log_debug("heap histogram written: %s", agent_data->heap_histogram_file);
+	}
+}
 
-		char class_signature[strnlen(loaded_class->name, PATH_MAX) + 3];
-		// TODO use snprintf, check return value for buffer overrun
-		sprintf(class_signature, "L%s;", loaded_class->name);
+// dumping collected profiles before stopping profilers
+static void stop_profilers(AgentData* agent_data) {
+	if (agent_data->cpu_profiler != NULL) {
+		dump_cpu_profile(agent_data);
 
-		jclass_free(loaded_class);
+		cpu_profiler_stop(agent_data->cpu_profiler);
+		agent_data->cpu_profiler = NULL;
+	}
 
-		jclass klass = hash_map_get(agent_data->classes, class_signature);
-		jvmtiClassDefinition class_definitions[] = {
-				{ klass, class_bytes_count, class_file_bytes }
-		};
+	if (agent_data->heap_profiler != NULL) {
+		set_heap_profiler_events_mode(agent_data->jvmti, JVMTI_DISABLE);
 
-		log_debug("redefining class: %s", class_signature);
-		jvmtiError error = (*agent_data->jvmti)->RedefineClasses(agent_data->jvmti, 1, class_definitions);
-		if (error != JVMTI_ERROR_NONE) {
-			log_debug("failed to redefine class - error code: %d", error);
-		} else {
-			log_debug("class redefined");
-		}
+		dump_heap_profile(agent_data);
+
+		heap_profiler_stop(agent_data->heap_profiler);
+		agent_data->heap_profiler = NULL;
 	}
 
-	(*agent_data->jvm)->DetachCurrentThread(agent_data->jvm);
-}
+	if (agent_data->monitor_profiler != NULL) {
+		set_monitor_profiler_events_mode(agent_data->jvmti, JVMTI_DISABLE);
 
-static void* redefine_class_activity(void* arg) {
-	log_debug("'redefine class' thread is running");
+		dump_monitor_profile(agent_data);
 
-	const size_t event_buf_size = sizeof(struct inotify_event) + PATH_MAX + 1;
-	char event_buf[event_buf_size];
+		monitor_profiler_stop(agent_data->monitor_profiler);
+		agent_data->monitor_profiler = NULL;
+	}
 
-	AgentData* agent_data = (AgentData*)atomic_load(&agent_data_ref);
+	if (agent_data->thread_cpu_sampler != NULL) {
+		dump_thread_cpu_profile(agent_data);
 
-	for (;;) {
-		log_debug("watching classes directory: %s", agent_data->classes_dir);
+		thread_cpu_sampler_stop(agent_data->thread_cpu_sampler);
+		agent_data->thread_cpu_sampler = NULL;
+	}
+}
 
-		ssize_t event_size = read(agent_data->inotify_fd, event_buf, event_buf_size);
-		if (event_size == 0 || event_size == -1) {
-			log_debug("failed to read event - stopping 'redefine class' thread");
-			break;
+static void JNICALL VMInitEventHandler(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread) {
+	AgentData* agent_data = enter_event_handler();
+	if (agent_data == NULL) {
+		return;
+	}
+
+	ClassLoadTimeline* class_load_timeline = atomic_load(&agent_data->class_load_timeline);
+	if (class_load_timeline != NULL) {
+		class_load_timeline_vm_initialized(class_load_timeline);
+	}
+
+	if (start_redefine_class_thread(agent_data)) {
+		start_profilers(agent_data);
+
+		if (agent_data->probe_methods != NULL) {
+			start_method_probes(agent_data, jni);
 		}
 
-		struct inotify_event* event = (struct inotify_event*)event_buf;
+		log_debug("VM initialization completed");
+	}
 
-		size_t classes_dir_path_len = strnlen(agent_data->classes_dir, PATH_MAX);
-		size_t file_name_len = strnlen(event->name, NAME_MAX);
+	leave_event_handler();
+}
 
-		// allocating enougn bytes for class dir path length + '/' + class file name length + '\0'
-		char class_file_path[classes_dir_path_len + 1 + file_name_len + 1];
-		// TODO check return value
-		sprintf(class_file_path, "%s/%s", agent_data->classes_dir, event->name);
+static void JNICALL VMDeathEventHandler(jvmtiEnv* jvmti, JNIEnv* jni) {
+	AgentData* agent_data = enter_event_handler();
+	if (agent_data == NULL) {
+		return;
+	}
 
-		log_debug("class file %s changed", class_file_path);
+	stop_profilers(agent_data);
 
-		struct stat class_file_stat;
-		if (stat(class_file_path, &class_file_stat) == -1) {
-			log_debug("failed to find class file");
-			break;
-		}
+	stop_method_probes(agent_data);
 
-		log_debug("class file size: %lld", class_file_stat.st_size);
+	stop_class_load_timeline(agent_data);
 
-		FILE* class_file = fopen(class_file_path, "rb");
-		if (class_file == NULL) {
-			log_debug("failed to open class file");
-			break;
-		}
+	log_debug("VM is dead");
+
+	leave_event_handler();
+}
 
-		redefine_class(agent_data, class_file, class_file_stat.st_size);
+// copying at most max_length characters of passed in string to dynamically allocated buffer
+// client is responsible for memory reclaiming
+static char* copy_string(const char* str, size_t max_length) {
+	size_t str_length = strnlen(str, max_length);
 
-		fclose(class_file);
+	char* copy_buf = malloc(str_length + 1);
+	if (copy_buf == NULL) {
+		return NULL;
 	}
 
-	log_debug("'redefine class' thread stopping...");
+	memcpy(copy_buf, str, str_length);
+	copy_buf[str_length] = '\0';
 
-	return NULL;
+	return copy_buf;
 }
 
-static void JNICALL ClassPreparedHandler(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread, jclass klass) {
-	char* class_signature;
-	jvmtiError error = (*jvmti)->GetClassSignature(jvmti, klass, &class_signature, NULL);
-	if (error != JVMTI_ERROR_NONE) {
-		log_debug("failed to get class signature");
-	} else {
-		log_debug("class loaded: %s", class_signature);
+// looking up option value in comma separated list of name=value pairs,
+// returned value copy should be freed by client, NULL returned when option is missing and there is no default value
+static char* get_agent_option_value(const char* options, const char* name, const char* default_value) {
+	size_t name_len = strlen(name);
 
-		AgentData* agent_data = (AgentData*)atomic_load(&agent_data_ref);
+	const char* option = options;
+	while (option != NULL && *option != '\0') {
+		const char* option_end = strchr(option, ',');
+		size_t option_len = option_end != NULL ? (size_t)(option_end - option) : strlen(option);
 
-		jclass class_ref = (*jni)->NewGlobalRef(jni, klass);
-		hash_map_put(agent_data->classes, class_signature, class_ref);
+		if (option_len > name_len && strncmp(option, name, name_len) == 0 && option[name_len] == '=') {
+			return copy_string(option + name_len + 1, option_len - name_len - 1);
+		}
 
-		(*jvmti)->Deallocate(jvmti, (unsigned char*)class_signature);
+		option = option_end != NULL ? option_end + 1 : NULL;
 	}
+
+	if (default_value == NULL) {
+		return NULL;
+	}
+
+	return copy_string(default_value, PATH_MAX);
 }
 
-static void JNICALL VMInitEventHandler(jvmtiEnv* jvmti, JNIEnv* jni, jthread thread) {
-	pthread_t redefine_class_thread;
-    int thread_create_status = pthread_create(&redefine_class_thread, NULL, redefine_class_activity, NULL);
-    if (thread_create_status != 0) {
-    	log_debug("failed to start 'redefine class' service thread");
-    	return;
-    }
+static int get_agent_int_option_value(const char* options, const char* name, int default_value) {
+	char* option_value = get_agent_option_value(options, name, NULL);
+	if (option_value == NULL) {
+		return default_value;
+	}
 
-    log_debug("'redefine class' service thread started");
+	char* option_value_end = NULL;
+	long value = strtol(option_value, &option_value_end, 10);
+	if (option_value_end == option_value || *option_value_end != '\0' || value < INT_MIN || value > INT_MAX) {
+		value = default_value;
+	}
 
-	// TODO detach 'redefine class' thread
+	free(option_value);
 
-	log_debug("VM initialization completed");
+	return (int)value;
 }
 
-static void JNICALL VMDeathEventHandler(jvmtiEnv* jvmti, JNIEnv* jni) {
-	log_debug("VM is dead");
-}
+// capabilities depend on enabled agent modes
+static void get_agent_capabilities(const AgentData* agent_data, jvmtiCapabilities* capabilities) {
+	memset(capabilities, 0, sizeof(jvmtiCapabilities));
 
-// copying passed in string to dynamically allocated buffer
-// client is responsible for memory reclaiming
-static char* copy_string(const char* str, size_t max_length) {
-	size_t copy_buf_size = strnlen(str, max_length) + 1;
+	capabilities->can_redefine_classes = JNI_TRUE;
 
-	char* copy_buf = malloc(copy_buf_size);
-	if (copy_buf == NULL) {
-		return NULL;
+	if (agent_data->heap_sampling_interval > 0) {
+		capabilities->can_generate_sampled_object_alloc_events = JNI_TRUE;
+		capabilities->can_generate_object_free_events = JNI_TRUE;
+		capabilities->can_tag_objects = JNI_TRUE;
 	}
 
-	strncpy(copy_buf, str, copy_buf_size);
+	if (agent_data->monitor_profiling) {
+		capabilities->can_generate_monitor_events = JNI_TRUE;
+	}
 
-	return copy_buf;
+	if (agent_data->thread_cpu_sampling_period_ms > 0) {
+		capabilities->can_get_thread_cpu_time = JNI_TRUE;
+	}
+
+	if (agent_data->reload_trace_file != NULL) {
+		capabilities->can_generate_garbage_collection_events = JNI_TRUE;
+		capabilities->can_generate_compiled_method_load_events = JNI_TRUE;
+	}
 }
 
-static char* get_agent_option_value(char* options, const char* name, const char* default_value) {
-	if (options == NULL) {
-		char* default_value_copy = copy_string(default_value, PATH_MAX);
-		if (default_value_copy == NULL) {
-			return NULL;
-		}
+static void free_agent_options(AgentData* agent_data) {
+	free(agent_data->classes_dir);
+	free(agent_data->cpu_profile_file);
+	free(agent_data->heap_profile_file);
+	free(agent_data->heap_live_profile_file);
+	free(agent_data->monitor_profile_file);
+	free(agent_data->monitor_histograms_file);
+	free(agent_data->reload_trace_file);
+	free(agent_data->probe_methods);
+	free(agent_data->method_timing_file);
+	free(agent_data->shm_ring_name);
+	free(agent_data->heap_histogram_file);
+	free(agent_data->heap_histogram_diff_file);
+	free(agent_data->thread_cpu_report_file);
+	free(agent_data->thread_cpu_profile_file);
+	free(agent_data->class_load_trace_file);
+	free(agent_data->class_load_summary_file);
+	free(agent_data->dependents_report_file);
+}
 
-		return default_value_copy;
+static void delete_class_ref(StrHandle class_name, void* class_ref, void* jni) {
+	(*(JNIEnv*)jni)->DeleteGlobalRef((JNIEnv*)jni, class_ref);
+}
+
+// disabling events, stopping service thread, releasing class index and disposing JVMTI environment,
+// library itself stays loaded so agent can be attached again later
+static void agent_detach(AgentData* agent_data, JNIEnv* jni) {
+	log_debug("detaching agent");
+
+	jvmtiEnv* jvmti = agent_data->jvmti;
+
+	(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_DISABLE, JVMTI_EVENT_CLASS_PREPARE, NULL);
+	(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_DISABLE, JVMTI_EVENT_VM_INIT, NULL);
+	(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_DISABLE, JVMTI_EVENT_VM_DEATH, NULL);
+
+	stop_redefine_class_thread(agent_data);
+
+	// no handler is called from now on, the ones already running may still use profilers, probes,
+	// patch table or class index, so nothing is freed before they are finished
+	atomic_store(&event_handlers_active, false);
+	(*jvmti)->SetEventCallbacks(jvmti, NULL, 0);
+
+	while (atomic_load(&event_handlers_in_flight) > 0) {
+		sched_yield();
+	}
+
+	// index is used by 'redefine class' thread only
+	if (agent_data->dependency_index != NULL) {
+		dependency_index_free(agent_data->dependency_index);
+		agent_data->dependency_index = NULL;
 	}
 
-	char* name_value_sep_pos = strchr(options, '=');
+	stop_profilers(agent_data);
 
-	if (name_value_sep_pos == NULL) {
-		char* default_value_copy = copy_string(default_value, PATH_MAX);
-		if (default_value_copy == NULL) {
-			return NULL;
-		}
+	// probed code keeps calling agent natives, so original classes are restored first
+	if (agent_data->method_probes != NULL) {
+		set_method_probes_installed(agent_data, false);
+		stop_method_probes(agent_data);
+	}
 
-		return default_value_copy;
-	} else {
-		char* option_value_copy = copy_string(name_value_sep_pos + 1, PATH_MAX);
-		if (option_value_copy == NULL) {
-			return NULL;
+	stop_reload_trace(agent_data);
+
+	stop_class_load_timeline(agent_data);
+
+	// pending patches are dropped, classes defined after detach are loaded from their class files
+	(*jvmti)->SetEventNotificationMode(jvmti, JVMTI_DISABLE, JVMTI_EVENT_CLASS_FILE_LOAD_HOOK, NULL);
+	if (agent_data->patch_table != NULL) {
+		patch_table_free(agent_data->patch_table);
+	}
+	pthread_mutex_destroy(&agent_data->class_file_load_hook_mutex);
+
+	// histogram environment holds class tags only, they are gone with it
+	if (agent_data->heap_histogram != NULL) {
+		heap_histogram_free(agent_data->heap_histogram);
+		agent_data->heap_histogram = NULL;
+	}
+
+	pthread_mutex_destroy(&agent_data->heap_histogram_mutex);
+
+	if (agent_data->inotify_fd != -1) {
+		close(agent_data->inotify_fd);
+	}
+
+	// agent which failed to initialize may have no class index yet
+	if (agent_data->classes != NULL) {
+		if (jni != NULL) {
+			symbol_map_for_each(agent_data->classes, delete_class_ref, jni);
 		}
 
-		return option_value_copy;
+		symbol_map_free(agent_data->classes);
+	}
+
+	if (agent_data->class_names != NULL) {
+		str_arena_free(agent_data->class_names);
+	}
+
+	free_agent_options(agent_data);
+
+	// capabilities are relinquished with environment, attaching again gets a new one
+	jvmtiError error = (*jvmti)->DisposeEnvironment(jvmti);
+	if (error != JVMTI_ERROR_NONE) {
+		log_debug("failed to dispose JVMTI environment - error: %d", error);
 	}
+	agent_data->jvmti = NULL;
+
+	log_debug("agent detached");
+
+	atomic_store(&agent_data_ref, 0);
+
+	fclose(agent_data->log_file);
 }
 
-JNIEXPORT jint JNICALL Agent_OnLoad(JavaVM* jvm, char* options, void* reserved) {
-    FILE* log_file = fopen("agent.log", "w");
+// partially initialized agent is torn down as detached one, so the next attach initializes it again
+// instead of passing commands to it
+static jint abort_agent_init(AgentData* agent_data) {
+	log_debug("agent initialization failed");
+
+	// there is no Java thread to delete class refs on during 'OnLoad' phase, but there are no class refs either
+	JNIEnv* jni = NULL;
+	if ((*agent_data->jvm)->GetEnv(agent_data->jvm, (void**)&jni, JNI_VERSION_1_6) != JNI_OK) {
+		jni = NULL;
+	}
+
+	agent_detach(agent_data, jni);
+
+	return JNI_ERR;
+}
+
+static jint agent_init(JavaVM* jvm, char* options, bool live_phase) {
+    FILE* log_file = fopen("agent.log", live_phase ? "a" : "w");
     if (log_file == NULL) {
     	fprintf(stderr, "failed to open log file\n");
     	return JNI_ERR;
     }
 
-    fprintf(log_file, "loading agent - options: '%s'\n", options);
-
-	char* classes_dir = get_agent_option_value(options, "classes_dir", DEFAULT_CLASSES_DIR);
-	fprintf(log_file, "classes dir: %s\n", classes_dir);
-
-	int inotify_fd = inotify_init();
-	if (inotify_fd == -1) {
-		fprintf(log_file, "failed to open inotify descriptor\n");
-		return JNI_ERR;
-	}
+    fprintf(log_file, "%s agent - options: '%s'\n", live_phase ? "attaching" : "loading", options);
 
     jvmtiEnv* jvmti = NULL;
     if ((*jvm)->GetEnv(jvm, (void**)&jvmti, JVMTI_VERSION_1_0) != JNI_OK) {
+    	fprintf(log_file, "failed to get JVMTI environment\n");
+    	fclose(log_file);
         return JNI_ERR;
     }
 
-    static AgentData agent_data;
+    memset(&agent_data, 0, sizeof(AgentData));
     agent_data.jvm = jvm;
     agent_data.jvmti = jvmti;
     agent_data.log_file = log_file;
+	agent_data.inotify_fd = -1;
+	agent_data.inotify_watch_fd = -1;
 
-	int add_watch_status = inotify_add_watch(inotify_fd, classes_dir, IN_CLOSE_WRITE);	
-	if (add_watch_status == -1) {
-		fprintf(log_file, "failed to add classes dir inotify watch\n");
-		return JNI_ERR;
+	pthread_mutex_init(&agent_data.class_file_load_hook_mutex, NULL);
+	pthread_mutex_init(&agent_data.heap_histogram_mutex, NULL);
+
+	// from now on failed initialization is undone by abort_agent_init()
+    atomic_store(&agent_data_ref, (uintptr_t)&agent_data);
+
+	agent_data.classes_dir = get_agent_option_value(options, "classes_dir", DEFAULT_CLASSES_DIR);
+	log_debug("classes dir: %s", agent_data.classes_dir);
+
+	// classes dir is watched by reload daemon when agent consumes its shared memory ring
+	agent_data.shm_ring_name = get_agent_option_value(options, "shm_ring", NULL);
+
+	if (agent_data.shm_ring_name == NULL) {
+		agent_data.inotify_fd = inotify_init();
+		if (agent_data.inotify_fd == -1) {
+			log_debug("failed to open inotify descriptor");
+			return abort_agent_init(&agent_data);
+		}
+
+		agent_data.inotify_watch_fd = inotify_add_watch(agent_data.inotify_fd, agent_data.classes_dir, IN_CLOSE_WRITE);
+		if (agent_data.inotify_watch_fd == -1) {
+			log_debug("failed to add classes dir inotify watch");
+			return abort_agent_init(&agent_data);
+		}
 	}
 
-	agent_data.inotify_fd = inotify_fd;
-	agent_data.classes_dir = classes_dir;
+	agent_data.shm_ring_owner_uid = (uid_t)get_agent_int_option_value(options, "shm_ring_owner_uid", (int)geteuid());
 
-	// TODO check new hash map allocation success
-	agent_data.classes = hash_map_new(16, NULL);
+	agent_data.cpu_sampling_rate = get_agent_int_option_value(options, "cpu_profiler", 0);
+	agent_data.cpu_profile_file = get_agent_option_value(options, "cpu_profile_file", DEFAULT_CPU_PROFILE_FILE);
 
-    atomic_store(&agent_data_ref, (uintptr_t)&agent_data);
+	agent_data.heap_sampling_interval = get_agent_int_option_value(options, "heap_profiler", 0);
+	agent_data.heap_profile_file = get_agent_option_value(options, "heap_profile_file", DEFAULT_HEAP_PROFILE_FILE);
+	agent_data.heap_live_profile_file = get_agent_option_value(options, "heap_live_profile_file", DEFAULT_HEAP_LIVE_PROFILE_FILE);
+
+	agent_data.monitor_profiling = get_agent_int_option_value(options, "monitor_profiler", 0) > 0;
+	agent_data.monitor_profile_file = get_agent_option_value(options, "monitor_profile_file", DEFAULT_MONITOR_PROFILE_FILE);
+	agent_data.monitor_histograms_file = get_agent_option_value(options, "monitor_histograms_file", DEFAULT_MONITOR_HISTOGRAMS_FILE);
+
+	agent_data.reload_trace_file = get_agent_option_value(options, "reload_trace_file", NULL);
+
+	agent_data.probe_methods = get_agent_option_value(options, "probe_methods", NULL);
+	agent_data.method_timing_file = get_agent_option_value(options, "method_timing_file", DEFAULT_METHOD_TIMING_FILE);
+
+	agent_data.heap_histogram_file = get_agent_option_value(options, "heap_histogram_file", DEFAULT_HEAP_HISTOGRAM_FILE);
+	agent_data.heap_histogram_diff_file = get_agent_option_value(options, "heap_histogram_diff_file", DEFAULT_HEAP_HISTOGRAM_DIFF_FILE);
+	agent_data.heap_histogram_reload = get_agent_int_option_value(options, "heap_histogram_reload", 0) > 0;
+
+	agent_data.thread_cpu_sampling_period_ms = get_agent_int_option_value(options, "thread_cpu_sampler", 0);
+	agent_data.thread_cpu_top = get_agent_int_option_value(options, "thread_cpu_top", DEFAULT_THREAD_CPU_TOP);
+	agent_data.thread_cpu_report_file = get_agent_option_value(options, "thread_cpu_report_file", DEFAULT_THREAD_CPU_REPORT_FILE);
+	agent_data.thread_cpu_profile_file = get_agent_option_value(options, "thread_cpu_profile_file", DEFAULT_THREAD_CPU_PROFILE_FILE);
+
+	agent_data.class_load_timeline_s = get_agent_int_option_value(options, "class_load_timeline", 0);
+	agent_data.class_load_trace_file = get_agent_option_value(options, "class_load_trace_file", DEFAULT_CLASS_LOAD_TRACE_FILE);
+	agent_data.class_load_summary_file = get_agent_option_value(options, "class_load_summary_file", DEFAULT_CLASS_LOAD_SUMMARY_FILE);
+
+	agent_data.dependency_indexing = get_agent_int_option_value(options, "dependency_index", 0) > 0;
+	agent_data.dependents_report_file = get_agent_option_value(options, "dependents_report_file", DEFAULT_DEPENDENTS_REPORT_FILE);
+
+	agent_data.class_names = str_arena_new();
+	agent_data.classes = symbol_map_new();
+	if (agent_data.class_names == NULL || agent_data.classes == NULL) {
+		log_debug("failed to allocate class index");
+		return abort_agent_init(&agent_data);
+	}
+
+	agent_data.patch_table = patch_table_new(agent_data.class_names);
+	if (agent_data.patch_table == NULL) {
+		log_debug("failed to allocate patch table");
+		return abort_agent_init(&agent_data);
+	}
+
+	if (agent_data.dependency_indexing) {
+		agent_data.dependency_index = dependency_index_new(agent_data.class_names);
+		if (agent_data.dependency_index == NULL) {
+			log_debug("failed to allocate dependency index - dependents won't be reported");
+		}
+	}
+
+    atomic_store(&event_handlers_active, true);
 
     log_debug("got JVMTI environment");
 
     log_debug("configuring capabilities");
 
-    static jvmtiCapabilities capabilities;
-    memset(&capabilities, 0, sizeof(jvmtiCapabilities));
-
-    capabilities.can_redefine_classes = JNI_TRUE;
+    jvmtiCapabilities capabilities;
+    get_agent_capabilities(&agent_data, &capabilities);
 
     jvmtiError error = (*jvmti)->AddCapabilities(jvmti, &capabilities);
     if (error != JVMTI_ERROR_NONE) {
     	log_debug("failed to configure capabilities - error: %d", error);
-    	return JNI_ERR;
+    	return abort_agent_init(&agent_data);
     }
 
     log_debug("capabilities configured");
 
     log_debug("configuring event handlers");
 
-    error = (*jvmti)->SetEventNotificationMode(jvmti, JVMTI_ENABLE, JVMTI_EVENT_CLASS_PREPARE, NULL);
+    jvmtiEventCallbacks eventCallbacks;
+    memset(&eventCallbacks, 0, sizeof(jvmtiEventCallbacks));
+
+    eventCallbacks.ClassPrepare = ClassPreparedHandler;
+    eventCallbacks.VMInit = VMInitEventHandler;
+	eventCallbacks.VMDeath = VMDeathEventHandler;
+	eventCallbacks.SampledObjectAlloc = SampledObjectAllocHandler;
+	eventCallbacks.ObjectFree = ObjectFreeHandler;
+	eventCallbacks.MonitorContendedEnter = MonitorContendedEnterHandler;
+	eventCallbacks.MonitorContendedEntered = MonitorContendedEnteredHandler;
+	eventCallbacks.GarbageCollectionStart = GarbageCollectionStartHandler;
+	eventCallbacks.GarbageCollectionFinish = GarbageCollectionFinishHandler;
+	eventCallbacks.CompiledMethodLoad = CompiledMethodLoadHandler;
+	eventCallbacks.CompiledMethodUnload = CompiledMethodUnloadHandler;
+	eventCallbacks.ClassFileLoadHook = ClassFileLoadHookHandler;
+	eventCallbacks.ClassLoad = ClassLoadHandler;
+
+    error = (*jvmti)->SetEventCallbacks(jvmti, &eventCallbacks, sizeof(eventCallbacks));
     if (error != JVMTI_ERROR_NONE) {
-    	log_debug("failed to enable 'CLASS_PREPARE' event notification");
-    	return JNI_ERR;
+    	log_debug("failed to configure event handlers");
+    	return abort_agent_init(&agent_data);
     }
 
-    error = (*jvmti)->SetEventNotificationMode(jvmti, JVMTI_ENABLE, JVMTI_EVENT_VM_INIT, NULL);
+    error = (*jvmti)->SetEventNotificationMode(jvmti, JVMTI_ENABLE, JVMTI_EVENT_CLASS_PREPARE, NULL);
     if (error != JVMTI_ERROR_NONE) {
-    	log_debug("failed to enable 'VM_INIT' event notification");
-    	return JNI_ERR;
+    	log_debug("failed to enable 'CLASS_PREPARE' event notification");
+    	return abort_agent_init(&agent_data);
     }
 
+	// VM is already initialized when agent is attached, 'redefine class' thread is started right away
+	if (!live_phase) {
+		error = (*jvmti)->SetEventNotificationMode(jvmti, JVMTI_ENABLE, JVMTI_EVENT_VM_INIT, NULL);
+		if (error != JVMTI_ERROR_NONE) {
+			log_debug("failed to enable 'VM_INIT' event notification");
+			return abort_agent_init(&agent_data);
+		}
+	}
+
 	error = (*jvmti)->SetEventNotificationMode(jvmti, JVMTI_ENABLE, JVMTI_EVENT_VM_DEATH, NULL);
 	if (error != JVMTI_ERROR_NONE) {
 		log_debug("failed to enable 'VM_DEATH' event notification");
-		return JNI_ERR;
+		return abort_agent_init(&agent_data);
 	}
 
-    jvmtiEventCallbacks eventCallbacks;
-    memset(&eventCallbacks, 0, sizeof(jvmtiEventCallbacks));
+    log_debug("event handlers configured");
 
-    eventCallbacks.ClassPrepare = ClassPreparedHandler;
-    eventCallbacks.VMInit = VMInitEventHandler;
-	eventCallbacks.VMDeath = VMDeathEventHandler;
+	if (agent_data.reload_trace_file != NULL) {
+		start_reload_trace(&agent_data, get_agent_int_option_value(options, "reload_trace_window_ms", DEFAULT_RELOAD_TRACE_WINDOW_MS));
+	}
 
-    error = (*jvmti)->SetEventCallbacks(jvmti, &eventCallbacks, sizeof(eventCallbacks));
-    if (error != JVMTI_ERROR_NONE) {
-    	log_debug("failed to configure event handlers");
-    	return JNI_ERR;
-    }
+	if (agent_data.class_load_timeline_s > 0) {
+		start_class_load_timeline(&agent_data, live_phase);
+	}
 
-    log_debug("event handlers configured");
+    return JNI_OK;
+}
+
+JNIEXPORT jint JNICALL Agent_OnLoad(JavaVM* jvm, char* options, void* reserved) {
+	jint init_status = agent_init(jvm, options, false);
+	if (init_status != JNI_OK) {
+		return init_status;
+	}
 
     log_debug("agent loaded");
 
     return JNI_OK;
 }
 
+// jcmd <pid> JVMTI.agent_load <path>/agent.so classes_dir=<dir>
+// attaching library once again passes command to already running agent
+JNIEXPORT jint JNICALL Agent_OnAttach(JavaVM* jvm, char* options, void* reserved) {
+	JNIEnv* jni = NULL;
+	if ((*jvm)->GetEnv(jvm, (void**)&jni, JNI_VERSION_1_6) != JNI_OK) {
+		return JNI_ERR;
+	}
+
+	AgentData* agent_data = (AgentData*)atomic_load(&agent_data_ref);
+	if (agent_data != NULL) {
+		char* command = get_agent_option_value(options, "command", "");
+
+		log_debug("agent command received: '%s'", command);
+
+		jint command_status = JNI_OK;
+		if (strcmp(command, "detach") == 0) {
+			agent_detach(agent_data, jni);
+		} else if (strcmp(command, "cpu_profile_dump") == 0) {
+			dump_cpu_profile(agent_data);
+		} else if (strcmp(command, "heap_profile_dump") == 0) {
+			dump_heap_profile(agent_data);
+		} else if (strcmp(command, "monitor_profile_dump") == 0) {
+			dump_monitor_profile(agent_data);
+		} else if (strcmp(command, "method_timing_dump") == 0) {
+			dump_method_timing(agent_data);
+		} else if (strcmp(command, "probes_remove") == 0) {
+			set_method_probes_installed(agent_data, false);
+		} else if (strcmp(command, "probes_install") == 0) {
+			set_method_probes_installed(agent_data, true);
+		} else if (strcmp(command, "thread_cpu_dump") == 0) {
+			dump_thread_cpu_profile(agent_data);
+		} else if (strcmp(command, "heap_histogram") == 0) {
+			dump_heap_histogram(agent_data, jni);
+		} else {
+			log_debug("unknown agent command");
+			command_status = JNI_ERR;
+		}
+
+		free(command);
+
+		return command_status;
+	}
+
+	// command meant for running agent would attach a new one otherwise
+	char* command = get_agent_option_value(options, "command", NULL);
+	if (command != NULL) {
+		fprintf(stderr, "agent isn't attached, command '%s' rejected\n", command);
+		free(command);
+		return JNI_ERR;
+	}
+
+	jint init_status = agent_init(jvm, options, true);
+	if (init_status != JNI_OK) {
+		return init_status;
+	}
+
+	agent_data = (AgentData*)atomic_load(&agent_data_ref);
+
+	// class prepare events are already enabled, so classes loaded while indexing won't be missed
+	if (!index_loaded_classes(agent_data->jvmti, jni) || !start_redefine_class_thread(agent_data)) {
+		agent_detach(agent_data, jni);
+		return JNI_ERR;
+	}
+
+	start_profilers(agent_data);
+
+	// only classes loaded or redefined from now on are probed
+	if (agent_data->probe_methods != NULL) {
+		start_method_probes(agent_data, jni);
+	}
+
+	log_debug("agent attached");
+
+	return JNI_OK;
+}
+
 // TODO store reference to jclass ( only one class can be reloaded right now )
 // TODO scan commands directory for new version of the recompiled class
 
 JNIEXPORT void JNICALL Agent_OnUnload(JavaVM* jvm) {
 	AgentData* agent_data = (AgentData*)atomic_load(&agent_data_ref);
+	if (agent_data == NULL) {
+		// agent was detached already
+		return;
+	}
 
-	hash_map_free(agent_data->classes);
+	stop_reload_trace(agent_data);
 
-	free(agent_data->classes_dir);
+	if (agent_data->heap_histogram != NULL) {
+		heap_histogram_free(agent_data->heap_histogram);
+	}
+
+	patch_table_free(agent_data->patch_table);
+
+	if (agent_data->dependency_index != NULL) {
+		dependency_index_free(agent_data->dependency_index);
+	}
+
+	symbol_map_free(agent_data->classes);
+	str_arena_free(agent_data->class_names);
+
+	free_agent_options(agent_data);
 
 	log_debug("unloading agent");
 
@@ -0,0 +1,6 @@
+#ifndef _AGENT_H_
+#define _AGENT_H_
+
+void log_debug(const char* format, ...);
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include <sys/stat.h>
@@ -7,51 +8,79 @@
 
 #include "classload.h"
 
-typedef struct {
-   uint16_t first;
-   uint16_t second; 
-} CPIndexPair;
-
 static const int CP_SLOT_STOP = 0;
 static const int CP_SLOT_NEXT = 1;
 
-static uint64_t read_uint64(const uint8_t* buffer, size_t* buffer_pos) {
-    uint64_t* uint64_ptr = (uint64_t*)(buffer + *buffer_pos);
-    *buffer_pos += sizeof(uint64_t);
+// reads past the end of class bytes return zeros and mark reader overrun, so malformed class is rejected
+// once the structure being read is complete
+typedef struct {
+    const uint8_t* buffer;
+    size_t length;
+    size_t pos;
+    bool overrun;
+} ClassReader;
+
+static bool reader_has(ClassReader* reader, size_t count) {
+    if (reader->overrun || count > reader->length - reader->pos) {
+        reader->overrun = true;
+        return false;
+    }
+
+    return true;
+}
 
-    uint64_t uint64_high_bytes = htonl(*uint64_ptr >> 32);
-    uint64_t uint64_low_bytes = htonl(*uint64_ptr & 0x00000000FFFFFFFF);
+static const uint8_t* read_bytes(ClassReader* reader, size_t count) {
+    if (!reader_has(reader, count)) {
+        return NULL;
+    }
 
-    return (uint64_low_bytes << 32) | uint64_high_bytes;
+    const uint8_t* bytes = reader->buffer + reader->pos;
+    reader->pos += count;
+
+    return bytes;
 }
 
-static uint32_t read_uint32(const uint8_t* buffer, size_t* buffer_pos) {
-    uint32_t* uint32_ptr = (uint32_t*)(buffer + *buffer_pos);
-    *buffer_pos += sizeof(uint32_t);
+static uint32_t read_uint32(ClassReader* reader) {
+    const uint8_t* bytes = read_bytes(reader, sizeof(uint32_t));
+    if (bytes == NULL) {
+        return 0;
+    }
 
-    return htonl(*uint32_ptr);
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
 }
 
-static uint16_t read_uint16(const uint8_t* buffer, size_t* buffer_pos) {
-    uint16_t* uint16_ptr = (uint16_t*)(buffer + *buffer_pos);
-    *buffer_pos += sizeof(uint16_t);
+static uint64_t read_uint64(ClassReader* reader) {
+    uint64_t high_bytes = read_uint32(reader);
+    uint64_t low_bytes = read_uint32(reader);
 
-    return htons(*uint16_ptr);
+    return (high_bytes << 32) | low_bytes;
 }
 
-static char read_byte(const uint8_t* buffer, size_t* buffer_pos) {
-    char byte = buffer[*buffer_pos];
-    *buffer_pos += sizeof(char);
+static uint16_t read_uint16(ClassReader* reader) {
+    const uint8_t* bytes = read_bytes(reader, sizeof(uint16_t));
+    if (bytes == NULL) {
+        return 0;
+    }
 
-    return byte;
+    return (bytes[0] << 8) | bytes[1];
+}
+
+static char read_byte(ClassReader* reader) {
+    const uint8_t* bytes = read_bytes(reader, sizeof(char));
+
+    return bytes != NULL ? *bytes : 0;
 }
 
 static inline CPEntry* get_cp_entry(CPool* const_pool, int cp_entry_idx) {
     return const_pool->entries + cp_entry_idx;
 }
 
-static int read_utf8_const_pool_entry(int cp_entry_idx, CPool* const_pool, const uint8_t* buffer, size_t* buffer_pos) {
-    uint16_t utf8_length = read_uint16(buffer, buffer_pos);
+static int read_utf8_const_pool_entry(int cp_entry_idx, CPool* const_pool, ClassReader* reader) {
+    uint16_t utf8_length = read_uint16(reader);
+    const uint8_t* utf8_bytes = read_bytes(reader, utf8_length);
+    if (utf8_bytes == NULL) {
+        return CP_SLOT_STOP;
+    }
 
     size_t utf8_buf_len = utf8_length + 1;
     char* utf8_buf = malloc(utf8_buf_len);
@@ -59,27 +88,25 @@ static int read_utf8_const_pool_entry(int cp_entry_idx, CPool* const_pool, const
         return CP_SLOT_STOP;
     }
 
-    memcpy(utf8_buf, buffer + *buffer_pos, utf8_length);
+    memcpy(utf8_buf, utf8_bytes, utf8_length);
     utf8_buf[utf8_length] = '\0';
 
     CPEntry* utf8_cp_entry = get_cp_entry(const_pool, cp_entry_idx);
     utf8_cp_entry->tag = CPUtf8;
     utf8_cp_entry->value = utf8_buf;
 
-    *buffer_pos += utf8_length;
-
     return CP_SLOT_NEXT;
 }
 
  // TODO create macro to declare constant pool entries parsing functions
-static int read_int_const_pool_entry(int cp_entry_idx, CPool* const_pool, const uint8_t* buffer, size_t* buffer_pos) {
+static int read_int_const_pool_entry(int cp_entry_idx, CPool* const_pool, ClassReader* reader) {
    // allocating 4 bytes for integer constant
    uint32_t* int_buf = malloc(sizeof(uint32_t));
    if (int_buf == NULL) {
        return CP_SLOT_STOP;
    }
 
-   uint32_t value = read_uint32(buffer, buffer_pos);
+   uint32_t value = read_uint32(reader);
 
    *int_buf = value;
 
@@ -90,14 +117,14 @@ static int read_int_const_pool_entry(int cp_entry_idx, CPool* const_pool, const
    return CP_SLOT_NEXT;
 }
 
-static int read_long_const_pool_entry(int cp_entry_idx, CPool* const_pool, const uint8_t* buffer, size_t* buffer_pos) {
+static int read_long_const_pool_entry(int cp_entry_idx, CPool* const_pool, ClassReader* reader) {
     // allocating 8 bytes for long constant
     uint64_t* long_buf = malloc(sizeof(uint64_t));
     if (long_buf == NULL) {
         return CP_SLOT_STOP;
     }
 
-    uint64_t value = read_uint64(buffer, buffer_pos);
+    uint64_t value = read_uint64(reader);
     *long_buf = value;
 
     CPEntry* long_cp_entry = get_cp_entry(const_pool, cp_entry_idx);
@@ -108,13 +135,13 @@ static int read_long_const_pool_entry(int cp_entry_idx, CPool* const_pool, const
     return CP_SLOT_NEXT + CP_SLOT_NEXT;
 }
 
-static int read_double_const_pool_entry(int cp_entry_idx, CPool* const_pool, const uint8_t* buffer, size_t* buffer_pos) {
+static int read_double_const_pool_entry(int cp_entry_idx, CPool* const_pool, ClassReader* reader) {
     double* double_buf = malloc(sizeof(double));
     if (double_buf == NULL) {
         return CP_SLOT_STOP;
     }
 
-    uint64_t value = read_uint64(buffer, buffer_pos);
+    uint64_t value = read_uint64(reader);
     memcpy(double_buf, &value, sizeof(double));
 
     CPEntry* double_cp_entry = get_cp_entry(const_pool, cp_entry_idx);
@@ -125,13 +152,13 @@ static int read_double_const_pool_entry(int cp_entry_idx, CPool* const_pool, con
     return CP_SLOT_NEXT + CP_SLOT_NEXT;
 }
 
-static int read_float_const_pool_entry(int cp_entry_idx, CPool* const_pool, const uint8_t* buffer, size_t* buffer_pos) {
+static int read_float_const_pool_entry(int cp_entry_idx, CPool* const_pool, ClassReader* reader) {
     float* float_buf = malloc(sizeof(float));
     if (float_buf == NULL) {
         return CP_SLOT_STOP;
     }
 
-    uint32_t value = read_uint32(buffer, buffer_pos);
+    uint32_t value = read_uint32(reader);
     memcpy(float_buf, &value, sizeof(float));
 
     CPEntry* float_cp_entry = get_cp_entry(const_pool, cp_entry_idx);
@@ -153,9 +180,9 @@ static CPIndexPair* cp_index_pair_new(uint16_t first, uint16_t second) {
    return index_pair_ptr;
 }
 
-static int read_ref_const_pool_entry(CPTag cp_entry_tag, int cp_entry_idx, CPool* const_pool, const uint8_t* buffer, size_t* buffer_pos) {
-   uint16_t class_index = read_uint16(buffer, buffer_pos);
-   uint16_t name_type_index = read_uint16(buffer, buffer_pos);
+static int read_ref_const_pool_entry(CPTag cp_entry_tag, int cp_entry_idx, CPool* const_pool, ClassReader* reader) {
+   uint16_t class_index = read_uint16(reader);
+   uint16_t name_type_index = read_uint16(reader);
 
    CPIndexPair* index_pair = cp_index_pair_new(class_index, name_type_index);
    if (index_pair == NULL) {
@@ -169,9 +196,9 @@ static int read_ref_const_pool_entry(CPTag cp_entry_tag, int cp_entry_idx, CPool
    return CP_SLOT_NEXT;
 }
 
-static int read_nametype_const_pool_entry(int cp_entry_idx, CPool* const_pool, const uint8_t* buffer, size_t* buffer_pos) {
-   uint16_t name_index = read_uint16(buffer, buffer_pos);
-   uint16_t type_index = read_uint16(buffer, buffer_pos);
+static int read_nametype_const_pool_entry(int cp_entry_idx, CPool* const_pool, ClassReader* reader) {
+   uint16_t name_index = read_uint16(reader);
+   uint16_t type_index = read_uint16(reader);
 
    CPIndexPair* index_pair = cp_index_pair_new(name_index, type_index);
    if (index_pair == NULL) {
@@ -186,9 +213,9 @@ static int read_nametype_const_pool_entry(int cp_entry_idx, CPool* const_pool, c
    return CP_SLOT_NEXT;
 }
 
-static int read_method_handle_const_pool_entry(int cp_entry_idx, CPool* const_pool, const uint8_t* buffer, size_t* buffer_pos) {
-    char method_handle_tag = read_byte(buffer, buffer_pos);
-    uint16_t ref_index = read_uint16(buffer, buffer_pos);
+static int read_method_handle_const_pool_entry(int cp_entry_idx, CPool* const_pool, ClassReader* reader) {
+    char method_handle_tag = read_byte(reader);
+    uint16_t ref_index = read_uint16(reader);
 
     CPIndexPair* tag_ref_index_pair = cp_index_pair_new(method_handle_tag, ref_index);
     if (tag_ref_index_pair == NULL) {
@@ -202,13 +229,13 @@ static int read_method_handle_const_pool_entry(int cp_entry_idx, CPool* const_po
     return CP_SLOT_NEXT;
 }
 
-static int read_utf8_ref_const_pool_entry(CPTag cp_entry_tag, int cp_entry_idx, CPool* const_pool, const uint8_t* buffer, size_t* buffer_pos) {
+static int read_utf8_ref_const_pool_entry(CPTag cp_entry_tag, int cp_entry_idx, CPool* const_pool, ClassReader* reader) {
     uint16_t* utf8_ref_cp_entry_index_ptr = malloc(sizeof(uint16_t));
     if (utf8_ref_cp_entry_index_ptr == NULL) {
         return CP_SLOT_STOP;
     }
 
-    uint16_t utf8_ref_cp_entry_index = read_uint16(buffer, buffer_pos);
+    uint16_t utf8_ref_cp_entry_index = read_uint16(reader);
     *utf8_ref_cp_entry_index_ptr = utf8_ref_cp_entry_index;
 
     CPEntry* utf8_ref_cp_entry = get_cp_entry(const_pool, cp_entry_idx);
@@ -218,92 +245,608 @@ static int read_utf8_ref_const_pool_entry(CPTag cp_entry_tag, int cp_entry_idx,
     return CP_SLOT_NEXT;
 }
 
-static int read_const_pool_entry(int cp_entry_idx, CPool* const_pool, const uint8_t* buffer, size_t* buffer_pos) {
-    char cp_entry_tag = read_byte(buffer, buffer_pos);
+static int read_const_pool_entry(int cp_entry_idx, CPool* const_pool, ClassReader* reader) {
+    char cp_entry_tag = read_byte(reader);
 
     switch (cp_entry_tag) {
-        case CPUtf8: return read_utf8_const_pool_entry(cp_entry_idx, const_pool, buffer, buffer_pos);
-        case CPInteger: return read_int_const_pool_entry(cp_entry_idx, const_pool, buffer, buffer_pos);
-        case CPFloat: return read_float_const_pool_entry(cp_entry_idx, const_pool, buffer, buffer_pos);
-        case CPLong: return read_long_const_pool_entry(cp_entry_idx, const_pool, buffer, buffer_pos);
-        case CPDouble: return read_double_const_pool_entry(cp_entry_idx, const_pool, buffer, buffer_pos);
-        case CPClass: return read_utf8_ref_const_pool_entry(CPClass, cp_entry_idx, const_pool, buffer, buffer_pos);
-        case CPString: return read_utf8_ref_const_pool_entry(CPString, cp_entry_idx, const_pool, buffer, buffer_pos);
-        case CPFieldRef: return read_ref_const_pool_entry(CPFieldRef, cp_entry_idx, const_pool, buffer, buffer_pos);
-        case CPMethodRef: return read_ref_const_pool_entry(CPMethodRef, cp_entry_idx, const_pool, buffer, buffer_pos);
-        case CPInterfaceMethodRef: return read_ref_const_pool_entry(CPInterfaceMethodRef, cp_entry_idx, const_pool, buffer, buffer_pos);
-        case CPNameAndType: return read_nametype_const_pool_entry(cp_entry_idx, const_pool, buffer, buffer_pos);
-        case CPMethodHandle: return read_method_handle_const_pool_entry(cp_entry_idx, const_pool, buffer, buffer_pos);
-        case CPMethodType: return read_utf8_ref_const_pool_entry(CPMethodType, cp_entry_idx, const_pool, buffer, buffer_pos);
-        case CPInvokeDynamic: return read_ref_const_pool_entry(CPInvokeDynamic, cp_entry_idx, const_pool, buffer, buffer_pos); // fix, first arg is BSM index
+        case CPUtf8: return read_utf8_const_pool_entry(cp_entry_idx, const_pool, reader);
+        case CPInteger: return read_int_const_pool_entry(cp_entry_idx, const_pool, reader);
+        case CPFloat: return read_float_const_pool_entry(cp_entry_idx, const_pool, reader);
+        case CPLong: return read_long_const_pool_entry(cp_entry_idx, const_pool, reader);
+        case CPDouble: return read_double_const_pool_entry(cp_entry_idx, const_pool, reader);
+        case CPClass: return read_utf8_ref_const_pool_entry(CPClass, cp_entry_idx, const_pool, reader);
+        case CPString: return read_utf8_ref_const_pool_entry(CPString, cp_entry_idx, const_pool, reader);
+        case CPFieldRef: return read_ref_const_pool_entry(CPFieldRef, cp_entry_idx, const_pool, reader);
+        case CPMethodRef: return read_ref_const_pool_entry(CPMethodRef, cp_entry_idx, const_pool, reader);
+        case CPInterfaceMethodRef: return read_ref_const_pool_entry(CPInterfaceMethodRef, cp_entry_idx, const_pool, reader);
+        case CPNameAndType: return read_nametype_const_pool_entry(cp_entry_idx, const_pool, reader);
+        case CPMethodHandle: return read_method_handle_const_pool_entry(cp_entry_idx, const_pool, reader);
+        case CPMethodType: return read_utf8_ref_const_pool_entry(CPMethodType, cp_entry_idx, const_pool, reader);
+        case CPDynamic: return read_ref_const_pool_entry(CPDynamic, cp_entry_idx, const_pool, reader); // first is BSM index
+        case CPInvokeDynamic: return read_ref_const_pool_entry(CPInvokeDynamic, cp_entry_idx, const_pool, reader); // first is BSM index
+        case CPModule: return read_utf8_ref_const_pool_entry(CPModule, cp_entry_idx, const_pool, reader);
+        case CPPackage: return read_utf8_ref_const_pool_entry(CPPackage, cp_entry_idx, const_pool, reader);
         default: 
             return CP_SLOT_STOP;
     }
 }
 
-static char* get_class_name(int cp_entry_idx, CPool* const_pool) {
-    CPEntry* class_cp_entry = get_cp_entry(const_pool, cp_entry_idx - 1);
+static bool read_attributes(uint16_t attributes_count, JAttribute** attributes_ref, ClassReader* reader) {
+    if (attributes_count == 0) {
+        *attributes_ref = NULL;
+        return true;
+    }
+
+    JAttribute* attributes = calloc(attributes_count, sizeof(JAttribute));
+    if (attributes == NULL) {
+        return false;
+    }
+
+    *attributes_ref = attributes;
+
+    for (uint16_t attribute_idx = 0;attribute_idx < attributes_count;attribute_idx++) {
+        JAttribute* attribute = attributes + attribute_idx;
+        attribute->name_index = read_uint16(reader);
+        attribute->length = read_uint32(reader);
+
+        // length is checked against remaining bytes before anything is allocated for it
+        const uint8_t* info = read_bytes(reader, attribute->length);
+        if (info == NULL) {
+            return false;
+        }
+
+        // zero length attributes still get a buffer, so NULL info of complete attribute means allocation failure
+        attribute->info = malloc(attribute->length + 1);
+        if (attribute->info == NULL) {
+            return false;
+        }
+
+        memcpy(attribute->info, info, attribute->length);
+    }
+
+    return true;
+}
+
+static bool read_members(uint16_t members_count, JMember** members_ref, ClassReader* reader) {
+    if (members_count == 0) {
+        *members_ref = NULL;
+        return true;
+    }
+
+    JMember* members = calloc(members_count, sizeof(JMember));
+    if (members == NULL) {
+        return false;
+    }
+
+    *members_ref = members;
 
-    uint16_t* class_name_cp_entry_idx_ptr = (uint16_t*)class_cp_entry->value;
-    CPEntry* class_name_cp_entry = get_cp_entry(const_pool, *class_name_cp_entry_idx_ptr - 1);
+    for (uint16_t member_idx = 0;member_idx < members_count;member_idx++) {
+        JMember* member = members + member_idx;
+        member->access_flags = read_uint16(reader);
+        member->name_index = read_uint16(reader);
+        member->descriptor_index = read_uint16(reader);
 
-    return class_name_cp_entry->value;
+        // attributes count is set before reading, so partially read member is freed properly
+        member->attributes_count = read_uint16(reader);
+        if (reader->overrun || !read_attributes(member->attributes_count, &member->attributes, reader)) {
+            return false;
+        }
+    }
+
+    return true;
 }
 
-JClass* jclass_load(const uint8_t* buffer) {
-    size_t buffer_pos = 0;
-    
+// class bytes may come from a half written or corrupted file, every read is checked against the length
+JClass* jclass_load(const uint8_t* buffer, size_t length) {
+    ClassReader reader = { .buffer = buffer, .length = length };
+
     // magic number
-    read_uint32(buffer, &buffer_pos);
-    // minor version
-    read_uint16(buffer, &buffer_pos);
-    // major version
-    read_uint16(buffer, &buffer_pos);
+    read_uint32(&reader);
 
-    uint16_t cp_size = read_uint16(buffer, &buffer_pos) - 1;
+    JClass* jclass = calloc(1, sizeof(JClass));
+    if (jclass == NULL) {
+        return NULL;
+    }
+
+    jclass->minor_version = read_uint16(&reader);
+    jclass->major_version = read_uint16(&reader);
+
+    uint16_t cp_count = read_uint16(&reader);
+    if (cp_count == 0) {
+        jclass_free(jclass);
+        return NULL;
+    }
+
+    uint16_t cp_size = cp_count - 1;
 
     size_t cp_obj_size = sizeof(CPool) + cp_size * sizeof(CPEntry);
     CPool* const_pool = malloc(cp_obj_size);
     if (const_pool == NULL) {
+        jclass_free(jclass);
         return NULL;
     }
 
     memset(const_pool, 0, cp_obj_size);
     const_pool->size = cp_size;
 
+    jclass->const_pool = const_pool;
+
     for (int cp_entry_idx = 0;cp_entry_idx < cp_size;) {
-        int next_cp_entry_distance = read_const_pool_entry(cp_entry_idx, const_pool, buffer, &buffer_pos);
-        if (next_cp_entry_distance == 0) {
+        int next_cp_entry_distance = read_const_pool_entry(cp_entry_idx, const_pool, &reader);
+        if (next_cp_entry_distance == 0 || reader.overrun) {
+            jclass_free(jclass);
             return NULL;
         }
 
         cp_entry_idx += next_cp_entry_distance;
     }
 
-    // access flags
-    read_uint16(buffer, &buffer_pos);
+    jclass->access_flags = read_uint16(&reader);
+
+    jclass->this_class = read_uint16(&reader);
+    jclass->name = (char*)jclass_cp_class_name(jclass, jclass->this_class);
+    if (jclass->name == NULL) {
+        jclass_free(jclass);
+        return NULL;
+    }
+
+    jclass->super_class = read_uint16(&reader);
+
+    jclass->interfaces_count = read_uint16(&reader);
+    if (jclass->interfaces_count > 0) {
+        jclass->interfaces = malloc(jclass->interfaces_count * sizeof(uint16_t));
+        if (jclass->interfaces == NULL) {
+            jclass_free(jclass);
+            return NULL;
+        }
+
+        for (uint16_t interface_idx = 0;interface_idx < jclass->interfaces_count;interface_idx++) {
+            jclass->interfaces[interface_idx] = read_uint16(&reader);
+        }
+    }
+
+    jclass->fields_count = read_uint16(&reader);
+    if (!read_members(jclass->fields_count, &jclass->fields, &reader)) {
+        jclass_free(jclass);
+        return NULL;
+    }
+
+    jclass->methods_count = read_uint16(&reader);
+    if (!read_members(jclass->methods_count, &jclass->methods, &reader)) {
+        jclass_free(jclass);
+        return NULL;
+    }
+
+    jclass->attributes_count = read_uint16(&reader);
+    if (!read_attributes(jclass->attributes_count, &jclass->attributes, &reader) || reader.overrun) {
+        jclass_free(jclass);
+        return NULL;
+    }
+
+    return jclass;
+}
+
+const char* jclass_cp_utf8(const JClass* jclass, uint16_t cp_index) {
+    if (cp_index == 0 || cp_index > jclass->const_pool->size) {
+        return NULL;
+    }
+
+    CPEntry* cp_entry = get_cp_entry(jclass->const_pool, cp_index - 1);
+    if (cp_entry->tag != CPUtf8) {
+        return NULL;
+    }
+
+    return cp_entry->value;
+}
+
+const char* jclass_cp_class_name(const JClass* jclass, uint16_t cp_index) {
+    if (cp_index == 0 || cp_index > jclass->const_pool->size) {
+        return NULL;
+    }
+
+    CPEntry* cp_entry = get_cp_entry(jclass->const_pool, cp_index - 1);
+    if (cp_entry->tag != CPClass) {
+        return NULL;
+    }
+
+    return jclass_cp_utf8(jclass, *(uint16_t*)cp_entry->value);
+}
+
+// appending entry to the end of constant pool, returned index is 0 when pool is full or allocation failed
+static uint16_t cp_append_entry(JClass* jclass, CPTag cp_entry_tag, void* value) {
+    CPool* const_pool = jclass->const_pool;
+    if (const_pool->size + 1 >= UINT16_MAX) {
+        free(value);
+        return 0;
+    }
+
+    CPool* new_const_pool = realloc(const_pool, sizeof(CPool) + (const_pool->size + 1) * sizeof(CPEntry));
+    if (new_const_pool == NULL) {
+        free(value);
+        return 0;
+    }
+
+    CPEntry* cp_entry = get_cp_entry(new_const_pool, new_const_pool->size);
+    cp_entry->tag = cp_entry_tag;
+    cp_entry->value = value;
+
+    new_const_pool->size += 1;
+    jclass->const_pool = new_const_pool;
+
+    return new_const_pool->size;
+}
+
+uint16_t jclass_cp_add_utf8(JClass* jclass, const char* utf8) {
+    for (uint16_t cp_index = 1;cp_index <= jclass->const_pool->size;cp_index++) {
+        const char* cp_utf8 = jclass_cp_utf8(jclass, cp_index);
+        if (cp_utf8 != NULL && strcmp(cp_utf8, utf8) == 0) {
+            return cp_index;
+        }
+    }
 
-    uint16_t this_class_cp_entry_idx = read_uint16(buffer, &buffer_pos);
-    char* class_name = get_class_name(this_class_cp_entry_idx, const_pool);
+    char* utf8_buf = strdup(utf8);
+    if (utf8_buf == NULL) {
+        return 0;
+    }
+
+    return cp_append_entry(jclass, CPUtf8, utf8_buf);
+}
+
+static uint16_t cp_add_utf8_ref(JClass* jclass, CPTag cp_entry_tag, const char* utf8) {
+    uint16_t utf8_cp_index = jclass_cp_add_utf8(jclass, utf8);
+    if (utf8_cp_index == 0) {
+        return 0;
+    }
+
+    for (uint16_t cp_index = 1;cp_index <= jclass->const_pool->size;cp_index++) {
+        CPEntry* cp_entry = get_cp_entry(jclass->const_pool, cp_index - 1);
+        if (cp_entry->tag == cp_entry_tag && *(uint16_t*)cp_entry->value == utf8_cp_index) {
+            return cp_index;
+        }
+    }
+
+    uint16_t* utf8_cp_index_ptr = malloc(sizeof(uint16_t));
+    if (utf8_cp_index_ptr == NULL) {
+        return 0;
+    }
+
+    *utf8_cp_index_ptr = utf8_cp_index;
+
+    return cp_append_entry(jclass, cp_entry_tag, utf8_cp_index_ptr);
+}
 
-    JClass* jclass = malloc(sizeof(JClass));
+static uint16_t cp_add_index_pair(JClass* jclass, CPTag cp_entry_tag, uint16_t first, uint16_t second) {
+    for (uint16_t cp_index = 1;cp_index <= jclass->const_pool->size;cp_index++) {
+        CPEntry* cp_entry = get_cp_entry(jclass->const_pool, cp_index - 1);
+        if (cp_entry->tag == cp_entry_tag) {
+            CPIndexPair* index_pair = cp_entry->value;
+            if (index_pair->first == first && index_pair->second == second) {
+                return cp_index;
+            }
+        }
+    }
+
+    CPIndexPair* index_pair = cp_index_pair_new(first, second);
+    if (index_pair == NULL) {
+        return 0;
+    }
+
+    return cp_append_entry(jclass, cp_entry_tag, index_pair);
+}
+
+uint16_t jclass_cp_add_class(JClass* jclass, const char* class_name) {
+    return cp_add_utf8_ref(jclass, CPClass, class_name);
+}
+
+uint16_t jclass_cp_add_method_ref(JClass* jclass, const char* class_name, const char* method_name, const char* descriptor) {
+    uint16_t class_cp_index = jclass_cp_add_class(jclass, class_name);
+    uint16_t name_cp_index = jclass_cp_add_utf8(jclass, method_name);
+    uint16_t descriptor_cp_index = jclass_cp_add_utf8(jclass, descriptor);
+    if (class_cp_index == 0 || name_cp_index == 0 || descriptor_cp_index == 0) {
+        return 0;
+    }
+
+    uint16_t name_type_cp_index = cp_add_index_pair(jclass, CPNameAndType, name_cp_index, descriptor_cp_index);
+    if (name_type_cp_index == 0) {
+        return 0;
+    }
+
+    return cp_add_index_pair(jclass, CPMethodRef, class_cp_index, name_type_cp_index);
+}
+
+// creating empty class of Java 8 format with no members
+JClass* jclass_new(const char* name, const char* super_name, uint16_t access_flags) {
+    JClass* jclass = calloc(1, sizeof(JClass));
     if (jclass == NULL) {
         return NULL;
     }
 
-    jclass->name = class_name;
-    jclass->const_pool = const_pool;
-    
+    jclass->const_pool = calloc(1, sizeof(CPool));
+    if (jclass->const_pool == NULL) {
+        jclass_free(jclass);
+        return NULL;
+    }
+
+    jclass->major_version = 52;
+    jclass->access_flags = access_flags;
+    jclass->this_class = jclass_cp_add_class(jclass, name);
+    jclass->super_class = jclass_cp_add_class(jclass, super_name);
+    if (jclass->this_class == 0 || jclass->super_class == 0) {
+        jclass_free(jclass);
+        return NULL;
+    }
+
+    jclass->name = (char*)jclass_cp_class_name(jclass, jclass->this_class);
+
     return jclass;
 }
 
+// adding method without attributes, so only abstract and native methods are complete
+JMember* jclass_add_method(JClass* jclass, uint16_t access_flags, const char* name, const char* descriptor) {
+    uint16_t name_cp_index = jclass_cp_add_utf8(jclass, name);
+    uint16_t descriptor_cp_index = jclass_cp_add_utf8(jclass, descriptor);
+    if (name_cp_index == 0 || descriptor_cp_index == 0) {
+        return NULL;
+    }
+
+    JMember* new_methods = realloc(jclass->methods, (jclass->methods_count + 1) * sizeof(JMember));
+    if (new_methods == NULL) {
+        return NULL;
+    }
+
+    jclass->methods = new_methods;
+
+    JMember* method = jclass->methods + jclass->methods_count;
+    memset(method, 0, sizeof(JMember));
+    method->access_flags = access_flags;
+    method->name_index = name_cp_index;
+    method->descriptor_index = descriptor_cp_index;
+
+    jclass->methods_count += 1;
+
+    return method;
+}
+
+JAttribute* jmember_find_attribute(const JClass* jclass, const JMember* member, const char* name) {
+    for (uint16_t attribute_idx = 0;attribute_idx < member->attributes_count;attribute_idx++) {
+        JAttribute* attribute = member->attributes + attribute_idx;
+
+        const char* attribute_name = jclass_cp_utf8(jclass, attribute->name_index);
+        if (attribute_name != NULL && strcmp(attribute_name, name) == 0) {
+            return attribute;
+        }
+    }
+
+    return NULL;
+}
+
+static void write_uint32(uint8_t* buffer, size_t* buffer_pos, uint32_t value) {
+    uint32_t net_value = htonl(value);
+    memcpy(buffer + *buffer_pos, &net_value, sizeof(uint32_t));
+    *buffer_pos += sizeof(uint32_t);
+}
+
+static void write_uint16(uint8_t* buffer, size_t* buffer_pos, uint16_t value) {
+    uint16_t net_value = htons(value);
+    memcpy(buffer + *buffer_pos, &net_value, sizeof(uint16_t));
+    *buffer_pos += sizeof(uint16_t);
+}
+
+static void write_byte(uint8_t* buffer, size_t* buffer_pos, uint8_t value) {
+    buffer[*buffer_pos] = value;
+    *buffer_pos += sizeof(uint8_t);
+}
+
+static void write_uint64(uint8_t* buffer, size_t* buffer_pos, uint64_t value) {
+    write_uint32(buffer, buffer_pos, value >> 32);
+    write_uint32(buffer, buffer_pos, value & 0x00000000FFFFFFFF);
+}
+
+// returning number of bytes constant pool entry takes in class file, including tag
+static size_t cp_entry_size(const CPEntry* cp_entry) {
+    switch (cp_entry->tag) {
+        case CPUtf8: return 1 + 2 + strlen(cp_entry->value);
+        case CPInteger:
+        case CPFloat: return 1 + 4;
+        case CPLong:
+        case CPDouble: return 1 + 8;
+        case CPClass:
+        case CPString:
+        case CPMethodType:
+        case CPModule:
+        case CPPackage: return 1 + 2;
+        case CPMethodHandle: return 1 + 1 + 2;
+        case CPFieldRef:
+        case CPMethodRef:
+        case CPInterfaceMethodRef:
+        case CPNameAndType:
+        case CPDynamic:
+        case CPInvokeDynamic: return 1 + 4;
+        default: return 0; // second slot of long and double entries
+    }
+}
+
+static void write_const_pool_entry(const CPEntry* cp_entry, uint8_t* buffer, size_t* buffer_pos) {
+    if (cp_entry_size(cp_entry) == 0) {
+        return;
+    }
+
+    write_byte(buffer, buffer_pos, cp_entry->tag);
+
+    switch (cp_entry->tag) {
+        case CPUtf8: {
+            uint16_t utf8_length = strlen(cp_entry->value);
+            write_uint16(buffer, buffer_pos, utf8_length);
+            memcpy(buffer + *buffer_pos, cp_entry->value, utf8_length);
+            *buffer_pos += utf8_length;
+            break;
+        }
+        case CPInteger:
+        case CPFloat: {
+            uint32_t value;
+            memcpy(&value, cp_entry->value, sizeof(uint32_t));
+            write_uint32(buffer, buffer_pos, value);
+            break;
+        }
+        case CPLong:
+        case CPDouble: {
+            uint64_t value;
+            memcpy(&value, cp_entry->value, sizeof(uint64_t));
+            write_uint64(buffer, buffer_pos, value);
+            break;
+        }
+        case CPMethodHandle: {
+            CPIndexPair* tag_ref_index_pair = cp_entry->value;
+            write_byte(buffer, buffer_pos, tag_ref_index_pair->first);
+            write_uint16(buffer, buffer_pos, tag_ref_index_pair->second);
+            break;
+        }
+        case CPFieldRef:
+        case CPMethodRef:
+        case CPInterfaceMethodRef:
+        case CPNameAndType:
+        case CPDynamic:
+        case CPInvokeDynamic: {
+            CPIndexPair* index_pair = cp_entry->value;
+            write_uint16(buffer, buffer_pos, index_pair->first);
+            write_uint16(buffer, buffer_pos, index_pair->second);
+            break;
+        }
+        default:
+            write_uint16(buffer, buffer_pos, *(uint16_t*)cp_entry->value);
+            break;
+    }
+}
+
+static size_t attributes_size(uint16_t attributes_count, const JAttribute* attributes) {
+    size_t size = 0;
+    for (uint16_t attribute_idx = 0;attribute_idx < attributes_count;attribute_idx++) {
+        size += 2 + 4 + attributes[attribute_idx].length;
+    }
+
+    return size;
+}
+
+static size_t members_size(uint16_t members_count, const JMember* members) {
+    size_t size = 0;
+    for (uint16_t member_idx = 0;member_idx < members_count;member_idx++) {
+        size += 2 + 2 + 2 + 2 + attributes_size(members[member_idx].attributes_count, members[member_idx].attributes);
+    }
+
+    return size;
+}
+
+static void write_attributes(uint16_t attributes_count, const JAttribute* attributes, uint8_t* buffer, size_t* buffer_pos) {
+    write_uint16(buffer, buffer_pos, attributes_count);
+
+    for (uint16_t attribute_idx = 0;attribute_idx < attributes_count;attribute_idx++) {
+        const JAttribute* attribute = attributes + attribute_idx;
+        write_uint16(buffer, buffer_pos, attribute->name_index);
+        write_uint32(buffer, buffer_pos, attribute->length);
+        memcpy(buffer + *buffer_pos, attribute->info, attribute->length);
+        *buffer_pos += attribute->length;
+    }
+}
+
+static void write_members(uint16_t members_count, const JMember* members, uint8_t* buffer, size_t* buffer_pos) {
+    write_uint16(buffer, buffer_pos, members_count);
+
+    for (uint16_t member_idx = 0;member_idx < members_count;member_idx++) {
+        const JMember* member = members + member_idx;
+        write_uint16(buffer, buffer_pos, member->access_flags);
+        write_uint16(buffer, buffer_pos, member->name_index);
+        write_uint16(buffer, buffer_pos, member->descriptor_index);
+        write_attributes(member->attributes_count, member->attributes, buffer, buffer_pos);
+    }
+}
+
+// serializing class to dynamically allocated buffer, client is responsible for memory reclaiming
+uint8_t* jclass_write(const JClass* jclass, size_t* class_bytes_count) {
+    const CPool* const_pool = jclass->const_pool;
+
+    size_t class_size = 4 + 2 + 2 + 2;
+    for (size_t cp_entry_idx = 0;cp_entry_idx < const_pool->size;cp_entry_idx++) {
+        class_size += cp_entry_size(const_pool->entries + cp_entry_idx);
+    }
+
+    class_size += 2 + 2 + 2 + 2 + jclass->interfaces_count * 2;
+    class_size += 2 + members_size(jclass->fields_count, jclass->fields);
+    class_size += 2 + members_size(jclass->methods_count, jclass->methods);
+    class_size += 2 + attributes_size(jclass->attributes_count, jclass->attributes);
+
+    uint8_t* buffer = malloc(class_size);
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    size_t buffer_pos = 0;
+
+    write_uint32(buffer, &buffer_pos, 0xCAFEBABE);
+    write_uint16(buffer, &buffer_pos, jclass->minor_version);
+    write_uint16(buffer, &buffer_pos, jclass->major_version);
+
+    write_uint16(buffer, &buffer_pos, const_pool->size + 1);
+    for (size_t cp_entry_idx = 0;cp_entry_idx < const_pool->size;cp_entry_idx++) {
+        write_const_pool_entry(const_pool->entries + cp_entry_idx, buffer, &buffer_pos);
+    }
+
+    write_uint16(buffer, &buffer_pos, jclass->access_flags);
+    write_uint16(buffer, &buffer_pos, jclass->this_class);
+    write_uint16(buffer, &buffer_pos, jclass->super_class);
+
+    write_uint16(buffer, &buffer_pos, jclass->interfaces_count);
+    for (uint16_t interface_idx = 0;interface_idx < jclass->interfaces_count;interface_idx++) {
+        write_uint16(buffer, &buffer_pos, jclass->interfaces[interface_idx]);
+    }
+
+    write_members(jclass->fields_count, jclass->fields, buffer, &buffer_pos);
+    write_members(jclass->methods_count, jclass->methods, buffer, &buffer_pos);
+    write_attributes(jclass->attributes_count, jclass->attributes, buffer, &buffer_pos);
+
+    *class_bytes_count = buffer_pos;
+
+    return buffer;
+}
+
+static void free_attributes(uint16_t attributes_count, JAttribute* attributes) {
+    if (attributes == NULL) {
+        return;
+    }
+
+    for (uint16_t attribute_idx = 0;attribute_idx < attributes_count;attribute_idx++) {
+        free(attributes[attribute_idx].info);
+    }
+
+    free(attributes);
+}
+
+static void free_members(uint16_t members_count, JMember* members) {
+    if (members == NULL) {
+        return;
+    }
+
+    for (uint16_t member_idx = 0;member_idx < members_count;member_idx++) {
+        free_attributes(members[member_idx].attributes_count, members[member_idx].attributes);
+    }
+
+    free(members);
+}
+
 void jclass_free(JClass* jclass) {
     CPool* const_pool = jclass->const_pool;
-    for (int cp_entry_idx = 0;cp_entry_idx < const_pool->size;cp_entry_idx++) {
-        CPEntry* cp_entry = get_cp_entry(const_pool, cp_entry_idx);
-        free(cp_entry->value);
+    if (const_pool != NULL) {
+        for (int cp_entry_idx = 0;cp_entry_idx < const_pool->size;cp_entry_idx++) {
+            CPEntry* cp_entry = get_cp_entry(const_pool, cp_entry_idx);
+            free(cp_entry->value);
+        }
+
+        free(const_pool);
     }
 
-    free(const_pool);
+    free(jclass->interfaces);
+    free_members(jclass->fields_count, jclass->fields);
+    free_members(jclass->methods_count, jclass->methods);
+    free_attributes(jclass->attributes_count, jclass->attributes);
+
     free(jclass);
-}
\ No newline at end of file
+}
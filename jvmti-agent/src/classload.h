@@ -15,7 +15,10 @@ typedef enum {
     CPNameAndType = 12,
     CPMethodHandle = 15,
     CPMethodType = 16,
-    CPInvokeDynamic = 18
+    CPDynamic = 17,
+    CPInvokeDynamic = 18,
+    CPModule = 19,
+    CPPackage = 20
 } CPTag;
 
 typedef struct {
@@ -28,12 +31,64 @@ typedef struct {
     CPEntry entries[];
 } CPool;
 
+typedef struct {
+    uint16_t first;
+    uint16_t second;
+} CPIndexPair;
+
+// attribute body is kept as is, interpretation is up to the client
+typedef struct {
+    uint16_t name_index;
+    uint32_t length;
+    uint8_t* info;
+} JAttribute;
+
+// field or method
+typedef struct {
+    uint16_t access_flags;
+    uint16_t name_index;
+    uint16_t descriptor_index;
+    uint16_t attributes_count;
+    JAttribute* attributes;
+} JMember;
+
 typedef struct {
     char* name;
     CPool* const_pool;
+    uint16_t minor_version;
+    uint16_t major_version;
+    uint16_t access_flags;
+    uint16_t this_class;
+    uint16_t super_class;
+    uint16_t interfaces_count;
+    uint16_t* interfaces;
+    uint16_t fields_count;
+    JMember* fields;
+    uint16_t methods_count;
+    JMember* methods;
+    uint16_t attributes_count;
+    JAttribute* attributes;
 } JClass;
 
-JClass* jclass_load(const uint8_t* buffer);
+JClass* jclass_load(const uint8_t* buffer, size_t length);
+
+JClass* jclass_new(const char* name, const char* super_name, uint16_t access_flags);
+
+const char* jclass_cp_utf8(const JClass* jclass, uint16_t cp_index);
+
+const char* jclass_cp_class_name(const JClass* jclass, uint16_t cp_index);
+
+uint16_t jclass_cp_add_utf8(JClass* jclass, const char* utf8);
+
+uint16_t jclass_cp_add_class(JClass* jclass, const char* class_name);
+
+uint16_t jclass_cp_add_method_ref(JClass* jclass, const char* class_name, const char* method_name, const char* descriptor);
+
+JMember* jclass_add_method(JClass* jclass, uint16_t access_flags, const char* name, const char* descriptor);
+
+JAttribute* jmember_find_attribute(const JClass* jclass, const JMember* member, const char* name);
+
+uint8_t* jclass_write(const JClass* jclass, size_t* class_bytes_count);
 
 void jclass_free(JClass* jclass);
 
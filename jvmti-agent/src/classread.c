@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "classread.h"
+
+// open, read and close requests per file
+#define REQUESTS_PER_FILE 3
+
+#define REQUEST_OPEN 0
+#define REQUEST_READ 1
+#define REQUEST_CLOSE 2
+
+// probe op table is indexed by u8 opcode
+#define PROBE_OPS_COUNT 256
+
+static int io_uring_setup(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int ring_fd, unsigned opcode, const void* arg, unsigned args_count) {
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, args_count);
+}
+
+static void reader_close_ring(ClassFileReader* reader) {
+    if (reader->sqes != NULL) {
+        munmap(reader->sqes, reader->sqes_size);
+        reader->sqes = NULL;
+    }
+
+    if (reader->cq_ring != NULL && reader->cq_ring != reader->sq_ring) {
+        munmap(reader->cq_ring, reader->cq_ring_size);
+    }
+
+    reader->cq_ring = NULL;
+
+    if (reader->sq_ring != NULL) {
+        munmap(reader->sq_ring, reader->sq_ring_size);
+        reader->sq_ring = NULL;
+    }
+
+    if (reader->ring_fd != -1) {
+        close(reader->ring_fd);
+        reader->ring_fd = -1;
+    }
+}
+
+static struct io_uring_sqe* next_sqe(ClassFileReader* reader, unsigned* tail) {
+    unsigned sqe_idx = *tail & *reader->sq_ring_mask;
+    reader->sq_array[sqe_idx] = sqe_idx;
+    *tail += 1;
+
+    struct io_uring_sqe* sqe = &reader->sqes[sqe_idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    return sqe;
+}
+
+// submitting the only queued request and waiting for its result
+static bool complete_request(ClassFileReader* reader, unsigned tail, int* result) {
+    __atomic_store_n(reader->sq_tail, tail, __ATOMIC_RELEASE);
+
+    unsigned head = *reader->cq_head;
+    unsigned to_submit = 1;
+    while (head == __atomic_load_n(reader->cq_tail, __ATOMIC_ACQUIRE)) {
+        int enter_status = io_uring_enter(reader->ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+        if (enter_status == -1 && errno != EINTR) {
+            return false;
+        }
+
+        if (enter_status > 0) {
+            to_submit = 0;
+        }
+    }
+
+    *result = reader->cqes[head & *reader->cq_ring_mask].res;
+    __atomic_store_n(reader->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+// open and close of direct descriptors need kernel 5.15, older kernels ignore 'file_index' and open a regular
+// descriptor instead, reads of the empty slot would fail then and close request would close descriptor 0
+static bool reader_supports_direct_open(ClassFileReader* reader) {
+    struct io_uring_probe* probe = calloc(1, sizeof(struct io_uring_probe) + PROBE_OPS_COUNT * sizeof(struct io_uring_probe_op));
+    if (probe == NULL) {
+        return false;
+    }
+
+    bool ops_supported = io_uring_register(reader->ring_fd, IORING_REGISTER_PROBE, probe, PROBE_OPS_COUNT) != -1;
+
+    const uint8_t required_ops[] = { IORING_OP_OPENAT, IORING_OP_READ_FIXED, IORING_OP_CLOSE };
+    for (size_t op_idx = 0;op_idx < sizeof(required_ops) && ops_supported;op_idx++) {
+        uint8_t op = required_ops[op_idx];
+        ops_supported = op < probe->ops_len && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+
+    free(probe);
+
+    if (!ops_supported) {
+        return false;
+    }
+
+    // descriptor 0 is taken while probing, so regular descriptor opened by old kernel can't look like slot index
+    int placeholder_fd = fcntl(0, F_GETFD) == -1 ? open("/dev/null", O_RDONLY) : -1;
+
+    unsigned tail = *reader->sq_tail;
+    struct io_uring_sqe* sqe = next_sqe(reader, &tail);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)"/dev/null";
+    sqe->open_flags = O_RDONLY;
+    sqe->file_index = 1;
+
+    int open_result = -1;
+    bool direct_open = complete_request(reader, tail, &open_result) && open_result == 0;
+    if (open_result > 0) {
+        close(open_result);
+    }
+
+    if (direct_open) {
+        tail = *reader->sq_tail;
+        sqe = next_sqe(reader, &tail);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->file_index = 1;
+
+        int close_result = -1;
+        direct_open = complete_request(reader, tail, &close_result) && close_result == 0;
+    }
+
+    if (placeholder_fd != -1) {
+        close(placeholder_fd);
+    }
+
+    return direct_open;
+}
+
+// setting up ring with buffers registered once, and sparse table of direct descriptors
+// the open requests install files into, so read request can be linked to open
+static bool reader_open_ring(ClassFileReader* reader) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    reader->ring_fd = io_uring_setup(reader->max_files * REQUESTS_PER_FILE, &params);
+    if (reader->ring_fd == -1) {
+        return false;
+    }
+
+    reader->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    reader->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+        if (reader->cq_ring_size > reader->sq_ring_size) {
+            reader->sq_ring_size = reader->cq_ring_size;
+        }
+
+        reader->cq_ring_size = reader->sq_ring_size;
+    }
+
+    reader->sq_ring = mmap(NULL, reader->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            reader->ring_fd, IORING_OFF_SQ_RING);
+    if (reader->sq_ring == MAP_FAILED) {
+        reader->sq_ring = NULL;
+        reader_close_ring(reader);
+        return false;
+    }
+
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+        reader->cq_ring = reader->sq_ring;
+    } else {
+        reader->cq_ring = mmap(NULL, reader->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                reader->ring_fd, IORING_OFF_CQ_RING);
+        if (reader->cq_ring == MAP_FAILED) {
+            reader->cq_ring = NULL;
+            reader_close_ring(reader);
+            return false;
+        }
+    }
+
+    reader->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    reader->sqes = mmap(NULL, reader->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            reader->ring_fd, IORING_OFF_SQES);
+    if (reader->sqes == MAP_FAILED) {
+        reader->sqes = NULL;
+        reader_close_ring(reader);
+        return false;
+    }
+
+    uint8_t* sq_ring = reader->sq_ring;
+    reader->sq_head = (unsigned*)(sq_ring + params.sq_off.head);
+    reader->sq_tail = (unsigned*)(sq_ring + params.sq_off.tail);
+    reader->sq_ring_mask = (unsigned*)(sq_ring + params.sq_off.ring_mask);
+    reader->sq_array = (unsigned*)(sq_ring + params.sq_off.array);
+
+    uint8_t* cq_ring = reader->cq_ring;
+    reader->cq_head = (unsigned*)(cq_ring + params.cq_off.head);
+    reader->cq_tail = (unsigned*)(cq_ring + params.cq_off.tail);
+    reader->cq_ring_mask = (unsigned*)(cq_ring + params.cq_off.ring_mask);
+    reader->cqes = (struct io_uring_cqe*)(cq_ring + params.cq_off.cqes);
+
+    struct iovec buffer_iovecs[reader->max_files];
+    int file_slots[reader->max_files];
+    for (uint32_t file_idx = 0;file_idx < reader->max_files;file_idx++) {
+        buffer_iovecs[file_idx].iov_base = reader->buffers + (size_t)file_idx * reader->buffer_size;
+        buffer_iovecs[file_idx].iov_len = reader->buffer_size;
+        file_slots[file_idx] = -1;
+    }
+
+    if (io_uring_register(reader->ring_fd, IORING_REGISTER_BUFFERS, buffer_iovecs, reader->max_files) == -1
+            || io_uring_register(reader->ring_fd, IORING_REGISTER_FILES, file_slots, reader->max_files) == -1
+            || !reader_supports_direct_open(reader)) {
+        reader_close_ring(reader);
+        return false;
+    }
+
+    return true;
+}
+
+ClassFileReader* class_file_reader_new(uint32_t max_files, uint32_t buffer_size) {
+    ClassFileReader* reader = calloc(1, sizeof(ClassFileReader));
+    if (reader == NULL) {
+        return NULL;
+    }
+
+    reader->max_files = max_files;
+    reader->buffer_size = buffer_size;
+    reader->ring_fd = -1;
+
+    reader->buffers = mmap(NULL, (size_t)max_files * buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    reader->overflow_buffers = calloc(max_files, sizeof(uint8_t*));
+    if (reader->buffers == MAP_FAILED || reader->overflow_buffers == NULL) {
+        if (reader->buffers != MAP_FAILED) {
+            munmap(reader->buffers, (size_t)max_files * buffer_size);
+        }
+
+        free(reader->overflow_buffers);
+        free(reader);
+        return NULL;
+    }
+
+    // io_uring may be missing or disabled, reader works synchronously then
+    reader_open_ring(reader);
+
+    return reader;
+}
+
+bool class_file_reader_uses_io_uring(const ClassFileReader* reader) {
+    return reader->ring_fd != -1;
+}
+
+static void read_file(ClassFileReader* reader, uint32_t file_idx, ClassFileRead* file) {
+    FILE* class_file = fopen(file->path, "rb");
+    if (class_file == NULL) {
+        file->error = errno;
+        return;
+    }
+
+    struct stat class_file_stat;
+    if (fstat(fileno(class_file), &class_file_stat) == -1) {
+        file->error = errno;
+        fclose(class_file);
+        return;
+    }
+
+    uint8_t* buffer = reader->buffers + (size_t)file_idx * reader->buffer_size;
+    if (class_file_stat.st_size > reader->buffer_size) {
+        buffer = malloc(class_file_stat.st_size);
+        if (buffer == NULL) {
+            file->error = ENOMEM;
+            fclose(class_file);
+            return;
+        }
+
+        reader->overflow_buffers[file_idx] = buffer;
+    }
+
+    if (class_file_stat.st_size > 0 && fread(buffer, class_file_stat.st_size, 1, class_file) != 1) {
+        file->error = EIO;
+    } else {
+        file->bytes = buffer;
+        file->bytes_count = class_file_stat.st_size;
+    }
+
+    fclose(class_file);
+}
+
+// reading files of a chunk with a single io_uring_enter call, false is returned when ring failed as a whole
+static bool read_files_with_ring(ClassFileReader* reader, ClassFileRead* files, uint32_t files_count) {
+    unsigned tail = *reader->sq_tail;
+
+    for (uint32_t file_idx = 0;file_idx < files_count;file_idx++) {
+        uint64_t user_data = (uint64_t)file_idx * REQUESTS_PER_FILE;
+
+        // opening file into direct descriptor slot, read request refers to the slot
+        struct io_uring_sqe* sqe = next_sqe(reader, &tail);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t)files[file_idx].path;
+        sqe->open_flags = O_RDONLY;
+        sqe->file_index = file_idx + 1;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = user_data + REQUEST_OPEN;
+
+        sqe = next_sqe(reader, &tail);
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->fd = file_idx;
+        sqe->addr = (uintptr_t)(reader->buffers + (size_t)file_idx * reader->buffer_size);
+        sqe->len = reader->buffer_size;
+        sqe->off = 0;
+        sqe->buf_index = file_idx;
+        // close request runs even if read fails
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+        sqe->user_data = user_data + REQUEST_READ;
+
+        sqe = next_sqe(reader, &tail);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->file_index = file_idx + 1;
+        sqe->user_data = user_data + REQUEST_CLOSE;
+    }
+
+    __atomic_store_n(reader->sq_tail, tail, __ATOMIC_RELEASE);
+
+    unsigned requests_count = files_count * REQUESTS_PER_FILE;
+    unsigned completed_count = 0;
+
+    while (completed_count < requests_count) {
+        int enter_status = io_uring_enter(reader->ring_fd, completed_count == 0 ? requests_count : 0,
+                requests_count - completed_count, IORING_ENTER_GETEVENTS);
+        if (enter_status == -1 && errno != EINTR) {
+            return false;
+        }
+
+        unsigned head = *reader->cq_head;
+        unsigned cq_tail = __atomic_load_n(reader->cq_tail, __ATOMIC_ACQUIRE);
+
+        for (;head != cq_tail;head++) {
+            const struct io_uring_cqe* cqe = &reader->cqes[head & *reader->cq_ring_mask];
+
+            uint32_t file_idx = cqe->user_data / REQUESTS_PER_FILE;
+            ClassFileRead* file = &files[file_idx];
+
+            switch (cqe->user_data % REQUESTS_PER_FILE) {
+                case REQUEST_OPEN:
+                    if (cqe->res < 0) {
+                        file->error = -cqe->res;
+                    }
+                    break;
+                case REQUEST_READ:
+                    // slot or buffer the kernel couldn't use isn't an error of the file, it's read synchronously
+                    if (cqe->res >= 0) {
+                        file->bytes = reader->buffers + (size_t)file_idx * reader->buffer_size;
+                        file->bytes_count = cqe->res;
+                    } else if (file->error == 0 && cqe->res != -EBADF && cqe->res != -EINVAL) {
+                        file->error = -cqe->res;
+                    }
+                    break;
+                default:
+                    break;
+            }
+
+            completed_count += 1;
+        }
+
+        __atomic_store_n(reader->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+// at most max_files are read, since bytes of a batch live in reader buffers until the next one,
+// files past max_files aren't read and get EOVERFLOW error, clients should pass at most max_files
+void class_file_reader_read(ClassFileReader* reader, ClassFileRead* files, uint32_t files_count) {
+    for (uint32_t file_idx = reader->max_files;file_idx < files_count;file_idx++) {
+        files[file_idx].bytes = NULL;
+        files[file_idx].bytes_count = 0;
+        files[file_idx].error = EOVERFLOW;
+    }
+
+    if (files_count > reader->max_files) {
+        files_count = reader->max_files;
+    }
+
+    for (uint32_t file_idx = 0;file_idx < reader->max_files;file_idx++) {
+        free(reader->overflow_buffers[file_idx]);
+        reader->overflow_buffers[file_idx] = NULL;
+    }
+
+    for (uint32_t file_idx = 0;file_idx < files_count;file_idx++) {
+        files[file_idx].bytes = NULL;
+        files[file_idx].bytes_count = 0;
+        files[file_idx].error = 0;
+    }
+
+    if (class_file_reader_uses_io_uring(reader) && !read_files_with_ring(reader, files, files_count)) {
+        reader_close_ring(reader);
+    }
+
+    for (uint32_t file_idx = 0;file_idx < files_count;file_idx++) {
+        ClassFileRead* file = &files[file_idx];
+
+        // filled registered buffer means file may be larger, it's read again synchronously
+        bool read_again = (file->bytes == NULL && file->error == 0) || file->bytes_count == reader->buffer_size;
+        if (read_again) {
+            file->bytes = NULL;
+            file->bytes_count = 0;
+            file->error = 0;
+
+            read_file(reader, file_idx, file);
+        }
+    }
+}
+
+void class_file_reader_free(ClassFileReader* reader) {
+    reader_close_ring(reader);
+
+    for (uint32_t file_idx = 0;file_idx < reader->max_files;file_idx++) {
+        free(reader->overflow_buffers[file_idx]);
+    }
+
+    free(reader->overflow_buffers);
+    munmap(reader->buffers, (size_t)reader->max_files * reader->buffer_size);
+
+    free(reader);
+}
@@ -0,0 +1,48 @@
+#ifndef _CLASSREAD_H_
+#define _CLASSREAD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    const char* path;
+    // filled in by reader, bytes stay valid until the next batch is read
+    const uint8_t* bytes;
+    uint32_t bytes_count;
+    int error;
+} ClassFileRead;
+
+// reads batch of class files with linked io_uring requests, one submission per batch,
+// falls back to synchronous reads when io_uring isn't available
+typedef struct {
+    uint32_t max_files;
+    uint32_t buffer_size;
+    uint8_t* buffers;
+    // files larger than registered buffer are read synchronously into these
+    uint8_t** overflow_buffers;
+    int ring_fd;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_ring_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_ring_mask;
+    struct io_uring_cqe* cqes;
+} ClassFileReader;
+
+ClassFileReader* class_file_reader_new(uint32_t max_files, uint32_t buffer_size);
+
+bool class_file_reader_uses_io_uring(const ClassFileReader* reader);
+
+void class_file_reader_read(ClassFileReader* reader, ClassFileRead* files, uint32_t files_count);
+
+void class_file_reader_free(ClassFileReader* reader);
+
+#endif
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "agent.h"
+#include "hashmap.h"
+#include "stacktable.h"
+#include "cpuprof.h"
+
+#define CPU_PROFILER_MAX_FRAMES 128
+
+static const long NANOS_PER_SECOND = 1000000000L;
+
+static void advance_time(struct timespec* time, long nanos) {
+    time->tv_nsec += nanos;
+    while (time->tv_nsec >= NANOS_PER_SECOND) {
+        time->tv_nsec -= NANOS_PER_SECOND;
+        time->tv_sec += 1;
+    }
+}
+
+static void sample_threads(CpuProfiler* cpu_profiler) {
+    jvmtiEnv* jvmti = cpu_profiler->jvmti;
+
+    jvmtiStackInfo* stack_infos = NULL;
+    jint threads_count = 0;
+    jvmtiError error = (*jvmti)->GetAllStackTraces(jvmti, CPU_PROFILER_MAX_FRAMES, &stack_infos, &threads_count);
+    if (error != JVMTI_ERROR_NONE) {
+        return;
+    }
+
+    for (jint thread_idx = 0;thread_idx < threads_count;thread_idx++) {
+        jvmtiStackInfo* stack_info = stack_infos + thread_idx;
+
+        // only threads which are able to burn CPU are sampled
+        if ((stack_info->state & JVMTI_THREAD_STATE_RUNNABLE) == 0 || stack_info->frame_count == 0) {
+            continue;
+        }
+
+        jmethodID methods[CPU_PROFILER_MAX_FRAMES];
+        for (jint frame_idx = 0;frame_idx < stack_info->frame_count;frame_idx++) {
+            methods[frame_idx] = stack_info->frame_buffer[frame_idx].method;
+        }
+
+        stack_table_add(cpu_profiler->stacks, jvmti, methods, stack_info->frame_count, NULL, 1);
+    }
+
+    // stack info array and frame buffers are allocated as a single block
+    (*jvmti)->Deallocate(jvmti, (unsigned char*)stack_infos);
+}
+
+static void* cpu_profiler_activity(void* arg) {
+    CpuProfiler* cpu_profiler = arg;
+
+    JNIEnv* jni = NULL;
+    jint attach_thread_status = (*cpu_profiler->jvm)->AttachCurrentThreadAsDaemon(cpu_profiler->jvm, (void**)&jni, NULL);
+    if (attach_thread_status != JNI_OK) {
+        log_debug("failed to attach 'cpu profiler' thread");
+        return NULL;
+    }
+
+    log_debug("'cpu profiler' thread is running");
+
+    struct timespec next_sample_time;
+    clock_gettime(CLOCK_MONOTONIC, &next_sample_time);
+
+    while (atomic_load(&cpu_profiler->sampling)) {
+        sample_threads(cpu_profiler);
+
+        // sleeping until absolute deadline, so sampling cost doesn't shift sampling rate
+        advance_time(&next_sample_time, cpu_profiler->sampling_period_ns);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_sample_time, NULL);
+    }
+
+    log_debug("'cpu profiler' thread stopping...");
+
+    (*cpu_profiler->jvm)->DetachCurrentThread(cpu_profiler->jvm);
+
+    return NULL;
+}
+
+CpuProfiler* cpu_profiler_start(JavaVM* jvm, jvmtiEnv* jvmti, int sampling_rate) {
+    if (sampling_rate <= 0) {
+        return NULL;
+    }
+
+    CpuProfiler* cpu_profiler = malloc(sizeof(CpuProfiler));
+    if (cpu_profiler == NULL) {
+        return NULL;
+    }
+
+    cpu_profiler->stacks = stack_table_new(jvm);
+    if (cpu_profiler->stacks == NULL) {
+        free(cpu_profiler);
+        return NULL;
+    }
+
+    cpu_profiler->jvm = jvm;
+    cpu_profiler->jvmti = jvmti;
+    cpu_profiler->sampling_period_ns = NANOS_PER_SECOND / sampling_rate;
+    atomic_store(&cpu_profiler->sampling, true);
+
+    int thread_create_status = pthread_create(&cpu_profiler->sampling_thread, NULL, cpu_profiler_activity, cpu_profiler);
+    if (thread_create_status != 0) {
+        stack_table_free(cpu_profiler->stacks);
+        free(cpu_profiler);
+        return NULL;
+    }
+
+    return cpu_profiler;
+}
+
+bool cpu_profiler_dump(CpuProfiler* cpu_profiler, const char* file_path) {
+    return stack_table_dump(cpu_profiler->stacks, file_path, StackSiteTotal);
+}
+
+void cpu_profiler_stop(CpuProfiler* cpu_profiler) {
+    atomic_store(&cpu_profiler->sampling, false);
+
+    pthread_join(cpu_profiler->sampling_thread, NULL);
+
+    stack_table_free(cpu_profiler->stacks);
+
+    free(cpu_profiler);
+}
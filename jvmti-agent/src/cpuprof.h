@@ -0,0 +1,23 @@
+#ifndef _CPUPROF_H_
+#define _CPUPROF_H_
+
+#include <jvmti.h>
+
+#include "stacktable.h"
+
+typedef struct {
+    JavaVM* jvm;
+    jvmtiEnv* jvmti;
+    long sampling_period_ns;
+    StackTable* stacks;
+    pthread_t sampling_thread;
+    atomic_bool sampling;
+} CpuProfiler;
+
+CpuProfiler* cpu_profiler_start(JavaVM* jvm, jvmtiEnv* jvmti, int sampling_rate);
+
+bool cpu_profiler_dump(CpuProfiler* cpu_profiler, const char* file_path);
+
+void cpu_profiler_stop(CpuProfiler* cpu_profiler);
+
+#endif
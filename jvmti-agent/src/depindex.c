@@ -0,0 +1,723 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+
+#include "agent.h"
+#include "strarena.h"
+#include "classload.h"
+#include "depindex.h"
+
+#define HASH_SEED 14695981039346656037ULL
+#define HASH_PRIME 1099511628211ULL
+
+#define ACC_STATIC 0x0008
+#define ACC_FINAL 0x0010
+// public, private, protected and static, changing them breaks linkage of referencing classes
+#define MEMBER_LINKAGE_FLAGS 0x000F
+// public, final, interface, abstract, annotation and enum
+#define CLASS_SHAPE_FLAGS 0x6611
+
+// platform classes are never reloaded, so references to them aren't indexed
+static const char* const PLATFORM_PACKAGES[] = { "java/", "javax/", "jdk/", "sun/", "com/sun/" };
+
+typedef enum {
+    DependentOfShape,
+    DependentOfMember,
+    DependentOfConstant
+} DependentReason;
+
+typedef struct {
+    StrHandle class_name;
+    DependentReason reason;
+    // class or member the dependent was found by
+    StrHandle cause;
+} Dependent;
+
+typedef struct {
+    const StrHandle* batch_classes;
+    size_t batch_classes_count;
+    Dependent* dependents;
+    size_t dependents_count;
+    size_t dependents_capacity;
+} DependentSet;
+
+static uint64_t hash_bytes(uint64_t hash, const void* bytes, size_t bytes_count) {
+    const uint8_t* byte_pos = bytes;
+    for (size_t byte_idx = 0;byte_idx < bytes_count;byte_idx++) {
+        hash ^= byte_pos[byte_idx];
+        hash *= HASH_PRIME;
+    }
+
+    return hash;
+}
+
+static bool is_platform_class(const char* class_name, size_t class_name_len) {
+    for (size_t package_idx = 0;package_idx < sizeof(PLATFORM_PACKAGES) / sizeof(PLATFORM_PACKAGES[0]);package_idx++) {
+        size_t package_len = strlen(PLATFORM_PACKAGES[package_idx]);
+        if (class_name_len > package_len && strncmp(class_name, PLATFORM_PACKAGES[package_idx], package_len) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// array classes depend on their element class, e.g. "[[Lcom/acme/Service;" on "com/acme/Service"
+static StrHandle intern_referenced_class(DependencyIndex* dependency_index, const char* class_name) {
+    size_t class_name_len = strnlen(class_name, PATH_MAX);
+
+    if (class_name[0] == '[') {
+        while (class_name_len > 0 && class_name[0] == '[') {
+            class_name += 1;
+            class_name_len -= 1;
+        }
+
+        // primitive arrays have no element class
+        if (class_name_len < 3 || class_name[0] != 'L' || class_name[class_name_len - 1] != ';') {
+            return 0;
+        }
+
+        class_name += 1;
+        class_name_len -= 2;
+    }
+
+    if (is_platform_class(class_name, class_name_len)) {
+        return 0;
+    }
+
+    return str_arena_intern(dependency_index->class_names, class_name, class_name_len);
+}
+
+static StrHandle intern_member(DependencyIndex* dependency_index, const char* owner_name, const char* name,
+        const char* descriptor) {
+    char member_name[MEMBER_NAME_MAX_LENGTH];
+    int member_name_len = snprintf(member_name, sizeof(member_name), "%s.%s:%s", owner_name, name, descriptor);
+    if (member_name_len < 0 || (size_t)member_name_len >= sizeof(member_name)) {
+        return 0;
+    }
+
+    return str_arena_intern(dependency_index->member_names, member_name, member_name_len);
+}
+
+static StrHandle intern_referenced_member(DependencyIndex* dependency_index, const JClass* jclass, const CPIndexPair* ref) {
+    // members called on arrays are members of 'java/lang/Object'
+    const char* owner_name = jclass_cp_class_name(jclass, ref->first);
+    if (owner_name == NULL || owner_name[0] == '[' || strcmp(owner_name, jclass->name) == 0
+            || is_platform_class(owner_name, strnlen(owner_name, PATH_MAX))) {
+        return 0;
+    }
+
+    if (ref->second == 0 || ref->second > jclass->const_pool->size) {
+        return 0;
+    }
+
+    const CPEntry* name_and_type_entry = &jclass->const_pool->entries[ref->second - 1];
+    if (name_and_type_entry->tag != CPNameAndType) {
+        return 0;
+    }
+
+    const CPIndexPair* name_and_type = name_and_type_entry->value;
+    const char* name = jclass_cp_utf8(jclass, name_and_type->first);
+    const char* descriptor = jclass_cp_utf8(jclass, name_and_type->second);
+    if (name == NULL || descriptor == NULL) {
+        return 0;
+    }
+
+    return intern_member(dependency_index, owner_name, name, descriptor);
+}
+
+static int compare_handles(const void* handle, const void* other_handle) {
+    StrHandle value = *(const StrHandle*)handle;
+    StrHandle other_value = *(const StrHandle*)other_handle;
+
+    return value < other_value ? -1 : value > other_value;
+}
+
+// sorting handles and dropping duplicates, constant pool may reference the same member with different entries
+static uint32_t unique_handles(StrHandle* handles, uint32_t handles_count) {
+    if (handles_count == 0) {
+        return 0;
+    }
+
+    qsort(handles, handles_count, sizeof(StrHandle), compare_handles);
+
+    uint32_t unique_count = 1;
+    for (uint32_t handle_idx = 1;handle_idx < handles_count;handle_idx++) {
+        if (handles[handle_idx] != handles[unique_count - 1]) {
+            handles[unique_count++] = handles[handle_idx];
+        }
+    }
+
+    return unique_count;
+}
+
+// literals are kept as "I:42", "J:42", "F:<bits>", "D:<bits>" and "S:<string>", so the same value
+// of any class gets the same handle and recompiled class with the same constants doesn't look changed
+static StrHandle intern_literal(DependencyIndex* dependency_index, const JClass* jclass, uint16_t cp_index) {
+    if (cp_index == 0 || cp_index > jclass->const_pool->size) {
+        return 0;
+    }
+
+    const CPEntry* cp_entry = &jclass->const_pool->entries[cp_index - 1];
+
+    char number_literal[32];
+    int number_literal_len = -1;
+
+    switch (cp_entry->tag) {
+        case CPInteger: {
+            int32_t value;
+            memcpy(&value, cp_entry->value, sizeof(value));
+            number_literal_len = snprintf(number_literal, sizeof(number_literal), "I:%d", value);
+            break;
+        }
+        case CPFloat: {
+            uint32_t bits;
+            memcpy(&bits, cp_entry->value, sizeof(bits));
+            number_literal_len = snprintf(number_literal, sizeof(number_literal), "F:%08x", bits);
+            break;
+        }
+        case CPLong: {
+            int64_t value;
+            memcpy(&value, cp_entry->value, sizeof(value));
+            number_literal_len = snprintf(number_literal, sizeof(number_literal), "J:%lld", (long long)value);
+            break;
+        }
+        case CPDouble: {
+            uint64_t bits;
+            memcpy(&bits, cp_entry->value, sizeof(bits));
+            number_literal_len = snprintf(number_literal, sizeof(number_literal), "D:%016llx", (unsigned long long)bits);
+            break;
+        }
+        case CPString: {
+            const char* str = jclass_cp_utf8(jclass, *(const uint16_t*)cp_entry->value);
+            if (str == NULL) {
+                return 0;
+            }
+
+            size_t str_len = strlen(str);
+            char* string_literal = malloc(str_len + 2);
+            if (string_literal == NULL) {
+                return 0;
+            }
+
+            memcpy(string_literal, "S:", 2);
+            memcpy(string_literal + 2, str, str_len);
+
+            StrHandle literal = str_arena_intern(dependency_index->literals, string_literal, str_len + 2);
+
+            free(string_literal);
+
+            return literal;
+        }
+        default:
+            return 0;
+    }
+
+    if (number_literal_len < 0 || (size_t)number_literal_len >= sizeof(number_literal)) {
+        return 0;
+    }
+
+    return str_arena_intern(dependency_index->literals, number_literal, number_literal_len);
+}
+
+static bool declare_member(DependencyIndex* dependency_index, const JClass* jclass, const JMember* member, bool field,
+        DeclaredMember* declared_member) {
+    const char* name = jclass_cp_utf8(jclass, member->name_index);
+    const char* descriptor = jclass_cp_utf8(jclass, member->descriptor_index);
+    if (name == NULL || descriptor == NULL) {
+        return false;
+    }
+
+    declared_member->member_name = intern_member(dependency_index, jclass->name, name, descriptor);
+    declared_member->access_flags = member->access_flags;
+    declared_member->constant_literal = 0;
+
+    if (field && (member->access_flags & (ACC_STATIC | ACC_FINAL)) == (ACC_STATIC | ACC_FINAL)) {
+        JAttribute* constant_value = jmember_find_attribute(jclass, member, "ConstantValue");
+        if (constant_value != NULL && constant_value->length == 2) {
+            uint16_t cp_index = (constant_value->info[0] << 8) | constant_value->info[1];
+            declared_member->constant_literal = intern_literal(dependency_index, jclass, cp_index);
+        }
+    }
+
+    return declared_member->member_name != 0;
+}
+
+static uint64_t hash_class_shape(const JClass* jclass) {
+    uint16_t access_flags = jclass->access_flags & CLASS_SHAPE_FLAGS;
+    uint64_t hash = hash_bytes(HASH_SEED, &access_flags, sizeof(access_flags));
+
+    // 'java/lang/Object' has no super class
+    const char* super_name = jclass_cp_class_name(jclass, jclass->super_class);
+    if (super_name != NULL) {
+        hash = hash_bytes(hash, super_name, strlen(super_name) + 1);
+    }
+
+    for (uint16_t interface_idx = 0;interface_idx < jclass->interfaces_count;interface_idx++) {
+        const char* interface_name = jclass_cp_class_name(jclass, jclass->interfaces[interface_idx]);
+        if (interface_name != NULL) {
+            hash = hash_bytes(hash, interface_name, strlen(interface_name) + 1);
+        }
+    }
+
+    return hash;
+}
+
+static void free_dependencies(ClassDependencies* dependencies) {
+    free(dependencies->referenced_classes);
+    free(dependencies->referenced_members);
+    free(dependencies->declared_members);
+    free(dependencies->literals);
+    free(dependencies);
+}
+
+static ClassDependencies* build_dependencies(DependencyIndex* dependency_index, const JClass* jclass, StrHandle class_name) {
+    ClassDependencies* dependencies = calloc(1, sizeof(ClassDependencies));
+    if (dependencies == NULL) {
+        return NULL;
+    }
+
+    // every constant pool entry references at most one class, member or literal
+    size_t cp_size = jclass->const_pool->size;
+    dependencies->referenced_classes = calloc(cp_size + 1, sizeof(StrHandle));
+    dependencies->referenced_members = calloc(cp_size + 1, sizeof(StrHandle));
+    dependencies->literals = calloc(cp_size + 1, sizeof(StrHandle));
+    dependencies->declared_members = calloc(jclass->fields_count + jclass->methods_count + 1, sizeof(DeclaredMember));
+    if (dependencies->referenced_classes == NULL || dependencies->referenced_members == NULL
+            || dependencies->literals == NULL || dependencies->declared_members == NULL) {
+        free_dependencies(dependencies);
+        return NULL;
+    }
+
+    dependencies->shape_hash = hash_class_shape(jclass);
+
+    for (size_t cp_index = 1;cp_index <= cp_size;cp_index++) {
+        const CPEntry* cp_entry = &jclass->const_pool->entries[cp_index - 1];
+
+        if (cp_entry->tag == CPClass) {
+            const char* referenced_class_name = jclass_cp_class_name(jclass, cp_index);
+            StrHandle referenced_class = referenced_class_name != NULL
+                    ? intern_referenced_class(dependency_index, referenced_class_name) : 0;
+
+            if (referenced_class != 0 && referenced_class != class_name) {
+                dependencies->referenced_classes[dependencies->referenced_classes_count++] = referenced_class;
+            }
+        } else if (cp_entry->tag == CPFieldRef || cp_entry->tag == CPMethodRef || cp_entry->tag == CPInterfaceMethodRef) {
+            StrHandle referenced_member = intern_referenced_member(dependency_index, jclass, cp_entry->value);
+            if (referenced_member != 0) {
+                dependencies->referenced_members[dependencies->referenced_members_count++] = referenced_member;
+            }
+        } else if (cp_entry->tag == CPInteger || cp_entry->tag == CPFloat || cp_entry->tag == CPLong
+                || cp_entry->tag == CPDouble || cp_entry->tag == CPString) {
+            StrHandle literal = intern_literal(dependency_index, jclass, cp_index);
+            if (literal != 0) {
+                dependencies->literals[dependencies->literals_count++] = literal;
+            }
+        }
+    }
+
+    dependencies->referenced_classes_count = unique_handles(dependencies->referenced_classes,
+            dependencies->referenced_classes_count);
+    dependencies->referenced_members_count = unique_handles(dependencies->referenced_members,
+            dependencies->referenced_members_count);
+    dependencies->literals_count = unique_handles(dependencies->literals, dependencies->literals_count);
+
+    for (uint16_t field_idx = 0;field_idx < jclass->fields_count;field_idx++) {
+        DeclaredMember* declared_member = &dependencies->declared_members[dependencies->declared_members_count];
+        if (declare_member(dependency_index, jclass, &jclass->fields[field_idx], true, declared_member)) {
+            dependencies->declared_members_count += 1;
+        }
+    }
+
+    for (uint16_t method_idx = 0;method_idx < jclass->methods_count;method_idx++) {
+        DeclaredMember* declared_member = &dependencies->declared_members[dependencies->declared_members_count];
+        if (declare_member(dependency_index, jclass, &jclass->methods[method_idx], false, declared_member)) {
+            dependencies->declared_members_count += 1;
+        }
+    }
+
+    return dependencies;
+}
+
+static bool add_dependent(SymbolMap* dependents, StrHandle target, StrHandle class_name) {
+    HandleList* handle_list = symbol_map_get(dependents, target);
+    if (handle_list == NULL) {
+        handle_list = calloc(1, sizeof(HandleList));
+        if (handle_list == NULL) {
+            return false;
+        }
+
+        if (!symbol_map_put(dependents, target, handle_list, NULL)) {
+            free(handle_list);
+            return false;
+        }
+    }
+
+    if (handle_list->count == handle_list->capacity) {
+        uint32_t new_capacity = handle_list->capacity > 0 ? handle_list->capacity * 2 : 4;
+        StrHandle* new_items = realloc(handle_list->items, new_capacity * sizeof(StrHandle));
+        if (new_items == NULL) {
+            return false;
+        }
+
+        handle_list->items = new_items;
+        handle_list->capacity = new_capacity;
+    }
+
+    handle_list->items[handle_list->count++] = class_name;
+
+    return true;
+}
+
+// order of dependents doesn't matter, so the last one takes place of the removed one
+static void remove_dependent(SymbolMap* dependents, StrHandle target, StrHandle class_name) {
+    HandleList* handle_list = symbol_map_get(dependents, target);
+    if (handle_list == NULL) {
+        return;
+    }
+
+    for (uint32_t item_idx = 0;item_idx < handle_list->count;item_idx++) {
+        if (handle_list->items[item_idx] == class_name) {
+            handle_list->items[item_idx] = handle_list->items[--handle_list->count];
+            return;
+        }
+    }
+}
+
+static void link_dependencies(DependencyIndex* dependency_index, StrHandle class_name,
+        const ClassDependencies* dependencies, bool link) {
+    for (uint32_t ref_idx = 0;ref_idx < dependencies->referenced_classes_count;ref_idx++) {
+        if (link) {
+            add_dependent(dependency_index->class_dependents, dependencies->referenced_classes[ref_idx], class_name);
+        } else {
+            remove_dependent(dependency_index->class_dependents, dependencies->referenced_classes[ref_idx], class_name);
+        }
+    }
+
+    for (uint32_t ref_idx = 0;ref_idx < dependencies->referenced_members_count;ref_idx++) {
+        if (link) {
+            add_dependent(dependency_index->member_dependents, dependencies->referenced_members[ref_idx], class_name);
+        } else {
+            remove_dependent(dependency_index->member_dependents, dependencies->referenced_members[ref_idx], class_name);
+        }
+    }
+
+    for (uint32_t literal_idx = 0;literal_idx < dependencies->literals_count;literal_idx++) {
+        if (link) {
+            add_dependent(dependency_index->literal_dependents, dependencies->literals[literal_idx], class_name);
+        } else {
+            remove_dependent(dependency_index->literal_dependents, dependencies->literals[literal_idx], class_name);
+        }
+    }
+}
+
+// new version of a class replaces references of the previous one
+static bool install_dependencies(DependencyIndex* dependency_index, StrHandle class_name, ClassDependencies* dependencies) {
+    void* previous_value = NULL;
+    if (!symbol_map_put(dependency_index->classes, class_name, dependencies, &previous_value)) {
+        free_dependencies(dependencies);
+        return false;
+    }
+
+    ClassDependencies* previous_dependencies = previous_value;
+    if (previous_dependencies != NULL) {
+        link_dependencies(dependency_index, class_name, previous_dependencies, false);
+        free_dependencies(previous_dependencies);
+    } else {
+        dependency_index->classes_count += 1;
+    }
+
+    link_dependencies(dependency_index, class_name, dependencies, true);
+
+    return true;
+}
+
+DependencyIndex* dependency_index_new(StrArena* class_names) {
+    DependencyIndex* dependency_index = calloc(1, sizeof(DependencyIndex));
+    if (dependency_index == NULL) {
+        return NULL;
+    }
+
+    dependency_index->class_names = class_names;
+    dependency_index->member_names = str_arena_new();
+    dependency_index->literals = str_arena_new();
+    dependency_index->classes = symbol_map_new();
+    dependency_index->class_dependents = symbol_map_new();
+    dependency_index->member_dependents = symbol_map_new();
+    dependency_index->literal_dependents = symbol_map_new();
+
+    if (dependency_index->member_names == NULL || dependency_index->literals == NULL || dependency_index->classes == NULL
+            || dependency_index->class_dependents == NULL || dependency_index->member_dependents == NULL
+            || dependency_index->literal_dependents == NULL) {
+        dependency_index_free(dependency_index);
+        return NULL;
+    }
+
+    return dependency_index;
+}
+
+// class is indexed with references of its constant pool, re-adding class replaces them
+bool dependency_index_add(DependencyIndex* dependency_index, const JClass* jclass) {
+    if (jclass->name == NULL) {
+        return false;
+    }
+
+    StrHandle class_name = str_arena_intern(dependency_index->class_names, jclass->name, strnlen(jclass->name, PATH_MAX));
+    if (class_name == 0) {
+        return false;
+    }
+
+    ClassDependencies* dependencies = build_dependencies(dependency_index, jclass, class_name);
+    if (dependencies == NULL) {
+        return false;
+    }
+
+    return install_dependencies(dependency_index, class_name, dependencies);
+}
+
+static bool is_batch_class(const DependentSet* dependent_set, StrHandle class_name) {
+    for (size_t class_idx = 0;class_idx < dependent_set->batch_classes_count;class_idx++) {
+        if (dependent_set->batch_classes[class_idx] == class_name) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// classes of the batch get recompiled bytes anyway, dependent found for several reasons is reported once
+static void add_dependents(DependentSet* dependent_set, SymbolMap* dependents, StrHandle target, DependentReason reason) {
+    const HandleList* handle_list = symbol_map_get(dependents, target);
+    if (handle_list == NULL) {
+        return;
+    }
+
+    for (uint32_t item_idx = 0;item_idx < handle_list->count;item_idx++) {
+        StrHandle class_name = handle_list->items[item_idx];
+        if (is_batch_class(dependent_set, class_name)) {
+            continue;
+        }
+
+        bool duplicate = false;
+        for (size_t dependent_idx = 0;dependent_idx < dependent_set->dependents_count && !duplicate;dependent_idx++) {
+            duplicate = dependent_set->dependents[dependent_idx].class_name == class_name;
+        }
+
+        if (duplicate) {
+            continue;
+        }
+
+        if (dependent_set->dependents_count == dependent_set->dependents_capacity) {
+            size_t new_capacity = dependent_set->dependents_capacity > 0 ? dependent_set->dependents_capacity * 2 : 16;
+            Dependent* new_dependents = realloc(dependent_set->dependents, new_capacity * sizeof(Dependent));
+            if (new_dependents == NULL) {
+                return;
+            }
+
+            dependent_set->dependents = new_dependents;
+            dependent_set->dependents_capacity = new_capacity;
+        }
+
+        Dependent* dependent = &dependent_set->dependents[dependent_set->dependents_count++];
+        dependent->class_name = class_name;
+        dependent->reason = reason;
+        dependent->cause = target;
+    }
+}
+
+static const DeclaredMember* find_declared_member(const ClassDependencies* dependencies, StrHandle member_name) {
+    for (uint32_t member_idx = 0;member_idx < dependencies->declared_members_count;member_idx++) {
+        if (dependencies->declared_members[member_idx].member_name == member_name) {
+            return &dependencies->declared_members[member_idx];
+        }
+    }
+
+    return NULL;
+}
+
+// comparing indexed version of a class with the new one, dependents are looked up for what changed only
+static void collect_dependents(DependencyIndex* dependency_index, DependentSet* dependent_set, StrHandle class_name,
+        const ClassDependencies* previous_dependencies, const ClassDependencies* dependencies) {
+    if (previous_dependencies->shape_hash != dependencies->shape_hash) {
+        add_dependents(dependent_set, dependency_index->class_dependents, class_name, DependentOfShape);
+    }
+
+    for (uint32_t member_idx = 0;member_idx < previous_dependencies->declared_members_count;member_idx++) {
+        const DeclaredMember* previous_member = &previous_dependencies->declared_members[member_idx];
+        const DeclaredMember* member = find_declared_member(dependencies, previous_member->member_name);
+
+        if (member == NULL || ((previous_member->access_flags ^ member->access_flags) & MEMBER_LINKAGE_FLAGS) != 0) {
+            add_dependents(dependent_set, dependency_index->member_dependents, previous_member->member_name,
+                    DependentOfMember);
+        } else if (previous_member->constant_literal != 0 && previous_member->constant_literal != member->constant_literal) {
+            // javac inlines constants, classes using nothing else of the owner are found by the literal they copied
+            // to their constant pool, so any class holding the same literal is reported; constants which fit
+            // iconst, bipush or sipush operands never reach constant pool, classes inlining them can't be found
+            char member_name[MEMBER_NAME_MAX_LENGTH];
+            str_arena_copy(dependency_index->member_names, previous_member->member_name, member_name, sizeof(member_name));
+            log_debug("constant %s changed - classes which inlined it as instruction operand can't be found", member_name);
+
+            size_t dependents_count = dependent_set->dependents_count;
+            add_dependents(dependent_set, dependency_index->class_dependents, class_name, DependentOfConstant);
+            add_dependents(dependent_set, dependency_index->literal_dependents, previous_member->constant_literal,
+                    DependentOfConstant);
+
+            for (size_t dependent_idx = dependents_count;dependent_idx < dependent_set->dependents_count;dependent_idx++) {
+                dependent_set->dependents[dependent_idx].cause = previous_member->member_name;
+            }
+        }
+    }
+}
+
+static const char* dependent_reason_name(DependentReason reason) {
+    switch (reason) {
+        case DependentOfShape: return "class shape changed";
+        case DependentOfMember: return "member removed or changed";
+        case DependentOfConstant: return "constant changed";
+    }
+
+    return "unknown";
+}
+
+// report shows dependents of the latest batch, it is written aside and renamed, so readers never see it half written
+static void write_report(DependencyIndex* dependency_index, const char* report_file_path, const DependentSet* dependent_set) {
+    size_t tmp_file_path_size = strlen(report_file_path) + 5;
+    char tmp_file_path[tmp_file_path_size];
+    snprintf(tmp_file_path, tmp_file_path_size, "%s.tmp", report_file_path);
+
+    FILE* file = fopen(tmp_file_path, "w");
+    if (file == NULL) {
+        log_debug("failed to write dependents report: %s", report_file_path);
+        return;
+    }
+
+    fprintf(file, "# batch of %zu classes, %zu dependents need recompiled bytes\n", dependent_set->batch_classes_count,
+            dependent_set->dependents_count);
+
+    for (size_t dependent_idx = 0;dependent_idx < dependent_set->dependents_count;dependent_idx++) {
+        const Dependent* dependent = &dependent_set->dependents[dependent_idx];
+
+        char class_name[PATH_MAX];
+        str_arena_copy(dependency_index->class_names, dependent->class_name, class_name, sizeof(class_name));
+
+        char cause_name[MEMBER_NAME_MAX_LENGTH];
+        StrArena* cause_names = dependent->reason == DependentOfShape
+                ? dependency_index->class_names : dependency_index->member_names;
+        str_arena_copy(cause_names, dependent->cause, cause_name, sizeof(cause_name));
+
+        fprintf(file, "%s\t%s\t%s\n", class_name, dependent_reason_name(dependent->reason), cause_name);
+    }
+
+    if (fclose(file) != 0 || rename(tmp_file_path, report_file_path) != 0) {
+        log_debug("failed to write dependents report: %s", report_file_path);
+    }
+}
+
+// called before classes of the batch are redefined, indexed classes referencing what the batch changed or removed
+// are reported, then new versions of batch classes replace indexed ones; dependents of dependents aren't followed,
+// since bytes of a dependent only change once it is recompiled
+size_t dependency_index_prepare_batch(DependencyIndex* dependency_index, const JClass* const* classes,
+        size_t classes_count, const char* report_file_path) {
+    StrHandle class_names[classes_count];
+    ClassDependencies* class_dependencies[classes_count];
+
+    for (size_t class_idx = 0;class_idx < classes_count;class_idx++) {
+        const JClass* jclass = classes[class_idx];
+
+        class_names[class_idx] = jclass->name != NULL
+                ? str_arena_intern(dependency_index->class_names, jclass->name, strnlen(jclass->name, PATH_MAX)) : 0;
+        class_dependencies[class_idx] = class_names[class_idx] != 0
+                ? build_dependencies(dependency_index, jclass, class_names[class_idx]) : NULL;
+    }
+
+    DependentSet dependent_set = { .batch_classes = class_names, .batch_classes_count = classes_count };
+
+    for (size_t class_idx = 0;class_idx < classes_count;class_idx++) {
+        if (class_dependencies[class_idx] == NULL) {
+            continue;
+        }
+
+        const ClassDependencies* previous_dependencies = symbol_map_get(dependency_index->classes, class_names[class_idx]);
+        if (previous_dependencies == NULL) {
+            log_debug("class %s wasn't indexed, its dependents are unknown", classes[class_idx]->name);
+            continue;
+        }
+
+        collect_dependents(dependency_index, &dependent_set, class_names[class_idx], previous_dependencies,
+                class_dependencies[class_idx]);
+    }
+
+    for (size_t dependent_idx = 0;dependent_idx < dependent_set.dependents_count;dependent_idx++) {
+        char class_name[PATH_MAX];
+        str_arena_copy(dependency_index->class_names, dependent_set.dependents[dependent_idx].class_name, class_name,
+                sizeof(class_name));
+
+        log_debug("class %s needs recompiled bytes - %s", class_name,
+                dependent_reason_name(dependent_set.dependents[dependent_idx].reason));
+    }
+
+    if (report_file_path != NULL) {
+        write_report(dependency_index, report_file_path, &dependent_set);
+    }
+
+    for (size_t class_idx = 0;class_idx < classes_count;class_idx++) {
+        if (class_dependencies[class_idx] != NULL
+                && !install_dependencies(dependency_index, class_names[class_idx], class_dependencies[class_idx])) {
+            log_debug("failed to index class: %s", classes[class_idx]->name);
+        }
+    }
+
+    size_t dependents_count = dependent_set.dependents_count;
+
+    free(dependent_set.dependents);
+
+    return dependents_count;
+}
+
+size_t dependency_index_count(DependencyIndex* dependency_index) {
+    return dependency_index->classes_count;
+}
+
+static void free_class_dependencies(StrHandle class_name, void* dependencies, void* arg) {
+    free_dependencies(dependencies);
+}
+
+static void free_handle_list(StrHandle target, void* handle_list, void* arg) {
+    free(((HandleList*)handle_list)->items);
+    free(handle_list);
+}
+
+void dependency_index_free(DependencyIndex* dependency_index) {
+    if (dependency_index->classes != NULL) {
+        symbol_map_for_each(dependency_index->classes, free_class_dependencies, NULL);
+        symbol_map_free(dependency_index->classes);
+    }
+
+    if (dependency_index->class_dependents != NULL) {
+        symbol_map_for_each(dependency_index->class_dependents, free_handle_list, NULL);
+        symbol_map_free(dependency_index->class_dependents);
+    }
+
+    if (dependency_index->member_dependents != NULL) {
+        symbol_map_for_each(dependency_index->member_dependents, free_handle_list, NULL);
+        symbol_map_free(dependency_index->member_dependents);
+    }
+
+    if (dependency_index->literal_dependents != NULL) {
+        symbol_map_for_each(dependency_index->literal_dependents, free_handle_list, NULL);
+        symbol_map_free(dependency_index->literal_dependents);
+    }
+
+    if (dependency_index->member_names != NULL) {
+        str_arena_free(dependency_index->member_names);
+    }
+
+    if (dependency_index->literals != NULL) {
+        str_arena_free(dependency_index->literals);
+    }
+
+    free(dependency_index);
+}
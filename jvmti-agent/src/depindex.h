@@ -0,0 +1,66 @@
+#ifndef _DEPINDEX_H_
+#define _DEPINDEX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "strarena.h"
+#include "classload.h"
+
+// member names are kept as "com/acme/Service.get:()I"
+#define MEMBER_NAME_MAX_LENGTH 1024
+
+// handles of classes referencing the same class or member
+typedef struct {
+    StrHandle* items;
+    uint32_t count;
+    uint32_t capacity;
+} HandleList;
+
+typedef struct {
+    StrHandle member_name;
+    uint16_t access_flags;
+    // literal of 'ConstantValue' of static final field, 0 if there is none
+    StrHandle constant_literal;
+} DeclaredMember;
+
+// what indexed version of a class references and declares
+typedef struct {
+    // access flags, super class and interfaces
+    uint64_t shape_hash;
+    StrHandle* referenced_classes;
+    uint32_t referenced_classes_count;
+    StrHandle* referenced_members;
+    uint32_t referenced_members_count;
+    DeclaredMember* declared_members;
+    uint32_t declared_members_count;
+    // integer, float, long, double and string constant pool entries, inlined constants end up there
+    StrHandle* literals;
+    uint32_t literals_count;
+} ClassDependencies;
+
+// reverse index of constant pool references, accessed by 'redefine class' thread only
+typedef struct {
+    // shared with class index, so dependents are kept by class name handle
+    StrArena* class_names;
+    StrArena* member_names;
+    StrArena* literals;
+    SymbolMap* classes;
+    SymbolMap* class_dependents;
+    SymbolMap* member_dependents;
+    SymbolMap* literal_dependents;
+    size_t classes_count;
+} DependencyIndex;
+
+DependencyIndex* dependency_index_new(StrArena* class_names);
+
+bool dependency_index_add(DependencyIndex* dependency_index, const JClass* jclass);
+
+size_t dependency_index_prepare_batch(DependencyIndex* dependency_index, const JClass* const* classes,
+        size_t classes_count, const char* report_file_path);
+
+size_t dependency_index_count(DependencyIndex* dependency_index);
+
+void dependency_index_free(DependencyIndex* dependency_index);
+
+#endif
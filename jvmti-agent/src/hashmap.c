@@ -65,14 +65,14 @@ void* hash_map_get(const HashMap* hash_map, const char* key) {
             size_t key_length = strlen(key);
             
             HashMapEntry* head_entry = bucket->entries;
-            if (strncmp(key, head_entry->key, key_length) == 0) {
+            if (strncmp(key, head_entry->key, key_length + 1) == 0) {
                 result = head_entry->value;
             } else {
                 HashMapEntry* current_entry = head_entry;
                 while (current_entry->next_entry != NULL) {
                     current_entry = current_entry->next_entry;
 
-                    if (strncmp(key, current_entry->key, key_length) == 0) {
+                    if (strncmp(key, current_entry->key, key_length + 1) == 0) {
                         result = current_entry->value;
                         break;
                     }
@@ -183,7 +183,7 @@ bool hash_map_put(HashMap* hash_map, const char* key, void* value) {
             memset(new_head_entry, 0, sizeof(HashMapEntry));
             bool set_key_success = hash_map_entry_set_key(new_head_entry, key, key_length);
             if (!set_key_success) {
-                return put_success = false;
+                put_success = false;
                 break;
             }
             
@@ -194,21 +194,27 @@ bool hash_map_put(HashMap* hash_map, const char* key, void* value) {
             hash_map->size += 1;
 
             break; // bucket head entry added
-        } else if (strncmp(key, head_entry->key, key_length) == 0) {
+        } else if (strncmp(key, head_entry->key, key_length + 1) == 0) {
             head_entry->value = value;
 
             break; // bucket head entry updated
         } else {
             HashMapEntry* current_entry = head_entry;
+            bool entry_updated = false;
             while (current_entry->next_entry != NULL) {
                 current_entry = current_entry->next_entry;
 
-                if (strncmp(key, current_entry->key, key_length) == 0) {
+                if (strncmp(key, current_entry->key, key_length + 1) == 0) {
                     current_entry->value = value;
-                    break; // bucket entry updated
+                    entry_updated = true;
+                    break;
                 }
             }
 
+            if (entry_updated) {
+                break; // bucket entry updated
+            }
+
             if (hash_map->size == hash_map->reallocation_limit) {
                 bool reallocation_success = hash_map_reallocate_and_put(hash_map, hash_map->capacity * 2, key, value);
                 if (!reallocation_success) {
@@ -248,6 +254,55 @@ bool hash_map_put(HashMap* hash_map, const char* key, void* value) {
     return put_success;
 }
 
+void* hash_map_remove(HashMap* hash_map, const char* key) {
+    pthread_mutex_lock(hash_map->mutex);
+
+    void* result = NULL;
+
+    if (hash_map->size > 0) {
+        uint32_t hash = hash_map->hash_fn(key, hash_map->capacity);
+
+        HashMapBucket* bucket = ((HashMapBucket*)hash_map->buckets) + hash;
+
+        size_t key_length = strlen(key);
+
+        HashMapEntry** entry_ref = &bucket->entries;
+        while (*entry_ref != NULL) {
+            HashMapEntry* current_entry = *entry_ref;
+
+            if (strncmp(key, current_entry->key, key_length + 1) == 0) {
+                *entry_ref = current_entry->next_entry;
+
+                result = current_entry->value;
+                hash_map_entry_free(current_entry);
+
+                hash_map->size -= 1;
+                break;
+            }
+
+            entry_ref = &current_entry->next_entry;
+        }
+    }
+
+    pthread_mutex_unlock(hash_map->mutex);
+
+    return result;
+}
+
+void hash_map_for_each(const HashMap* hash_map, HashMapEntryFn* entry_fn, void* arg) {
+    pthread_mutex_lock(hash_map->mutex);
+
+    for (size_t bucket_index = 0;bucket_index < hash_map->capacity;bucket_index++) {
+        HashMapBucket* current_bucket = ((HashMapBucket*)hash_map->buckets) + bucket_index;
+
+        for (HashMapEntry* current_entry = current_bucket->entries;current_entry != NULL;current_entry = current_entry->next_entry) {
+            entry_fn(current_entry->key, current_entry->value, arg);
+        }
+    }
+
+    pthread_mutex_unlock(hash_map->mutex);
+}
+
 void hash_map_free(HashMap* hash_map) {
     for (size_t bucket_index = 0;bucket_index < hash_map->capacity;bucket_index++) {
         HashMapBucket* current_bucket = ((HashMapBucket*)hash_map->buckets) + bucket_index;
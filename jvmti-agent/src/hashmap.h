@@ -5,6 +5,8 @@
 
 typedef uint32_t HashFn(const char* key, size_t capacity);
 
+typedef void HashMapEntryFn(const char* key, void* value, void* arg);
+
 typedef struct {
     size_t capacity;
     size_t size;
@@ -20,6 +22,10 @@ void* hash_map_get(const HashMap* hash_map, const char* key);
 
 bool hash_map_put(HashMap* hash_map, const char* key, void* value);
 
+void* hash_map_remove(HashMap* hash_map, const char* key);
+
+void hash_map_for_each(const HashMap* hash_map, HashMapEntryFn* entry_fn, void* arg);
+
 void hash_map_free(HashMap* hash_map);
 
 #endif
@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "agent.h"
+#include "strarena.h"
+#include "heaphisto.h"
+
+// class tag holds snapshot generation in the upper half and class ordinal in the lower half,
+// so classes tagged by previous snapshots and not tagged again are counted as untagged
+#define ORDINAL_BITS 32
+#define ORDINAL_MASK 0xFFFFFFFFLL
+
+#define CLASS_NAME_MAX_LENGTH 1024
+
+static const char* const UNTAGGED_CLASS_NAME = "[unindexed classes]";
+
+typedef struct {
+    jvmtiEnv* jvmti;
+    jlong generation;
+    StrHandle* ordinal_names;
+    size_t ordinals_count;
+    size_t ordinals_capacity;
+    bool tagging_failed;
+} ClassTagging;
+
+// flat counters indexed by class ordinal, allocated before heap iteration
+typedef struct {
+    jlong generation;
+    size_t ordinals_count;
+    jlong* instances;
+    jlong* bytes;
+} HeapPass;
+
+static bool tag_class(ClassTagging* tagging, jclass klass, StrHandle class_name) {
+    if (tagging->ordinals_count == tagging->ordinals_capacity) {
+        size_t new_capacity = tagging->ordinals_capacity == 0 ? 1024 : tagging->ordinals_capacity * 2;
+        StrHandle* new_ordinal_names = realloc(tagging->ordinal_names, new_capacity * sizeof(StrHandle));
+        if (new_ordinal_names == NULL) {
+            tagging->tagging_failed = true;
+            return false;
+        }
+
+        tagging->ordinal_names = new_ordinal_names;
+        tagging->ordinals_capacity = new_capacity;
+    }
+
+    // ordinal 0 is reserved for untagged classes
+    jlong ordinal = tagging->ordinals_count + 1;
+    jlong tag = (tagging->generation << ORDINAL_BITS) | ordinal;
+    if ((*tagging->jvmti)->SetTag(tagging->jvmti, klass, tag) != JVMTI_ERROR_NONE) {
+        return false;
+    }
+
+    tagging->ordinal_names[tagging->ordinals_count++] = class_name;
+
+    return true;
+}
+
+static void tag_indexed_class(StrHandle class_name, void* class_ref, void* arg) {
+    tag_class(arg, class_ref, class_name);
+}
+
+// class index holds instance classes only, array classes are tagged from loaded classes,
+// their signatures are interned along with class names
+static bool tag_array_classes(HeapHistogram* heap_histogram, JNIEnv* jni, ClassTagging* tagging) {
+    jvmtiEnv* jvmti = heap_histogram->jvmti;
+
+    jint classes_count = 0;
+    jclass* classes = NULL;
+    if ((*jvmti)->GetLoadedClasses(jvmti, &classes_count, &classes) != JVMTI_ERROR_NONE) {
+        return false;
+    }
+
+    for (jint class_idx = 0;class_idx < classes_count;class_idx++) {
+        jint class_status = 0;
+        if ((*jvmti)->GetClassStatus(jvmti, classes[class_idx], &class_status) == JVMTI_ERROR_NONE
+                && (class_status & JVMTI_CLASS_STATUS_ARRAY) != 0) {
+            char* class_signature = NULL;
+            if ((*jvmti)->GetClassSignature(jvmti, classes[class_idx], &class_signature, NULL) == JVMTI_ERROR_NONE) {
+                StrHandle class_name = str_arena_intern(heap_histogram->class_names, class_signature, strlen(class_signature));
+                if (class_name != 0) {
+                    tag_class(tagging, classes[class_idx], class_name);
+                }
+
+                (*jvmti)->Deallocate(jvmti, (unsigned char*)class_signature);
+            }
+        }
+
+        (*jni)->DeleteLocalRef(jni, classes[class_idx]);
+    }
+
+    (*jvmti)->Deallocate(jvmti, (unsigned char*)classes);
+
+    return true;
+}
+
+// called for every object, no allocations and no jvmti calls here
+static jint JNICALL count_object(jlong class_tag, jlong size, jlong* tag_ptr, jint length, void* user_data) {
+    HeapPass* heap_pass = user_data;
+
+    size_t ordinal = 0;
+    if ((class_tag >> ORDINAL_BITS) == heap_pass->generation) {
+        ordinal = class_tag & ORDINAL_MASK;
+        if (ordinal > heap_pass->ordinals_count) {
+            ordinal = 0;
+        }
+    }
+
+    heap_pass->instances[ordinal] += 1;
+    heap_pass->bytes[ordinal] += size;
+
+    return JVMTI_VISIT_OBJECTS;
+}
+
+static void snapshot_free(HeapHistogramSnapshot* snapshot) {
+    if (snapshot != NULL) {
+        free(snapshot->entries);
+        free(snapshot);
+    }
+}
+
+// tagging classes with fresh ordinals, then counting instances in a single pass over the heap
+static HeapHistogramSnapshot* take_snapshot(HeapHistogram* heap_histogram, JNIEnv* jni) {
+    jvmtiEnv* jvmti = heap_histogram->jvmti;
+
+    heap_histogram->generation += 1;
+
+    ClassTagging tagging = { jvmti, heap_histogram->generation, NULL, 0, 0, false };
+    symbol_map_for_each(heap_histogram->classes, tag_indexed_class, &tagging);
+
+    if (!tag_array_classes(heap_histogram, jni, &tagging) || tagging.tagging_failed) {
+        log_debug("failed to tag classes for heap histogram");
+        free(tagging.ordinal_names);
+        return NULL;
+    }
+
+    HeapPass heap_pass = { tagging.generation, tagging.ordinals_count, NULL, NULL };
+    heap_pass.instances = calloc(tagging.ordinals_count + 1, sizeof(jlong));
+    heap_pass.bytes = calloc(tagging.ordinals_count + 1, sizeof(jlong));
+
+    HeapHistogramSnapshot* snapshot = calloc(1, sizeof(HeapHistogramSnapshot));
+    if (heap_pass.instances == NULL || heap_pass.bytes == NULL || snapshot == NULL) {
+        free(heap_pass.instances);
+        free(heap_pass.bytes);
+        free(tagging.ordinal_names);
+        free(snapshot);
+        return NULL;
+    }
+
+    jvmtiHeapCallbacks heap_callbacks;
+    memset(&heap_callbacks, 0, sizeof(heap_callbacks));
+    heap_callbacks.heap_iteration_callback = count_object;
+
+    jvmtiError error = (*jvmti)->IterateThroughHeap(jvmti, 0, NULL, &heap_callbacks, &heap_pass);
+    if (error != JVMTI_ERROR_NONE) {
+        log_debug("failed to iterate through heap - error: %d", error);
+    } else {
+        snapshot->entries = calloc(tagging.ordinals_count + 1, sizeof(HeapHistogramEntry));
+    }
+
+    if (snapshot->entries != NULL) {
+        for (size_t ordinal = 0;ordinal <= tagging.ordinals_count;ordinal++) {
+            if (heap_pass.instances[ordinal] == 0) {
+                continue;
+            }
+
+            HeapHistogramEntry* entry = &snapshot->entries[snapshot->entries_count++];
+            entry->class_name = ordinal == 0 ? 0 : tagging.ordinal_names[ordinal - 1];
+            entry->instances = heap_pass.instances[ordinal];
+            entry->bytes = heap_pass.bytes[ordinal];
+        }
+    }
+
+    free(heap_pass.instances);
+    free(heap_pass.bytes);
+    free(tagging.ordinal_names);
+
+    if (snapshot->entries == NULL) {
+        free(snapshot);
+        return NULL;
+    }
+
+    return snapshot;
+}
+
+static int compare_entries_by_bytes(const void* first, const void* second) {
+    const HeapHistogramEntry* first_entry = first;
+    const HeapHistogramEntry* second_entry = second;
+
+    jlong first_bytes = first_entry->bytes < 0 ? -first_entry->bytes : first_entry->bytes;
+    jlong second_bytes = second_entry->bytes < 0 ? -second_entry->bytes : second_entry->bytes;
+
+    return first_bytes < second_bytes ? 1 : first_bytes > second_bytes ? -1 : 0;
+}
+
+static void write_entries(HeapHistogram* heap_histogram, FILE* file, HeapHistogramEntry* entries, size_t entries_count) {
+    qsort(entries, entries_count, sizeof(HeapHistogramEntry), compare_entries_by_bytes);
+
+    char class_name[CLASS_NAME_MAX_LENGTH];
+    for (size_t entry_idx = 0;entry_idx < entries_count;entry_idx++) {
+        const HeapHistogramEntry* entry = &entries[entry_idx];
+        if (entry->instances == 0 && entry->bytes == 0) {
+            continue;
+        }
+
+        if (entry->class_name == 0) {
+            snprintf(class_name, sizeof(class_name), "%s", UNTAGGED_CLASS_NAME);
+        } else {
+            str_arena_copy(heap_histogram->class_names, entry->class_name, class_name, sizeof(class_name));
+        }
+
+        fprintf(file, "%lld\t%lld\t%s\n", (long long)entry->instances, (long long)entry->bytes, class_name);
+    }
+}
+
+// histogram lines are "<instances>\t<bytes>\t<class>", sorted by bytes
+static bool write_histogram(HeapHistogram* heap_histogram, const HeapHistogramSnapshot* snapshot, const char* file_path) {
+    FILE* file = fopen(file_path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    write_entries(heap_histogram, file, snapshot->entries, snapshot->entries_count);
+
+    return fclose(file) == 0;
+}
+
+// diff lines hold instances and bytes deltas, sorted by absolute bytes delta,
+// entries are matched by interned class name, so snapshot ordinals don't matter
+static bool write_diff(HeapHistogram* heap_histogram, const HeapHistogramSnapshot* before,
+        const HeapHistogramSnapshot* after, const char* file_path) {
+    size_t diff_capacity = before->entries_count + after->entries_count;
+    HeapHistogramEntry* diff_entries = calloc(diff_capacity + 1, sizeof(HeapHistogramEntry));
+
+    StrHandle max_class_name = 0;
+    for (size_t entry_idx = 0;entry_idx < after->entries_count;entry_idx++) {
+        if (after->entries[entry_idx].class_name > max_class_name) {
+            max_class_name = after->entries[entry_idx].class_name;
+        }
+    }
+
+    for (size_t entry_idx = 0;entry_idx < before->entries_count;entry_idx++) {
+        if (before->entries[entry_idx].class_name > max_class_name) {
+            max_class_name = before->entries[entry_idx].class_name;
+        }
+    }
+
+    // diff entry position by class name handle, handles are dense
+    size_t* diff_positions = calloc((size_t)max_class_name + 1, sizeof(size_t));
+
+    FILE* file = diff_entries != NULL && diff_positions != NULL ? fopen(file_path, "w") : NULL;
+    if (file == NULL) {
+        free(diff_entries);
+        free(diff_positions);
+        return false;
+    }
+
+    size_t diff_entries_count = 0;
+    const HeapHistogramSnapshot* snapshots[] = { before, after };
+    for (size_t snapshot_idx = 0;snapshot_idx < 2;snapshot_idx++) {
+        jlong sign = snapshot_idx == 0 ? -1 : 1;
+
+        for (size_t entry_idx = 0;entry_idx < snapshots[snapshot_idx]->entries_count;entry_idx++) {
+            const HeapHistogramEntry* entry = &snapshots[snapshot_idx]->entries[entry_idx];
+
+            size_t position = diff_positions[entry->class_name];
+            if (position == 0) {
+                position = ++diff_entries_count;
+                diff_positions[entry->class_name] = position;
+                diff_entries[position - 1].class_name = entry->class_name;
+            }
+
+            diff_entries[position - 1].instances += sign * entry->instances;
+            diff_entries[position - 1].bytes += sign * entry->bytes;
+        }
+    }
+
+    write_entries(heap_histogram, file, diff_entries, diff_entries_count);
+
+    free(diff_entries);
+    free(diff_positions);
+
+    return fclose(file) == 0;
+}
+
+HeapHistogram* heap_histogram_new(JavaVM* jvm, StrArena* class_names, SymbolMap* classes) {
+    HeapHistogram* heap_histogram = calloc(1, sizeof(HeapHistogram));
+    if (heap_histogram == NULL) {
+        return NULL;
+    }
+
+    if ((*jvm)->GetEnv(jvm, (void**)&heap_histogram->jvmti, JVMTI_VERSION_1_2) != JNI_OK) {
+        free(heap_histogram);
+        return NULL;
+    }
+
+    jvmtiCapabilities capabilities;
+    memset(&capabilities, 0, sizeof(jvmtiCapabilities));
+    capabilities.can_tag_objects = JNI_TRUE;
+
+    jvmtiError error = (*heap_histogram->jvmti)->AddCapabilities(heap_histogram->jvmti, &capabilities);
+    if (error != JVMTI_ERROR_NONE) {
+        log_debug("failed to add heap histogram capabilities - error: %d", error);
+        (*heap_histogram->jvmti)->DisposeEnvironment(heap_histogram->jvmti);
+        free(heap_histogram);
+        return NULL;
+    }
+
+    heap_histogram->class_names = class_names;
+    heap_histogram->classes = classes;
+
+    pthread_mutex_init(&heap_histogram->mutex, NULL);
+
+    return heap_histogram;
+}
+
+// writing histogram of the heap, and its diff with the baseline when there is one,
+// the snapshot becomes the new baseline
+// diff is written only when there is a baseline to compare with, caller is told whether it was
+bool heap_histogram_dump(HeapHistogram* heap_histogram, JNIEnv* jni, const char* file_path, const char* diff_file_path,
+        bool* diff_written) {
+    *diff_written = false;
+
+    pthread_mutex_lock(&heap_histogram->mutex);
+
+    HeapHistogramSnapshot* snapshot = take_snapshot(heap_histogram, jni);
+
+    bool dump_success = snapshot != NULL && write_histogram(heap_histogram, snapshot, file_path);
+    if (dump_success && heap_histogram->baseline != NULL) {
+        dump_success = write_diff(heap_histogram, heap_histogram->baseline, snapshot, diff_file_path);
+        *diff_written = dump_success;
+    }
+
+    if (snapshot != NULL) {
+        snapshot_free(heap_histogram->baseline);
+        heap_histogram->baseline = snapshot;
+    }
+
+    pthread_mutex_unlock(&heap_histogram->mutex);
+
+    return dump_success;
+}
+
+// taking snapshot next dump is compared with, e.g. right before classes are redefined
+bool heap_histogram_mark_baseline(HeapHistogram* heap_histogram, JNIEnv* jni) {
+    pthread_mutex_lock(&heap_histogram->mutex);
+
+    HeapHistogramSnapshot* snapshot = take_snapshot(heap_histogram, jni);
+    if (snapshot != NULL) {
+        snapshot_free(heap_histogram->baseline);
+        heap_histogram->baseline = snapshot;
+    }
+
+    pthread_mutex_unlock(&heap_histogram->mutex);
+
+    return snapshot != NULL;
+}
+
+void heap_histogram_free(HeapHistogram* heap_histogram) {
+    snapshot_free(heap_histogram->baseline);
+
+    (*heap_histogram->jvmti)->DisposeEnvironment(heap_histogram->jvmti);
+
+    pthread_mutex_destroy(&heap_histogram->mutex);
+
+    free(heap_histogram);
+}
@@ -0,0 +1,44 @@
+#ifndef _HEAPHISTO_H_
+#define _HEAPHISTO_H_
+
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "strarena.h"
+
+typedef struct {
+    // 0 for objects of classes which weren't tagged
+    StrHandle class_name;
+    jlong instances;
+    jlong bytes;
+} HeapHistogramEntry;
+
+typedef struct {
+    size_t entries_count;
+    HeapHistogramEntry* entries;
+} HeapHistogramSnapshot;
+
+typedef struct {
+    // own environment, so class tags don't collide with tags of heap profiler
+    jvmtiEnv* jvmti;
+    StrArena* class_names;
+    SymbolMap* classes;
+    jlong generation;
+    // snapshot the next one is compared with
+    HeapHistogramSnapshot* baseline;
+    pthread_mutex_t mutex;
+} HeapHistogram;
+
+HeapHistogram* heap_histogram_new(JavaVM* jvm, StrArena* class_names, SymbolMap* classes);
+
+bool heap_histogram_dump(HeapHistogram* heap_histogram, JNIEnv* jni, const char* file_path, const char* diff_file_path,
+        bool* diff_written);
+
+bool heap_histogram_mark_baseline(HeapHistogram* heap_histogram, JNIEnv* jni);
+
+void heap_histogram_free(HeapHistogram* heap_histogram);
+
+#endif
@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "agent.h"
+#include "hashmap.h"
+#include "stacktable.h"
+#include "tlbuf.h"
+#include "heapprof.h"
+
+#define HEAP_PROFILER_MAX_FRAMES 32
+
+#define CLASS_NAME_MAX_LENGTH 1024
+
+// per thread buffer capacities, samples are dropped when drain thread falls behind
+#define ALLOC_SAMPLES_CAPACITY 256
+#define FREED_SAMPLES_CAPACITY 1024
+
+// enough for "%llx" formatted sample tag
+#define SAMPLE_KEY_MAX_LENGTH 24
+
+static const long DRAIN_PERIOD_NS = 100000000L;
+
+static const char* const UNKNOWN_CLASS_NAME = "[unknown class]";
+
+typedef struct {
+    jlong tag;
+    jlong weight;
+    jlong class_tag;
+    jint frame_count;
+    jmethodID frames[HEAP_PROFILER_MAX_FRAMES];
+} AllocSample;
+
+typedef struct {
+    jlong tag;
+} FreedSample;
+
+typedef struct {
+    StackSite* site;
+    jlong weight;
+} LiveSample;
+
+typedef struct {
+    jlong* tags;
+    size_t count;
+    size_t capacity;
+} FreedTags;
+
+// class objects are tagged with negative class name index, so they never collide with sample tags
+static jlong heap_profiler_class_tag(HeapProfiler* heap_profiler, jvmtiEnv* jvmti, jclass object_class) {
+    jlong class_tag = 0;
+    if ((*jvmti)->GetTag(jvmti, object_class, &class_tag) != JVMTI_ERROR_NONE || class_tag != 0) {
+        return class_tag;
+    }
+
+    char* class_signature = NULL;
+    if ((*jvmti)->GetClassSignature(jvmti, object_class, &class_signature, NULL) != JVMTI_ERROR_NONE) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&heap_profiler->class_names_mutex);
+
+    if (heap_profiler->class_names_count == heap_profiler->class_names_capacity) {
+        size_t new_capacity = heap_profiler->class_names_capacity * 2;
+        char** new_class_names = realloc(heap_profiler->class_names, new_capacity * sizeof(char*));
+        if (new_class_names != NULL) {
+            heap_profiler->class_names = new_class_names;
+            heap_profiler->class_names_capacity = new_capacity;
+        }
+    }
+
+    if (heap_profiler->class_names_count < heap_profiler->class_names_capacity) {
+        char class_frame_name[CLASS_NAME_MAX_LENGTH];
+        stack_table_class_name(class_signature, class_frame_name, sizeof(class_frame_name));
+
+        char* class_name = strdup(class_frame_name);
+        if (class_name != NULL) {
+            heap_profiler->class_names[heap_profiler->class_names_count++] = class_name;
+            class_tag = -(jlong)heap_profiler->class_names_count;
+        }
+    }
+
+    pthread_mutex_unlock(&heap_profiler->class_names_mutex);
+
+    (*jvmti)->Deallocate(jvmti, (unsigned char*)class_signature);
+
+    if (class_tag != 0) {
+        (*jvmti)->SetTag(jvmti, object_class, class_tag);
+    }
+
+    return class_tag;
+}
+
+static const char* heap_profiler_class_name(HeapProfiler* heap_profiler, jlong class_tag) {
+    const char* class_name = UNKNOWN_CLASS_NAME;
+
+    pthread_mutex_lock(&heap_profiler->class_names_mutex);
+
+    size_t class_name_idx = (size_t)(-class_tag - 1);
+    if (class_tag < 0 && class_name_idx < heap_profiler->class_names_count) {
+        class_name = heap_profiler->class_names[class_name_idx];
+    }
+
+    pthread_mutex_unlock(&heap_profiler->class_names_mutex);
+
+    return class_name;
+}
+
+// called from 'SampledObjectAlloc' event handler on the allocating thread
+void heap_profiler_record_alloc(HeapProfiler* heap_profiler, jvmtiEnv* jvmti, jobject object, jclass object_class, jlong size) {
+    ThreadBuffer* buffer = NULL;
+    AllocSample* sample = thread_buffer_reserve(heap_profiler->alloc_samples, &buffer);
+    if (sample == NULL) {
+        return;
+    }
+
+    jvmtiFrameInfo frames[HEAP_PROFILER_MAX_FRAMES];
+    jint frame_count = 0;
+    if ((*jvmti)->GetStackTrace(jvmti, NULL, 0, HEAP_PROFILER_MAX_FRAMES, frames, &frame_count) != JVMTI_ERROR_NONE) {
+        frame_count = 0;
+    }
+
+    for (jint frame_idx = 0;frame_idx < frame_count;frame_idx++) {
+        sample->frames[frame_idx] = frames[frame_idx].method;
+    }
+
+    sample->frame_count = frame_count;
+    sample->tag = atomic_fetch_add_explicit(&heap_profiler->last_sample_tag, 1, memory_order_relaxed) + 1;
+    sample->class_tag = heap_profiler_class_tag(heap_profiler, jvmti, object_class);
+
+    // each sample stands for sampling interval bytes on average, bigger objects are taken as is
+    sample->weight = size > heap_profiler->sampling_interval ? size : heap_profiler->sampling_interval;
+
+    // tagged object produces 'ObjectFree' event once collected
+    (*jvmti)->SetTag(jvmti, object, sample->tag);
+
+    atomic_fetch_add_explicit(&heap_profiler->sampled_bytes, sample->weight, memory_order_relaxed);
+
+    thread_buffer_commit(buffer);
+}
+
+// called from 'ObjectFree' event handler, only raw memory operations are allowed here
+void heap_profiler_record_free(HeapProfiler* heap_profiler, jlong tag) {
+    if (tag <= 0) {
+        // class object tag
+        return;
+    }
+
+    ThreadBuffer* buffer = NULL;
+    FreedSample* freed_sample = thread_buffer_reserve(heap_profiler->freed_samples, &buffer);
+    if (freed_sample == NULL) {
+        return;
+    }
+
+    freed_sample->tag = tag;
+
+    thread_buffer_commit(buffer);
+}
+
+static void collect_freed_tag(const void* record, void* arg) {
+    FreedTags* freed_tags = arg;
+
+    if (freed_tags->count == freed_tags->capacity) {
+        size_t new_capacity = freed_tags->capacity == 0 ? FREED_SAMPLES_CAPACITY : freed_tags->capacity * 2;
+        jlong* new_tags = realloc(freed_tags->tags, new_capacity * sizeof(jlong));
+        if (new_tags == NULL) {
+            return;
+        }
+
+        freed_tags->tags = new_tags;
+        freed_tags->capacity = new_capacity;
+    }
+
+    freed_tags->tags[freed_tags->count++] = ((const FreedSample*)record)->tag;
+}
+
+static void aggregate_alloc_sample(const void* record, void* arg) {
+    HeapProfiler* heap_profiler = arg;
+    const AllocSample* sample = record;
+
+    const char* class_name = heap_profiler_class_name(heap_profiler, sample->class_tag);
+
+    StackSite* site = stack_table_add(heap_profiler->sites, heap_profiler->jvmti, sample->frames, sample->frame_count,
+            class_name, sample->weight);
+    if (site == NULL) {
+        return;
+    }
+
+    LiveSample* live_sample = malloc(sizeof(LiveSample));
+    if (live_sample == NULL) {
+        return;
+    }
+
+    live_sample->site = site;
+    live_sample->weight = sample->weight;
+
+    char sample_key[SAMPLE_KEY_MAX_LENGTH];
+    snprintf(sample_key, sizeof(sample_key), "%llx", (unsigned long long)sample->tag);
+
+    if (!hash_map_put(heap_profiler->live_samples, sample_key, live_sample)) {
+        free(live_sample);
+        return;
+    }
+
+    pthread_mutex_lock(&heap_profiler->sites->mutex);
+
+    site->live_count += 1;
+    site->live_total += sample->weight;
+
+    pthread_mutex_unlock(&heap_profiler->sites->mutex);
+}
+
+static void release_live_sample(HeapProfiler* heap_profiler, jlong tag) {
+    char sample_key[SAMPLE_KEY_MAX_LENGTH];
+    snprintf(sample_key, sizeof(sample_key), "%llx", (unsigned long long)tag);
+
+    LiveSample* live_sample = hash_map_remove(heap_profiler->live_samples, sample_key);
+    if (live_sample == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&heap_profiler->sites->mutex);
+
+    live_sample->site->live_count -= 1;
+    live_sample->site->live_total -= live_sample->weight;
+
+    pthread_mutex_unlock(&heap_profiler->sites->mutex);
+
+    free(live_sample);
+}
+
+// freed tags are collected before allocation samples are drained, so every collected tag
+// refers to allocation sample which is already aggregated
+static void heap_profiler_drain(HeapProfiler* heap_profiler) {
+    FreedTags freed_tags = { NULL, 0, 0 };
+    thread_buffer_set_drain(heap_profiler->freed_samples, collect_freed_tag, &freed_tags);
+
+    thread_buffer_set_drain(heap_profiler->alloc_samples, aggregate_alloc_sample, heap_profiler);
+
+    for (size_t tag_idx = 0;tag_idx < freed_tags.count;tag_idx++) {
+        release_live_sample(heap_profiler, freed_tags.tags[tag_idx]);
+    }
+
+    free(freed_tags.tags);
+}
+
+static void* heap_profiler_activity(void* arg) {
+    HeapProfiler* heap_profiler = arg;
+
+    JNIEnv* jni = NULL;
+    jint attach_thread_status = (*heap_profiler->jvm)->AttachCurrentThreadAsDaemon(heap_profiler->jvm, (void**)&jni, NULL);
+    if (attach_thread_status != JNI_OK) {
+        log_debug("failed to attach 'heap profiler' thread");
+        return NULL;
+    }
+
+    log_debug("'heap profiler' thread is running");
+
+    const struct timespec drain_period = { 0, DRAIN_PERIOD_NS };
+
+    while (atomic_load(&heap_profiler->draining)) {
+        nanosleep(&drain_period, NULL);
+
+        heap_profiler_drain(heap_profiler);
+    }
+
+    log_debug("'heap profiler' thread stopping...");
+
+    (*heap_profiler->jvm)->DetachCurrentThread(heap_profiler->jvm);
+
+    return NULL;
+}
+
+static void free_live_sample(const char* sample_key, void* live_sample, void* arg) {
+    free(live_sample);
+}
+
+static void heap_profiler_free(HeapProfiler* heap_profiler) {
+    if (heap_profiler->live_samples != NULL) {
+        hash_map_for_each(heap_profiler->live_samples, free_live_sample, NULL);
+        hash_map_free(heap_profiler->live_samples);
+    }
+
+    if (heap_profiler->alloc_samples != NULL) {
+        thread_buffer_set_free(heap_profiler->alloc_samples);
+    }
+
+    if (heap_profiler->freed_samples != NULL) {
+        thread_buffer_set_free(heap_profiler->freed_samples);
+    }
+
+    if (heap_profiler->sites != NULL) {
+        stack_table_free(heap_profiler->sites);
+    }
+
+    for (size_t class_name_idx = 0;class_name_idx < heap_profiler->class_names_count;class_name_idx++) {
+        free(heap_profiler->class_names[class_name_idx]);
+    }
+
+    free(heap_profiler->class_names);
+
+    pthread_mutex_destroy(&heap_profiler->class_names_mutex);
+
+    free(heap_profiler);
+}
+
+HeapProfiler* heap_profiler_start(JavaVM* jvm, jvmtiEnv* jvmti, jint sampling_interval) {
+    if (sampling_interval <= 0) {
+        return NULL;
+    }
+
+    HeapProfiler* heap_profiler = calloc(1, sizeof(HeapProfiler));
+    if (heap_profiler == NULL) {
+        return NULL;
+    }
+
+    heap_profiler->jvm = jvm;
+    heap_profiler->jvmti = jvmti;
+    heap_profiler->sampling_interval = sampling_interval;
+    pthread_mutex_init(&heap_profiler->class_names_mutex, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &heap_profiler->start_time);
+
+    heap_profiler->class_names_capacity = 256;
+    heap_profiler->class_names = malloc(heap_profiler->class_names_capacity * sizeof(char*));
+    heap_profiler->sites = stack_table_new(jvm);
+    heap_profiler->alloc_samples = thread_buffer_set_new(sizeof(AllocSample), ALLOC_SAMPLES_CAPACITY);
+    heap_profiler->freed_samples = thread_buffer_set_new(sizeof(FreedSample), FREED_SAMPLES_CAPACITY);
+    heap_profiler->live_samples = hash_map_new(1024, NULL);
+
+    if (heap_profiler->class_names == NULL || heap_profiler->sites == NULL || heap_profiler->alloc_samples == NULL
+            || heap_profiler->freed_samples == NULL || heap_profiler->live_samples == NULL) {
+        heap_profiler_free(heap_profiler);
+        return NULL;
+    }
+
+    jvmtiError error = (*jvmti)->SetHeapSamplingInterval(jvmti, sampling_interval);
+    if (error != JVMTI_ERROR_NONE) {
+        log_debug("failed to set heap sampling interval - error: %d", error);
+        heap_profiler_free(heap_profiler);
+        return NULL;
+    }
+
+    atomic_store(&heap_profiler->draining, true);
+
+    int thread_create_status = pthread_create(&heap_profiler->drain_thread, NULL, heap_profiler_activity, heap_profiler);
+    if (thread_create_status != 0) {
+        heap_profiler_free(heap_profiler);
+        return NULL;
+    }
+
+    return heap_profiler;
+}
+
+// allocation profile holds estimated allocated bytes per site, live profile holds
+// estimated bytes of sampled objects which are not collected yet
+bool heap_profiler_dump(HeapProfiler* heap_profiler, const char* alloc_file_path, const char* live_file_path) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double elapsed_seconds = (now.tv_sec - heap_profiler->start_time.tv_sec)
+            + (now.tv_nsec - heap_profiler->start_time.tv_nsec) / 1e9;
+    uint64_t sampled_bytes = atomic_load(&heap_profiler->sampled_bytes);
+    if (elapsed_seconds > 0) {
+        log_debug("estimated allocation rate: %.0f bytes/s, samples dropped: %llu", sampled_bytes / elapsed_seconds,
+                (unsigned long long)thread_buffer_set_dropped(heap_profiler->alloc_samples));
+    }
+
+    return stack_table_dump(heap_profiler->sites, alloc_file_path, StackSiteTotal)
+            && stack_table_dump(heap_profiler->sites, live_file_path, StackSiteLiveTotal);
+}
+
+// allocation and free events should be disabled before profiler is stopped
+void heap_profiler_stop(HeapProfiler* heap_profiler) {
+    atomic_store(&heap_profiler->draining, false);
+
+    pthread_join(heap_profiler->drain_thread, NULL);
+
+    heap_profiler_free(heap_profiler);
+}
@@ -0,0 +1,39 @@
+#ifndef _HEAPPROF_H_
+#define _HEAPPROF_H_
+
+#include <jvmti.h>
+
+#include "hashmap.h"
+#include "stacktable.h"
+#include "tlbuf.h"
+
+typedef struct {
+    JavaVM* jvm;
+    jvmtiEnv* jvmti;
+    jint sampling_interval;
+    StackTable* sites;
+    ThreadBufferSet* alloc_samples;
+    ThreadBufferSet* freed_samples;
+    HashMap* live_samples;
+    char** class_names;
+    size_t class_names_count;
+    size_t class_names_capacity;
+    pthread_mutex_t class_names_mutex;
+    atomic_llong last_sample_tag;
+    atomic_uint_fast64_t sampled_bytes;
+    struct timespec start_time;
+    pthread_t drain_thread;
+    atomic_bool draining;
+} HeapProfiler;
+
+HeapProfiler* heap_profiler_start(JavaVM* jvm, jvmtiEnv* jvmti, jint sampling_interval);
+
+void heap_profiler_record_alloc(HeapProfiler* heap_profiler, jvmtiEnv* jvmti, jobject object, jclass object_class, jlong size);
+
+void heap_profiler_record_free(HeapProfiler* heap_profiler, jlong tag);
+
+bool heap_profiler_dump(HeapProfiler* heap_profiler, const char* alloc_file_path, const char* live_file_path);
+
+void heap_profiler_stop(HeapProfiler* heap_profiler);
+
+#endif
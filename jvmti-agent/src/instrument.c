@@ -0,0 +1,719 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "classload.h"
+#include "instrument.h"
+
+#define OPCODE_SIPUSH 0x11
+#define OPCODE_IINC 0x84
+#define OPCODE_IFEQ 0x99
+#define OPCODE_JSR 0xa8
+#define OPCODE_TABLESWITCH 0xaa
+#define OPCODE_LOOKUPSWITCH 0xab
+#define OPCODE_IRETURN 0xac
+#define OPCODE_RETURN 0xb1
+#define OPCODE_INVOKESTATIC 0xb8
+#define OPCODE_WIDE 0xc4
+#define OPCODE_IFNULL 0xc6
+#define OPCODE_IFNONNULL 0xc7
+#define OPCODE_GOTO_W 0xc8
+#define OPCODE_JSR_W 0xc9
+
+// sipush <probe id>; invokestatic <probe method>
+#define PROBE_LENGTH 6
+
+#define MAX_CODE_LENGTH 65535
+
+#define NO_OFFSET UINT32_MAX
+
+// verification type tags with payload
+#define ITEM_OBJECT 7
+#define ITEM_UNINITIALIZED 8
+
+typedef struct {
+    const uint8_t* data;
+    size_t length;
+    size_t pos;
+    bool overrun;
+} Reader;
+
+typedef struct {
+    uint8_t* data;
+    size_t capacity;
+    size_t pos;
+    bool overrun;
+} Writer;
+
+typedef struct {
+    uint32_t code_length;
+    // old instruction offset -> new offset of whatever is inserted before the instruction, branches go there
+    uint32_t* target_map;
+    // old instruction offset -> new offset of the instruction itself
+    uint32_t* start_map;
+    uint32_t new_code_length;
+} CodeLayout;
+
+static uint16_t get_uint16(const uint8_t* data) {
+    return (data[0] << 8) | data[1];
+}
+
+static uint32_t get_uint32(const uint8_t* data) {
+    return ((uint32_t)data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+static void put_uint16(uint8_t* data, uint16_t value) {
+    data[0] = value >> 8;
+    data[1] = value & 0xFF;
+}
+
+static void put_uint32(uint8_t* data, uint32_t value) {
+    data[0] = value >> 24;
+    data[1] = (value >> 16) & 0xFF;
+    data[2] = (value >> 8) & 0xFF;
+    data[3] = value & 0xFF;
+}
+
+static uint8_t reader_byte(Reader* reader) {
+    if (reader->pos + 1 > reader->length) {
+        reader->overrun = true;
+        return 0;
+    }
+
+    return reader->data[reader->pos++];
+}
+
+static uint16_t reader_uint16(Reader* reader) {
+    if (reader->pos + 2 > reader->length) {
+        reader->overrun = true;
+        return 0;
+    }
+
+    uint16_t value = get_uint16(reader->data + reader->pos);
+    reader->pos += 2;
+
+    return value;
+}
+
+static void writer_byte(Writer* writer, uint8_t value) {
+    if (writer->pos + 1 > writer->capacity) {
+        writer->overrun = true;
+        return;
+    }
+
+    writer->data[writer->pos++] = value;
+}
+
+static void writer_uint16(Writer* writer, uint16_t value) {
+    if (writer->pos + 2 > writer->capacity) {
+        writer->overrun = true;
+        return;
+    }
+
+    put_uint16(writer->data + writer->pos, value);
+    writer->pos += 2;
+}
+
+static size_t switch_padding(uint32_t pc) {
+    return (4 - ((pc + 1) % 4)) % 4;
+}
+
+// returning instruction length or 0 for malformed code,
+// switch instructions length depends on their position because of alignment padding
+static uint32_t instruction_length(const uint8_t* code, uint32_t code_length, uint32_t pc) {
+    uint8_t opcode = code[pc];
+
+    switch (opcode) {
+        case 0x10: case 0x12: case 0x15 ... 0x19: case 0x36 ... 0x3a: case 0xa9: case 0xbc:
+            return 2;
+        case 0x11: case 0x13: case 0x14: case 0x84: case 0x99 ... 0xa8: case 0xb2 ... 0xb8:
+        case 0xbb: case 0xbd: case 0xc0: case 0xc1: case 0xc6: case 0xc7:
+            return 3;
+        case 0xc5:
+            return 4;
+        case 0xb9: case 0xba: case 0xc8: case 0xc9:
+            return 5;
+        case OPCODE_WIDE:
+            if (pc + 1 >= code_length) {
+                return 0;
+            }
+
+            return code[pc + 1] == OPCODE_IINC ? 6 : 4;
+        case OPCODE_TABLESWITCH: {
+            uint32_t operands_pc = pc + 1 + switch_padding(pc);
+            if (operands_pc + 12 > code_length) {
+                return 0;
+            }
+
+            int32_t low = (int32_t)get_uint32(code + operands_pc + 4);
+            int32_t high = (int32_t)get_uint32(code + operands_pc + 8);
+            if (high < low) {
+                return 0;
+            }
+
+            // jump table size is checked in 64 bits, crafted bounds would wrap it around otherwise
+            uint64_t switch_end = (uint64_t)operands_pc + 12 + ((uint64_t)((int64_t)high - low) + 1) * 4;
+            if (switch_end > code_length) {
+                return 0;
+            }
+
+            return (uint32_t)switch_end - pc;
+        }
+        case OPCODE_LOOKUPSWITCH: {
+            uint32_t operands_pc = pc + 1 + switch_padding(pc);
+            if (operands_pc + 8 > code_length) {
+                return 0;
+            }
+
+            uint32_t pairs_count = get_uint32(code + operands_pc + 4);
+
+            uint64_t switch_end = (uint64_t)operands_pc + 8 + (uint64_t)pairs_count * 8;
+            if (switch_end > code_length) {
+                return 0;
+            }
+
+            return (uint32_t)switch_end - pc;
+        }
+        case 0x00 ... 0x0f: case 0x1a ... 0x35: case 0x3b ... 0x83: case 0x85 ... 0x98:
+        case 0xac ... 0xb1: case 0xbe: case 0xbf: case 0xc2: case 0xc3:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static bool is_return(uint8_t opcode) {
+    return opcode >= OPCODE_IRETURN && opcode <= OPCODE_RETURN;
+}
+
+static bool is_branch16(uint8_t opcode) {
+    return (opcode >= OPCODE_IFEQ && opcode <= OPCODE_JSR) || opcode == OPCODE_IFNULL || opcode == OPCODE_IFNONNULL;
+}
+
+static bool is_branch32(uint8_t opcode) {
+    return opcode == OPCODE_GOTO_W || opcode == OPCODE_JSR_W;
+}
+
+static void code_layout_free(CodeLayout* layout) {
+    free(layout->target_map);
+    free(layout->start_map);
+}
+
+// entry probe precedes the first instruction but branches to offset 0 skip it,
+// exit probe precedes every return instruction and branches to the return run it
+static bool code_layout_compute(CodeLayout* layout, const uint8_t* code, uint32_t code_length) {
+    layout->code_length = code_length;
+    layout->target_map = malloc((code_length + 1) * sizeof(uint32_t));
+    layout->start_map = malloc((code_length + 1) * sizeof(uint32_t));
+    if (layout->target_map == NULL || layout->start_map == NULL) {
+        code_layout_free(layout);
+        return false;
+    }
+
+    for (uint32_t pc = 0;pc <= code_length;pc++) {
+        layout->target_map[pc] = NO_OFFSET;
+        layout->start_map[pc] = NO_OFFSET;
+    }
+
+    uint32_t new_pc = PROBE_LENGTH;
+    for (uint32_t pc = 0;pc < code_length;) {
+        uint32_t length = instruction_length(code, code_length, pc);
+        if (length == 0 || pc + length > code_length) {
+            code_layout_free(layout);
+            return false;
+        }
+
+        layout->target_map[pc] = new_pc;
+        if (is_return(code[pc])) {
+            new_pc += PROBE_LENGTH;
+        }
+
+        layout->start_map[pc] = new_pc;
+
+        uint8_t opcode = code[pc];
+        if (opcode == OPCODE_TABLESWITCH || opcode == OPCODE_LOOKUPSWITCH) {
+            new_pc += length - switch_padding(pc) + switch_padding(new_pc);
+        } else {
+            new_pc += length;
+        }
+
+        pc += length;
+    }
+
+    layout->target_map[code_length] = new_pc;
+    layout->start_map[code_length] = new_pc;
+    layout->new_code_length = new_pc;
+
+    if (new_pc > MAX_CODE_LENGTH) {
+        code_layout_free(layout);
+        return false;
+    }
+
+    return true;
+}
+
+static uint32_t layout_target(const CodeLayout* layout, uint32_t pc) {
+    return pc <= layout->code_length ? layout->target_map[pc] : NO_OFFSET;
+}
+
+static uint32_t layout_start(const CodeLayout* layout, uint32_t pc) {
+    return pc <= layout->code_length ? layout->start_map[pc] : NO_OFFSET;
+}
+
+static void emit_probe(uint8_t* new_code, uint32_t new_pc, uint16_t probe_id, uint16_t probe_method_ref) {
+    new_code[new_pc] = OPCODE_SIPUSH;
+    put_uint16(new_code + new_pc + 1, probe_id);
+    new_code[new_pc + 3] = OPCODE_INVOKESTATIC;
+    put_uint16(new_code + new_pc + 4, probe_method_ref);
+}
+
+// computing relocated branch offset, false is returned when target isn't instruction boundary
+static bool relocate_branch(const CodeLayout* layout, uint32_t pc, int32_t offset, int32_t* new_offset) {
+    int64_t target_pc = (int64_t)pc + offset;
+    if (target_pc < 0 || target_pc >= layout->code_length) {
+        return false;
+    }
+
+    uint32_t new_target_pc = layout_target(layout, target_pc);
+    if (new_target_pc == NO_OFFSET) {
+        return false;
+    }
+
+    *new_offset = (int32_t)new_target_pc - (int32_t)layout_start(layout, pc);
+
+    return true;
+}
+
+// switch length was checked against code length by instruction_length() already
+static bool emit_switch(const CodeLayout* layout, const uint8_t* code, uint32_t pc, uint8_t* new_code) {
+    uint32_t new_pc = layout_start(layout, pc);
+    uint32_t operands_pc = pc + 1 + switch_padding(pc);
+    uint32_t new_operands_pc = new_pc + 1 + switch_padding(new_pc);
+
+    new_code[new_pc] = code[pc];
+    memset(new_code + new_pc + 1, 0, new_operands_pc - new_pc - 1);
+
+    uint32_t jumps_count = 0;
+    uint32_t jumps_pc = 0;
+    uint32_t jump_stride = 0;
+
+    // copying fixed operands, then relocating default jump and jump table
+    if (code[pc] == OPCODE_TABLESWITCH) {
+        memcpy(new_code + new_operands_pc, code + operands_pc, 12);
+
+        int32_t low = (int32_t)get_uint32(code + operands_pc + 4);
+        int32_t high = (int32_t)get_uint32(code + operands_pc + 8);
+        jumps_count = (uint32_t)(high - low) + 1;
+        jumps_pc = 12;
+        jump_stride = 4;
+    } else {
+        memcpy(new_code + new_operands_pc, code + operands_pc, 8);
+
+        jumps_count = get_uint32(code + operands_pc + 4);
+        jumps_pc = 8;
+        jump_stride = 8;
+    }
+
+    int32_t new_offset = 0;
+    if (!relocate_branch(layout, pc, (int32_t)get_uint32(code + operands_pc), &new_offset)) {
+        return false;
+    }
+
+    put_uint32(new_code + new_operands_pc, new_offset);
+
+    for (uint32_t jump_idx = 0;jump_idx < jumps_count;jump_idx++) {
+        uint32_t entry_pc = jumps_pc + jump_idx * jump_stride;
+
+        // lookup switch pair starts with match value
+        if (jump_stride == 8) {
+            memcpy(new_code + new_operands_pc + entry_pc, code + operands_pc + entry_pc, 4);
+            entry_pc += 4;
+        }
+
+        if (!relocate_branch(layout, pc, (int32_t)get_uint32(code + operands_pc + entry_pc), &new_offset)) {
+            return false;
+        }
+
+        put_uint32(new_code + new_operands_pc + entry_pc, new_offset);
+    }
+
+    return true;
+}
+
+static uint8_t* emit_code(const CodeLayout* layout, const uint8_t* code, uint16_t probe_id, uint16_t enter_method_ref, uint16_t exit_method_ref) {
+    uint8_t* new_code = malloc(layout->new_code_length);
+    if (new_code == NULL) {
+        return NULL;
+    }
+
+    emit_probe(new_code, 0, probe_id, enter_method_ref);
+
+    for (uint32_t pc = 0;pc < layout->code_length;) {
+        uint8_t opcode = code[pc];
+        uint32_t length = instruction_length(code, layout->code_length, pc);
+        uint32_t new_pc = layout_start(layout, pc);
+
+        if (is_return(opcode)) {
+            emit_probe(new_code, layout_target(layout, pc), probe_id, exit_method_ref);
+        }
+
+        int32_t new_offset = 0;
+        if (is_branch16(opcode)) {
+            if (!relocate_branch(layout, pc, (int16_t)get_uint16(code + pc + 1), &new_offset)
+                    || new_offset < INT16_MIN || new_offset > INT16_MAX) {
+                free(new_code);
+                return NULL;
+            }
+
+            new_code[new_pc] = opcode;
+            put_uint16(new_code + new_pc + 1, (uint16_t)new_offset);
+        } else if (is_branch32(opcode)) {
+            if (!relocate_branch(layout, pc, (int32_t)get_uint32(code + pc + 1), &new_offset)) {
+                free(new_code);
+                return NULL;
+            }
+
+            new_code[new_pc] = opcode;
+            put_uint32(new_code + new_pc + 1, (uint32_t)new_offset);
+        } else if (opcode == OPCODE_TABLESWITCH || opcode == OPCODE_LOOKUPSWITCH) {
+            if (!emit_switch(layout, code, pc, new_code)) {
+                free(new_code);
+                return NULL;
+            }
+        } else {
+            memcpy(new_code + new_pc, code + pc, length);
+        }
+
+        pc += length;
+    }
+
+    return new_code;
+}
+
+static void copy_verification_types(const CodeLayout* layout, Reader* reader, Writer* writer, uint16_t types_count) {
+    for (uint16_t type_idx = 0;type_idx < types_count && !reader->overrun;type_idx++) {
+        uint8_t type_tag = reader_byte(reader);
+        writer_byte(writer, type_tag);
+
+        if (type_tag == ITEM_OBJECT) {
+            writer_uint16(writer, reader_uint16(reader));
+        } else if (type_tag == ITEM_UNINITIALIZED) {
+            // offset of the 'new' instruction
+            uint32_t new_offset = layout_start(layout, reader_uint16(reader));
+            if (new_offset == NO_OFFSET) {
+                reader->overrun = true;
+                return;
+            }
+
+            writer_uint16(writer, new_offset);
+        }
+    }
+}
+
+// stack map frames are re-encoded with relocated offset deltas, compact frame forms
+// are widened to extended ones when delta doesn't fit anymore
+static uint8_t* relocate_stack_map_table(const CodeLayout* layout, const uint8_t* info, uint32_t length, uint32_t* new_length) {
+    Reader reader = { info, length, 0, false };
+    Writer writer = { NULL, length * 3 + 2, 0, false };
+    writer.data = malloc(writer.capacity);
+    if (writer.data == NULL) {
+        return NULL;
+    }
+
+    uint16_t frames_count = reader_uint16(&reader);
+    writer_uint16(&writer, frames_count);
+
+    int64_t offset = -1;
+    int64_t new_offset = -1;
+
+    for (uint16_t frame_idx = 0;frame_idx < frames_count && !reader.overrun;frame_idx++) {
+        uint8_t frame_type = reader_byte(&reader);
+
+        uint16_t offset_delta = 0;
+        if (frame_type <= 63) {
+            offset_delta = frame_type;
+        } else if (frame_type <= 127) {
+            offset_delta = frame_type - 64;
+        } else if (frame_type >= 247) {
+            offset_delta = reader_uint16(&reader);
+        } else {
+            // reserved frame types
+            reader.overrun = true;
+            break;
+        }
+
+        offset += offset_delta + 1;
+
+        uint32_t frame_new_offset = layout_target(layout, offset);
+        if (frame_new_offset == NO_OFFSET) {
+            reader.overrun = true;
+            break;
+        }
+
+        uint32_t new_offset_delta = frame_new_offset - new_offset - 1;
+        new_offset = frame_new_offset;
+
+        if (frame_type <= 63 || frame_type == 251) {
+            if (new_offset_delta <= 63) {
+                writer_byte(&writer, new_offset_delta);
+            } else {
+                writer_byte(&writer, 251);
+                writer_uint16(&writer, new_offset_delta);
+            }
+        } else if (frame_type <= 127 || frame_type == 247) {
+            if (new_offset_delta <= 63) {
+                writer_byte(&writer, 64 + new_offset_delta);
+            } else {
+                writer_byte(&writer, 247);
+                writer_uint16(&writer, new_offset_delta);
+            }
+
+            copy_verification_types(layout, &reader, &writer, 1);
+        } else if (frame_type <= 250) {
+            // chop frame
+            writer_byte(&writer, frame_type);
+            writer_uint16(&writer, new_offset_delta);
+        } else if (frame_type <= 254) {
+            // append frame
+            writer_byte(&writer, frame_type);
+            writer_uint16(&writer, new_offset_delta);
+            copy_verification_types(layout, &reader, &writer, frame_type - 251);
+        } else {
+            writer_byte(&writer, frame_type);
+            writer_uint16(&writer, new_offset_delta);
+
+            uint16_t locals_count = reader_uint16(&reader);
+            writer_uint16(&writer, locals_count);
+            copy_verification_types(layout, &reader, &writer, locals_count);
+
+            uint16_t stack_items_count = reader_uint16(&reader);
+            writer_uint16(&writer, stack_items_count);
+            copy_verification_types(layout, &reader, &writer, stack_items_count);
+        }
+    }
+
+    if (reader.overrun || writer.overrun || reader.pos != length) {
+        free(writer.data);
+        return NULL;
+    }
+
+    *new_length = writer.pos;
+
+    return writer.data;
+}
+
+static uint8_t* relocate_line_number_table(const CodeLayout* layout, const uint8_t* info, uint32_t length) {
+    uint8_t* new_info = malloc(length);
+    if (new_info == NULL || length < 2) {
+        free(new_info);
+        return NULL;
+    }
+
+    memcpy(new_info, info, length);
+
+    uint16_t lines_count = get_uint16(info);
+    if (2 + lines_count * 4 != length) {
+        free(new_info);
+        return NULL;
+    }
+
+    for (uint16_t line_idx = 0;line_idx < lines_count;line_idx++) {
+        uint8_t* line = new_info + 2 + line_idx * 4;
+
+        uint32_t new_start_pc = layout_target(layout, get_uint16(line));
+        if (new_start_pc == NO_OFFSET) {
+            free(new_info);
+            return NULL;
+        }
+
+        put_uint16(line, new_start_pc);
+    }
+
+    return new_info;
+}
+
+// used for both LocalVariableTable and LocalVariableTypeTable
+static uint8_t* relocate_local_variable_table(const CodeLayout* layout, const uint8_t* info, uint32_t length) {
+    uint8_t* new_info = malloc(length);
+    if (new_info == NULL || length < 2) {
+        free(new_info);
+        return NULL;
+    }
+
+    memcpy(new_info, info, length);
+
+    uint16_t variables_count = get_uint16(info);
+    if (2 + variables_count * 10 != length) {
+        free(new_info);
+        return NULL;
+    }
+
+    for (uint16_t variable_idx = 0;variable_idx < variables_count;variable_idx++) {
+        uint8_t* variable = new_info + 2 + variable_idx * 10;
+
+        uint32_t start_pc = get_uint16(variable);
+        uint32_t end_pc = start_pc + get_uint16(variable + 2);
+
+        uint32_t new_start_pc = layout_target(layout, start_pc);
+        uint32_t new_end_pc = layout_target(layout, end_pc);
+        if (new_start_pc == NO_OFFSET || new_end_pc == NO_OFFSET) {
+            free(new_info);
+            return NULL;
+        }
+
+        put_uint16(variable, new_start_pc);
+        put_uint16(variable + 2, new_end_pc - new_start_pc);
+    }
+
+    return new_info;
+}
+
+// instrumenting Code attribute of the method, original code is left intact when method can't be instrumented
+bool instrument_method(JClass* jclass, JMember* method, uint16_t probe_id, uint16_t enter_method_ref, uint16_t exit_method_ref) {
+    JAttribute* code_attribute = jmember_find_attribute(jclass, method, "Code");
+    if (code_attribute == NULL || code_attribute->length < 12) {
+        return false;
+    }
+
+    const uint8_t* info = code_attribute->info;
+    uint16_t max_stack = get_uint16(info);
+    uint32_t code_length = get_uint32(info + 4);
+    if (code_length == 0 || 8 + code_length + 2 > code_attribute->length || max_stack == UINT16_MAX) {
+        return false;
+    }
+
+    const uint8_t* code = info + 8;
+
+    CodeLayout layout;
+    if (!code_layout_compute(&layout, code, code_length)) {
+        return false;
+    }
+
+    uint8_t* new_code = emit_code(&layout, code, probe_id, enter_method_ref, exit_method_ref);
+    if (new_code == NULL) {
+        code_layout_free(&layout);
+        return false;
+    }
+
+    // relocated sub attributes may grow because of widened stack map frames
+    Writer writer = { NULL, code_attribute->length * 4 + layout.new_code_length, 0, false };
+    writer.data = malloc(writer.capacity);
+    if (writer.data == NULL) {
+        free(new_code);
+        code_layout_free(&layout);
+        return false;
+    }
+
+    writer_uint16(&writer, max_stack + 1);
+    writer_uint16(&writer, get_uint16(info + 2));
+    put_uint32(writer.data + writer.pos, layout.new_code_length);
+    writer.pos += 4;
+    memcpy(writer.data + writer.pos, new_code, layout.new_code_length);
+    writer.pos += layout.new_code_length;
+
+    free(new_code);
+
+    Reader reader = { info, code_attribute->length, 8 + code_length, false };
+
+    uint16_t handlers_count = reader_uint16(&reader);
+    writer_uint16(&writer, handlers_count);
+
+    bool relocation_success = true;
+    for (uint16_t handler_idx = 0;handler_idx < handlers_count && relocation_success;handler_idx++) {
+        uint32_t new_start_pc = layout_target(&layout, reader_uint16(&reader));
+        uint32_t new_end_pc = layout_target(&layout, reader_uint16(&reader));
+        uint32_t new_handler_pc = layout_target(&layout, reader_uint16(&reader));
+        uint16_t catch_type = reader_uint16(&reader);
+
+        if (new_start_pc == NO_OFFSET || new_end_pc == NO_OFFSET || new_handler_pc == NO_OFFSET) {
+            relocation_success = false;
+            break;
+        }
+
+        writer_uint16(&writer, new_start_pc);
+        writer_uint16(&writer, new_end_pc);
+        writer_uint16(&writer, new_handler_pc);
+        writer_uint16(&writer, catch_type);
+    }
+
+    uint16_t attributes_count = reader_uint16(&reader);
+    size_t attributes_count_pos = writer.pos;
+    uint16_t new_attributes_count = 0;
+    writer_uint16(&writer, 0);
+
+    for (uint16_t attribute_idx = 0;attribute_idx < attributes_count && relocation_success;attribute_idx++) {
+        uint16_t name_index = reader_uint16(&reader);
+        if (reader.pos + 4 > reader.length) {
+            relocation_success = false;
+            break;
+        }
+
+        uint32_t length = get_uint32(info + reader.pos);
+        reader.pos += 4;
+        if (reader.pos + length > reader.length) {
+            relocation_success = false;
+            break;
+        }
+
+        const uint8_t* attribute_info = info + reader.pos;
+        reader.pos += length;
+
+        const char* name = jclass_cp_utf8(jclass, name_index);
+        if (name == NULL) {
+            relocation_success = false;
+            break;
+        }
+
+        // type annotations may point to code offsets, they are dropped rather than relocated
+        if (strcmp(name, "RuntimeVisibleTypeAnnotations") == 0 || strcmp(name, "RuntimeInvisibleTypeAnnotations") == 0) {
+            continue;
+        }
+
+        uint8_t* new_attribute_info = NULL;
+        uint32_t new_length = length;
+        if (strcmp(name, "StackMapTable") == 0) {
+            new_attribute_info = relocate_stack_map_table(&layout, attribute_info, length, &new_length);
+        } else if (strcmp(name, "LineNumberTable") == 0) {
+            new_attribute_info = relocate_line_number_table(&layout, attribute_info, length);
+        } else if (strcmp(name, "LocalVariableTable") == 0 || strcmp(name, "LocalVariableTypeTable") == 0) {
+            new_attribute_info = relocate_local_variable_table(&layout, attribute_info, length);
+        } else {
+            new_attribute_info = malloc(length + 1);
+            if (new_attribute_info != NULL) {
+                memcpy(new_attribute_info, attribute_info, length);
+            }
+        }
+
+        if (new_attribute_info == NULL || writer.pos + 6 + new_length > writer.capacity) {
+            free(new_attribute_info);
+            relocation_success = false;
+            break;
+        }
+
+        writer_uint16(&writer, name_index);
+        put_uint32(writer.data + writer.pos, new_length);
+        writer.pos += 4;
+        memcpy(writer.data + writer.pos, new_attribute_info, new_length);
+        writer.pos += new_length;
+
+        free(new_attribute_info);
+
+        new_attributes_count += 1;
+    }
+
+    code_layout_free(&layout);
+
+    if (!relocation_success || reader.overrun || writer.overrun) {
+        free(writer.data);
+        return false;
+    }
+
+    put_uint16(writer.data + attributes_count_pos, new_attributes_count);
+
+    free(code_attribute->info);
+    code_attribute->info = writer.data;
+    code_attribute->length = writer.pos;
+
+    return true;
+}
@@ -0,0 +1,8 @@
+#ifndef _INSTRUMENT_H_
+#define _INSTRUMENT_H_
+
+#include "classload.h"
+
+bool instrument_method(JClass* jclass, JMember* method, uint16_t probe_id, uint16_t enter_method_ref, uint16_t exit_method_ref);
+
+#endif
@@ -0,0 +1,789 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "agent.h"
+#include "strarena.h"
+#include "tlbuf.h"
+#include "loadtimeline.h"
+
+#define LOAD_EVENT_NAME_MAX_LENGTH 200
+
+// nesting of class definitions, e.g. superclasses loaded while subclass is defined
+#define MAX_LOAD_DEPTH 64
+
+// per thread buffer capacity, sized to events a thread produces within a drain period,
+// events are dropped and counted when timeline thread falls behind
+#define LOAD_EVENTS_CAPACITY 128
+
+#define BOOTSTRAP_LOADER_ID 0
+#define OTHER_LOADERS_ID MAX_CLASS_LOADERS
+
+static const long DRAIN_PERIOD_NS = 50000000L;
+
+static const char* const OTHER_LOADERS_NAME = "[other loaders]";
+static const char* const UNNAMED_PACKAGE_NAME = "[unnamed package]";
+static const char* const UNKNOWN_NAME = "[unknown]";
+
+typedef enum {
+    LoadEventThreadStarted,
+    LoadEventClassHooked,
+    LoadEventClassLoaded,
+    LoadEventClassPrepared
+} LoadEventKind;
+
+typedef struct {
+    uint64_t time_ns;
+    uint32_t thread_id;
+    uint32_t loader_id;
+    jint class_bytes_count;
+    uint8_t kind;
+    // thread name or class name in internal form, empty for hidden classes
+    char name[LOAD_EVENT_NAME_MAX_LENGTH];
+} LoadEvent;
+
+// class definition from class file load hook to class load event of the same thread
+struct LoadSlice {
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    // duration without nested class definitions
+    uint64_t self_ns;
+    StrHandle class_name;
+    uint32_t thread_id;
+    uint32_t loader_id;
+    jint class_bytes_count;
+    uint32_t depth;
+};
+
+struct LoadMark {
+    uint64_t time_ns;
+    StrHandle class_name;
+    uint32_t thread_id;
+};
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t child_ns;
+    // 0 for hidden classes, their name is known once they are loaded
+    StrHandle class_name;
+    uint32_t loader_id;
+    jint class_bytes_count;
+} OpenSlice;
+
+struct LoadThread {
+    StrHandle name;
+    uint32_t depth;
+    OpenSlice open_slices[MAX_LOAD_DEPTH];
+};
+
+typedef struct {
+    StrHandle name;
+    uint32_t classes;
+    uint64_t bytes;
+    uint64_t self_ns;
+} LoadSummaryEntry;
+
+static atomic_uint next_timeline_id = ATOMIC_VAR_INIT(1);
+
+// thread state is valid for the timeline it was set up by only
+static __thread uint32_t thread_timeline_id = 0;
+static __thread uint32_t thread_id = 0;
+static __thread bool cached_loader_valid = false;
+static __thread jint cached_loader_hash_code = 0;
+static __thread uint32_t cached_loader_id = 0;
+
+static uint64_t monotonic_time_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void copy_name(char* buf, const char* name, size_t name_len) {
+    if (name_len >= LOAD_EVENT_NAME_MAX_LENGTH) {
+        name_len = LOAD_EVENT_NAME_MAX_LENGTH - 1;
+    }
+
+    memcpy(buf, name, name_len);
+    buf[name_len] = '\0';
+}
+
+static void record_event(ClassLoadTimeline* timeline, LoadEventKind kind, uint64_t time_ns, uint32_t loader_id,
+        jint class_bytes_count, const char* name, size_t name_len) {
+    ThreadBuffer* buffer = NULL;
+    LoadEvent* event = thread_buffer_reserve(timeline->events, &buffer);
+    if (event == NULL) {
+        return;
+    }
+
+    event->time_ns = time_ns;
+    event->thread_id = thread_id;
+    event->loader_id = loader_id;
+    event->class_bytes_count = class_bytes_count;
+    event->kind = kind;
+    copy_name(event->name, name, name_len);
+
+    thread_buffer_commit(buffer);
+}
+
+// thread gets its timeline id and name recorded on its first event
+static void ensure_thread_registered(ClassLoadTimeline* timeline, jvmtiEnv* jvmti, JNIEnv* jni) {
+    if (thread_timeline_id == timeline->timeline_id) {
+        return;
+    }
+
+    thread_timeline_id = timeline->timeline_id;
+    thread_id = atomic_fetch_add(&timeline->next_thread_id, 1);
+    cached_loader_valid = false;
+
+    const char* thread_name = UNKNOWN_NAME;
+
+    jvmtiThreadInfo thread_info;
+    memset(&thread_info, 0, sizeof(jvmtiThreadInfo));
+    jvmtiError error = (*jvmti)->GetThreadInfo(jvmti, NULL, &thread_info);
+    if (error == JVMTI_ERROR_NONE && thread_info.name != NULL) {
+        thread_name = thread_info.name;
+    }
+
+    record_event(timeline, LoadEventThreadStarted, monotonic_time_ns(), 0, 0, thread_name, strlen(thread_name));
+
+    if (error == JVMTI_ERROR_NONE) {
+        (*jvmti)->Deallocate(jvmti, (unsigned char*)thread_info.name);
+        (*jni)->DeleteLocalRef(jni, thread_info.thread_group);
+        (*jni)->DeleteLocalRef(jni, thread_info.context_class_loader);
+    }
+}
+
+static void get_loader_name(jvmtiEnv* jvmti, JNIEnv* jni, jobject loader, jint hash_code, char* buf, size_t buf_size) {
+    jclass loader_class = (*jni)->GetObjectClass(jni, loader);
+
+    char* class_signature = NULL;
+    if ((*jvmti)->GetClassSignature(jvmti, loader_class, &class_signature, NULL) == JVMTI_ERROR_NONE) {
+        // "Lcom/acme/PluginLoader;" becomes "com/acme/PluginLoader@1b6d3586"
+        size_t class_signature_len = strlen(class_signature);
+        if (class_signature[0] == 'L' && class_signature_len > 2) {
+            snprintf(buf, buf_size, "%.*s@%x", (int)(class_signature_len - 2), class_signature + 1, (unsigned int)hash_code);
+        } else {
+            snprintf(buf, buf_size, "%s@%x", class_signature, (unsigned int)hash_code);
+        }
+
+        (*jvmti)->Deallocate(jvmti, (unsigned char*)class_signature);
+    } else {
+        snprintf(buf, buf_size, "%s@%x", UNKNOWN_NAME, (unsigned int)hash_code);
+    }
+
+    (*jni)->DeleteLocalRef(jni, loader_class);
+}
+
+static uint32_t find_loader(ClassLoadTimeline* timeline, jint hash_code) {
+    for (size_t loader_idx = 1;loader_idx < timeline->loaders_count;loader_idx++) {
+        if (timeline->loaders[loader_idx].hash_code == hash_code) {
+            return loader_idx;
+        }
+    }
+
+    return OTHER_LOADERS_ID;
+}
+
+// loaders are told apart by identity hash code, the loader of the previous class is cached per thread,
+// so shared loader table is locked when thread switches loaders only
+static uint32_t get_loader_id(ClassLoadTimeline* timeline, jvmtiEnv* jvmti, JNIEnv* jni, jobject loader) {
+    if (loader == NULL) {
+        return BOOTSTRAP_LOADER_ID;
+    }
+
+    jint hash_code = 0;
+    if ((*jvmti)->GetObjectHashCode(jvmti, loader, &hash_code) != JVMTI_ERROR_NONE) {
+        return OTHER_LOADERS_ID;
+    }
+
+    if (cached_loader_valid && cached_loader_hash_code == hash_code) {
+        return cached_loader_id;
+    }
+
+    pthread_mutex_lock(&timeline->loaders_mutex);
+    uint32_t loader_id = find_loader(timeline, hash_code);
+    pthread_mutex_unlock(&timeline->loaders_mutex);
+
+    if (loader_id == OTHER_LOADERS_ID) {
+        char loader_name[CLASS_LOADER_NAME_MAX_LENGTH];
+        get_loader_name(jvmti, jni, loader, hash_code, loader_name, sizeof(loader_name));
+
+        pthread_mutex_lock(&timeline->loaders_mutex);
+
+        // another thread could add the same loader meanwhile
+        loader_id = find_loader(timeline, hash_code);
+        if (loader_id == OTHER_LOADERS_ID && timeline->loaders_count < MAX_CLASS_LOADERS) {
+            loader_id = timeline->loaders_count++;
+            timeline->loaders[loader_id].hash_code = hash_code;
+            memcpy(timeline->loaders[loader_id].name, loader_name, sizeof(loader_name));
+        }
+
+        pthread_mutex_unlock(&timeline->loaders_mutex);
+    }
+
+    cached_loader_valid = true;
+    cached_loader_hash_code = hash_code;
+    cached_loader_id = loader_id;
+
+    return loader_id;
+}
+
+// called from 'ClassFileLoadHook' event handler before class is defined, redefinitions should be filtered out by caller
+void class_load_timeline_hook(ClassLoadTimeline* timeline, jvmtiEnv* jvmti, JNIEnv* jni, jobject loader,
+        const char* class_name, jint class_bytes_count) {
+    if (!atomic_load_explicit(&timeline->recording, memory_order_relaxed)) {
+        return;
+    }
+
+    ensure_thread_registered(timeline, jvmti, jni);
+
+    uint32_t loader_id = get_loader_id(timeline, jvmti, jni, loader);
+
+    record_event(timeline, LoadEventClassHooked, monotonic_time_ns(), loader_id, class_bytes_count,
+            class_name != NULL ? class_name : "", class_name != NULL ? strlen(class_name) : 0);
+}
+
+static void record_class_event(ClassLoadTimeline* timeline, jvmtiEnv* jvmti, JNIEnv* jni, jclass klass, LoadEventKind kind) {
+    uint64_t time_ns = monotonic_time_ns();
+
+    ensure_thread_registered(timeline, jvmti, jni);
+
+    char* class_signature = NULL;
+    if ((*jvmti)->GetClassSignature(jvmti, klass, &class_signature, NULL) != JVMTI_ERROR_NONE) {
+        return;
+    }
+
+    // "Lcom/acme/Service;" is recorded as "com/acme/Service"
+    size_t class_signature_len = strlen(class_signature);
+    if (class_signature[0] == 'L' && class_signature_len > 2) {
+        record_event(timeline, kind, time_ns, 0, 0, class_signature + 1, class_signature_len - 2);
+    }
+
+    (*jvmti)->Deallocate(jvmti, (unsigned char*)class_signature);
+}
+
+// called from 'ClassLoad' event handler, closes class definition opened by the hook
+void class_load_timeline_class_loaded(ClassLoadTimeline* timeline, jvmtiEnv* jvmti, JNIEnv* jni, jclass klass) {
+    if (atomic_load_explicit(&timeline->recording, memory_order_relaxed)) {
+        record_class_event(timeline, jvmti, jni, klass, LoadEventClassLoaded);
+    }
+}
+
+// called from 'ClassPrepare' event handler, marks the end of class linking
+void class_load_timeline_class_prepared(ClassLoadTimeline* timeline, jvmtiEnv* jvmti, JNIEnv* jni, jclass klass) {
+    if (atomic_load_explicit(&timeline->recording, memory_order_relaxed)) {
+        record_class_event(timeline, jvmti, jni, klass, LoadEventClassPrepared);
+    }
+}
+
+bool class_load_timeline_recording(ClassLoadTimeline* timeline) {
+    return atomic_load(&timeline->recording);
+}
+
+static LoadThread* get_thread(ClassLoadTimeline* timeline, uint32_t thread_id) {
+    if (thread_id >= timeline->threads_capacity) {
+        size_t new_capacity = timeline->threads_capacity == 0 ? 64 : timeline->threads_capacity;
+        while (new_capacity <= thread_id) {
+            new_capacity *= 2;
+        }
+
+        LoadThread* new_threads = realloc(timeline->threads, new_capacity * sizeof(LoadThread));
+        if (new_threads == NULL) {
+            return NULL;
+        }
+
+        memset(new_threads + timeline->threads_capacity, 0, (new_capacity - timeline->threads_capacity) * sizeof(LoadThread));
+
+        timeline->threads = new_threads;
+        timeline->threads_capacity = new_capacity;
+    }
+
+    return &timeline->threads[thread_id];
+}
+
+static void close_slice(ClassLoadTimeline* timeline, LoadThread* thread, uint32_t thread_id, uint32_t depth,
+        StrHandle class_name, uint64_t end_ns) {
+    if (timeline->slices_count == timeline->slices_capacity) {
+        size_t new_capacity = timeline->slices_capacity == 0 ? 4096 : timeline->slices_capacity * 2;
+        LoadSlice* new_slices = realloc(timeline->slices, new_capacity * sizeof(LoadSlice));
+        if (new_slices == NULL) {
+            return;
+        }
+
+        timeline->slices = new_slices;
+        timeline->slices_capacity = new_capacity;
+    }
+
+    const OpenSlice* open_slice = &thread->open_slices[depth];
+
+    uint64_t duration_ns = end_ns > open_slice->start_ns ? end_ns - open_slice->start_ns : 0;
+
+    LoadSlice* slice = &timeline->slices[timeline->slices_count++];
+    slice->start_ns = open_slice->start_ns;
+    slice->duration_ns = duration_ns;
+    slice->self_ns = duration_ns > open_slice->child_ns ? duration_ns - open_slice->child_ns : 0;
+    slice->class_name = class_name;
+    slice->thread_id = thread_id;
+    slice->loader_id = open_slice->loader_id;
+    slice->class_bytes_count = open_slice->class_bytes_count;
+    slice->depth = depth;
+
+    if (depth > 0) {
+        thread->open_slices[depth - 1].child_ns += duration_ns;
+    }
+}
+
+static void add_mark(ClassLoadTimeline* timeline, uint32_t thread_id, StrHandle class_name, uint64_t time_ns) {
+    if (timeline->marks_count == timeline->marks_capacity) {
+        size_t new_capacity = timeline->marks_capacity == 0 ? 4096 : timeline->marks_capacity * 2;
+        LoadMark* new_marks = realloc(timeline->marks, new_capacity * sizeof(LoadMark));
+        if (new_marks == NULL) {
+            return;
+        }
+
+        timeline->marks = new_marks;
+        timeline->marks_capacity = new_capacity;
+    }
+
+    LoadMark* mark = &timeline->marks[timeline->marks_count++];
+    mark->time_ns = time_ns;
+    mark->class_name = class_name;
+    mark->thread_id = thread_id;
+}
+
+// class load event closes the innermost definition of the same class, definitions opened after it
+// have failed, e.g. with linkage error, and are dropped
+static void merge_class_loaded(ClassLoadTimeline* timeline, LoadThread* thread, const LoadEvent* event) {
+    StrHandle class_name = str_arena_intern(timeline->names, event->name, strlen(event->name));
+
+    for (uint32_t depth = thread->depth;depth > 0;depth--) {
+        if (thread->open_slices[depth - 1].class_name == class_name) {
+            close_slice(timeline, thread, event->thread_id, depth - 1, class_name, event->time_ns);
+            thread->depth = depth - 1;
+            return;
+        }
+    }
+
+    // hidden classes are named once they are defined
+    if (thread->depth > 0 && thread->open_slices[thread->depth - 1].class_name == 0) {
+        close_slice(timeline, thread, event->thread_id, thread->depth - 1, class_name, event->time_ns);
+        thread->depth -= 1;
+    }
+}
+
+static void merge_event(const void* record, void* arg) {
+    ClassLoadTimeline* timeline = arg;
+    const LoadEvent* event = record;
+
+    LoadThread* thread = get_thread(timeline, event->thread_id);
+    if (thread == NULL) {
+        return;
+    }
+
+    switch (event->kind) {
+    case LoadEventThreadStarted:
+        thread->name = str_arena_intern(timeline->names, event->name, strlen(event->name));
+        break;
+    case LoadEventClassHooked:
+        if (thread->depth < MAX_LOAD_DEPTH) {
+            OpenSlice* open_slice = &thread->open_slices[thread->depth++];
+            open_slice->start_ns = event->time_ns;
+            open_slice->child_ns = 0;
+            open_slice->class_name = event->name[0] != '\0' ? str_arena_intern(timeline->names, event->name, strlen(event->name)) : 0;
+            open_slice->loader_id = event->loader_id;
+            open_slice->class_bytes_count = event->class_bytes_count;
+        }
+        break;
+    case LoadEventClassLoaded:
+        merge_class_loaded(timeline, thread, event);
+        break;
+    case LoadEventClassPrepared:
+        add_mark(timeline, event->thread_id, str_arena_intern(timeline->names, event->name, strlen(event->name)), event->time_ns);
+        break;
+    }
+}
+
+static void write_json_string(FILE* file, const char* str) {
+    fputc('"', file);
+
+    for (const char* str_pos = str;*str_pos != '\0';str_pos++) {
+        if (*str_pos == '"' || *str_pos == '\\') {
+            fprintf(file, "\\%c", *str_pos);
+        } else if ((unsigned char)*str_pos < 0x20) {
+            fprintf(file, "\\u%04x", *str_pos);
+        } else {
+            fputc(*str_pos, file);
+        }
+    }
+
+    fputc('"', file);
+}
+
+static const char* loader_name(ClassLoadTimeline* timeline, uint32_t loader_id) {
+    if (loader_id == BOOTSTRAP_LOADER_ID) {
+        return "bootstrap";
+    }
+
+    return loader_id < timeline->loaders_count ? timeline->loaders[loader_id].name : OTHER_LOADERS_NAME;
+}
+
+// chrome trace event format, definitions are complete events, ends of linking are instant events
+static bool write_trace(ClassLoadTimeline* timeline) {
+    FILE* file = fopen(timeline->trace_file_path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    char name[LOAD_EVENT_NAME_MAX_LENGTH];
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    bool first_event = true;
+    for (size_t thread_idx = 1;thread_idx < timeline->threads_capacity;thread_idx++) {
+        if (timeline->threads[thread_idx].name == 0) {
+            continue;
+        }
+
+        str_arena_copy(timeline->names, timeline->threads[thread_idx].name, name, sizeof(name));
+
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":",
+                first_event ? "" : ",\n", thread_idx);
+        write_json_string(file, name);
+        fprintf(file, "}}");
+
+        first_event = false;
+    }
+
+    for (size_t slice_idx = 0;slice_idx < timeline->slices_count;slice_idx++) {
+        const LoadSlice* slice = &timeline->slices[slice_idx];
+
+        str_arena_copy(timeline->names, slice->class_name, name, sizeof(name));
+
+        fprintf(file, "%s{\"name\":", first_event ? "" : ",\n");
+        write_json_string(file, name);
+        fprintf(file, ",\"cat\":\"define\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"bytes\":%d,\"loader\":",
+                (slice->start_ns - timeline->start_ns) / 1000.0, slice->duration_ns / 1000.0, slice->thread_id,
+                slice->class_bytes_count);
+        write_json_string(file, loader_name(timeline, slice->loader_id));
+        fprintf(file, "}}");
+
+        first_event = false;
+    }
+
+    for (size_t mark_idx = 0;mark_idx < timeline->marks_count;mark_idx++) {
+        const LoadMark* mark = &timeline->marks[mark_idx];
+
+        str_arena_copy(timeline->names, mark->class_name, name, sizeof(name));
+
+        fprintf(file, "%s{\"name\":", first_event ? "" : ",\n");
+        write_json_string(file, name);
+        fprintf(file, ",\"cat\":\"prepare\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                (mark->time_ns - timeline->start_ns) / 1000.0, mark->thread_id);
+
+        first_event = false;
+    }
+
+    fprintf(file, "\n]}\n");
+
+    return fclose(file) == 0;
+}
+
+static int compare_entries_by_self_time(const void* first, const void* second) {
+    const LoadSummaryEntry* first_entry = first;
+    const LoadSummaryEntry* second_entry = second;
+
+    return first_entry->self_ns < second_entry->self_ns ? 1 : first_entry->self_ns > second_entry->self_ns ? -1 : 0;
+}
+
+static void write_summary_entries(ClassLoadTimeline* timeline, FILE* file, const char* title,
+        LoadSummaryEntry* entries, size_t entries_count) {
+    qsort(entries, entries_count, sizeof(LoadSummaryEntry), compare_entries_by_self_time);
+
+    fprintf(file, "# %s: classes, bytes, self ms\n", title);
+
+    char name[LOAD_EVENT_NAME_MAX_LENGTH];
+    for (size_t entry_idx = 0;entry_idx < entries_count;entry_idx++) {
+        const LoadSummaryEntry* entry = &entries[entry_idx];
+        if (entry->classes == 0) {
+            continue;
+        }
+
+        if (entry->name == 0) {
+            snprintf(name, sizeof(name), "%s", UNKNOWN_NAME);
+        } else {
+            str_arena_copy(timeline->names, entry->name, name, sizeof(name));
+        }
+
+        fprintf(file, "%u\t%llu\t%.3f\t%s\n", entry->classes, (unsigned long long)entry->bytes, entry->self_ns / 1000000.0, name);
+    }
+}
+
+static int compare_slices_by_start(const void* first, const void* second) {
+    const LoadSlice* first_slice = *(const LoadSlice* const*)first;
+    const LoadSlice* second_slice = *(const LoadSlice* const*)second;
+
+    return first_slice->start_ns < second_slice->start_ns ? -1 : first_slice->start_ns > second_slice->start_ns ? 1 : 0;
+}
+
+// time any thread spent defining classes comparing to wall time it took,
+// parallelism close to 1 means threads were defining classes one after another
+static void write_summary_totals(ClassLoadTimeline* timeline, FILE* file) {
+    size_t top_slices_count = 0;
+    const LoadSlice** top_slices = malloc((timeline->slices_count + 1) * sizeof(LoadSlice*));
+    if (top_slices == NULL) {
+        return;
+    }
+
+    uint64_t total_bytes = 0;
+    uint64_t loading_ns = 0;
+    for (size_t slice_idx = 0;slice_idx < timeline->slices_count;slice_idx++) {
+        const LoadSlice* slice = &timeline->slices[slice_idx];
+
+        total_bytes += slice->class_bytes_count;
+        if (slice->depth == 0) {
+            top_slices[top_slices_count++] = slice;
+            loading_ns += slice->duration_ns;
+        }
+    }
+
+    qsort(top_slices, top_slices_count, sizeof(LoadSlice*), compare_slices_by_start);
+
+    uint64_t wall_ns = 0;
+    uint64_t covered_until_ns = 0;
+    for (size_t slice_idx = 0;slice_idx < top_slices_count;slice_idx++) {
+        uint64_t start_ns = top_slices[slice_idx]->start_ns;
+        uint64_t end_ns = start_ns + top_slices[slice_idx]->duration_ns;
+
+        if (start_ns < covered_until_ns) {
+            start_ns = covered_until_ns;
+        }
+
+        if (end_ns > start_ns) {
+            wall_ns += end_ns - start_ns;
+            covered_until_ns = end_ns;
+        }
+    }
+
+    free(top_slices);
+
+    fprintf(file, "# classes: %zu, bytes: %llu, defining: %.3f ms, wall: %.3f ms, parallelism: %.2f\n",
+            timeline->slices_count, (unsigned long long)total_bytes, loading_ns / 1000000.0, wall_ns / 1000000.0,
+            wall_ns > 0 ? (double)loading_ns / wall_ns : 0.0);
+}
+
+// loaders, packages and threads ordered by time spent defining their classes
+static bool write_summary(ClassLoadTimeline* timeline) {
+    size_t loaders_count = MAX_CLASS_LOADERS + 1;
+    LoadSummaryEntry* loaders = calloc(loaders_count, sizeof(LoadSummaryEntry));
+    if (loaders == NULL) {
+        return false;
+    }
+
+    for (size_t loader_idx = 0;loader_idx < loaders_count;loader_idx++) {
+        const char* name = loader_name(timeline, loader_idx);
+        loaders[loader_idx].name = str_arena_intern(timeline->names, name, strlen(name));
+    }
+
+    // packages are interned along with class names, so aggregates are indexed by name handles
+    size_t names_count = str_arena_count(timeline->names) + timeline->slices_count + 1;
+
+    LoadSummaryEntry* packages = calloc(names_count, sizeof(LoadSummaryEntry));
+    LoadSummaryEntry* threads = calloc(timeline->threads_capacity + 1, sizeof(LoadSummaryEntry));
+
+    FILE* file = packages != NULL && threads != NULL ? fopen(timeline->summary_file_path, "w") : NULL;
+    if (file == NULL) {
+        free(loaders);
+        free(packages);
+        free(threads);
+        return false;
+    }
+
+    char class_name[LOAD_EVENT_NAME_MAX_LENGTH];
+    for (size_t slice_idx = 0;slice_idx < timeline->slices_count;slice_idx++) {
+        const LoadSlice* slice = &timeline->slices[slice_idx];
+
+        str_arena_copy(timeline->names, slice->class_name, class_name, sizeof(class_name));
+
+        // "com/acme/Service" belongs to "com/acme"
+        const char* package_end = strrchr(class_name, '/');
+        StrHandle package_name = package_end != NULL
+                ? str_arena_intern(timeline->names, class_name, package_end - class_name)
+                : str_arena_intern(timeline->names, UNNAMED_PACKAGE_NAME, strlen(UNNAMED_PACKAGE_NAME));
+
+        LoadSummaryEntry* summary_entries[] = {
+                slice->loader_id < loaders_count ? &loaders[slice->loader_id] : NULL,
+                package_name != 0 && package_name < names_count ? &packages[package_name] : NULL,
+                slice->thread_id < timeline->threads_capacity ? &threads[slice->thread_id] : NULL
+        };
+
+        for (size_t entry_idx = 0;entry_idx < 3;entry_idx++) {
+            LoadSummaryEntry* summary_entry = summary_entries[entry_idx];
+            if (summary_entry != NULL) {
+                summary_entry->classes += 1;
+                summary_entry->bytes += slice->class_bytes_count;
+                summary_entry->self_ns += slice->self_ns;
+            }
+        }
+
+        if (package_name != 0 && package_name < names_count) {
+            packages[package_name].name = package_name;
+        }
+    }
+
+    for (size_t thread_idx = 0;thread_idx < timeline->threads_capacity;thread_idx++) {
+        threads[thread_idx].name = timeline->threads[thread_idx].name;
+    }
+
+    write_summary_totals(timeline, file);
+    write_summary_entries(timeline, file, "loaders", loaders, loaders_count);
+    write_summary_entries(timeline, file, "packages", packages, names_count);
+    write_summary_entries(timeline, file, "threads", threads, timeline->threads_capacity);
+
+    free(loaders);
+    free(packages);
+    free(threads);
+
+    return fclose(file) == 0;
+}
+
+static void write_timeline(ClassLoadTimeline* timeline) {
+    log_debug("class load events dropped: %llu", (unsigned long long)thread_buffer_set_dropped(timeline->events));
+
+    if (!write_trace(timeline)) {
+        log_debug("failed to write class load trace: %s", timeline->trace_file_path);
+    } else if (!write_summary(timeline)) {
+        log_debug("failed to write class load summary: %s", timeline->summary_file_path);
+    } else {
+        log_debug("class load timeline written: %s, %s - %zu classes", timeline->trace_file_path,
+                timeline->summary_file_path, timeline->slices_count);
+    }
+}
+
+// events are merged while they are recorded, so per thread buffers stay small,
+// timeline is written once recording period is over or timeline is stopped
+static void* class_load_timeline_activity(void* arg) {
+    ClassLoadTimeline* timeline = arg;
+
+    const struct timespec drain_period = { 0, DRAIN_PERIOD_NS };
+
+    bool deadline_reached = false;
+    while (atomic_load(&timeline->running) && !deadline_reached) {
+        nanosleep(&drain_period, NULL);
+
+        thread_buffer_set_drain(timeline->events, merge_event, timeline);
+
+        uint64_t deadline_ns = atomic_load(&timeline->deadline_ns);
+        deadline_reached = deadline_ns != 0 && monotonic_time_ns() >= deadline_ns;
+    }
+
+    atomic_store(&timeline->recording, false);
+
+    // events which were being recorded while recording stopped
+    nanosleep(&drain_period, NULL);
+    thread_buffer_set_drain(timeline->events, merge_event, timeline);
+
+    write_timeline(timeline);
+
+    // jvmti can be used by attached threads only
+    if (deadline_reached && timeline->finished_fn != NULL) {
+        JNIEnv* jni = NULL;
+        if ((*timeline->jvm)->AttachCurrentThreadAsDaemon(timeline->jvm, (void**)&jni, NULL) == JNI_OK) {
+            timeline->finished_fn(timeline->finished_arg);
+
+            (*timeline->jvm)->DetachCurrentThread(timeline->jvm);
+        }
+    }
+
+    return NULL;
+}
+
+static void class_load_timeline_free(ClassLoadTimeline* timeline) {
+    if (timeline->events != NULL) {
+        thread_buffer_set_free(timeline->events);
+    }
+
+    if (timeline->names != NULL) {
+        str_arena_free(timeline->names);
+    }
+
+    free(timeline->threads);
+    free(timeline->slices);
+    free(timeline->marks);
+    free(timeline->trace_file_path);
+    free(timeline->summary_file_path);
+    free(timeline);
+}
+
+// recording starts right away, its period starts once VM is initialized
+ClassLoadTimeline* class_load_timeline_start(JavaVM* jvm, int duration_s, const char* trace_file_path,
+        const char* summary_file_path, ClassLoadTimelineFinishedFn* finished_fn, void* finished_arg) {
+    if (duration_s <= 0) {
+        return NULL;
+    }
+
+    ClassLoadTimeline* timeline = calloc(1, sizeof(ClassLoadTimeline));
+    if (timeline == NULL) {
+        return NULL;
+    }
+
+    timeline->jvm = jvm;
+    timeline->timeline_id = atomic_fetch_add(&next_timeline_id, 1);
+    timeline->start_ns = monotonic_time_ns();
+    timeline->duration_ns = duration_s * 1000000000ULL;
+    timeline->finished_fn = finished_fn;
+    timeline->finished_arg = finished_arg;
+    timeline->trace_file_path = strdup(trace_file_path);
+    timeline->summary_file_path = strdup(summary_file_path);
+    timeline->events = thread_buffer_set_new(sizeof(LoadEvent), LOAD_EVENTS_CAPACITY);
+    timeline->names = str_arena_new();
+
+    // thread id 0 is never assigned, loader id 0 is bootstrap loader
+    atomic_init(&timeline->next_thread_id, 1);
+    timeline->loaders_count = 1;
+
+    if (timeline->trace_file_path == NULL || timeline->summary_file_path == NULL
+            || timeline->events == NULL || timeline->names == NULL) {
+        class_load_timeline_free(timeline);
+        return NULL;
+    }
+
+    pthread_mutex_init(&timeline->loaders_mutex, NULL);
+
+    atomic_store(&timeline->deadline_ns, 0);
+    atomic_store(&timeline->recording, true);
+    atomic_store(&timeline->running, true);
+
+    int thread_create_status = pthread_create(&timeline->timeline_thread, NULL, class_load_timeline_activity, timeline);
+    if (thread_create_status != 0) {
+        pthread_mutex_destroy(&timeline->loaders_mutex);
+        class_load_timeline_free(timeline);
+        return NULL;
+    }
+
+    return timeline;
+}
+
+void class_load_timeline_vm_initialized(ClassLoadTimeline* timeline) {
+    atomic_store(&timeline->deadline_ns, monotonic_time_ns() + timeline->duration_ns);
+}
+
+// class load events should be disabled and their in-flight handlers finished before timeline is stopped,
+// timeline is written unless it was already
+void class_load_timeline_stop(ClassLoadTimeline* timeline) {
+    atomic_store(&timeline->running, false);
+
+    pthread_join(timeline->timeline_thread, NULL);
+
+    pthread_mutex_destroy(&timeline->loaders_mutex);
+
+    class_load_timeline_free(timeline);
+}
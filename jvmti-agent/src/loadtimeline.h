@@ -0,0 +1,78 @@
+#ifndef _LOADTIMELINE_H_
+#define _LOADTIMELINE_H_
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "strarena.h"
+#include "tlbuf.h"
+
+#define CLASS_LOADER_NAME_MAX_LENGTH 192
+
+// loaders beyond this number are accounted as a single loader
+#define MAX_CLASS_LOADERS 1024
+
+typedef struct {
+    jint hash_code;
+    char name[CLASS_LOADER_NAME_MAX_LENGTH];
+} ClassLoaderName;
+
+typedef struct LoadSlice LoadSlice;
+typedef struct LoadMark LoadMark;
+typedef struct LoadThread LoadThread;
+
+// called on timeline thread once timeline is written, e.g. to disable events which aren't needed anymore
+typedef void ClassLoadTimelineFinishedFn(void* arg);
+
+typedef struct {
+    JavaVM* jvm;
+    // distinguishes thread local state of this timeline from the state left by the previous one
+    uint32_t timeline_id;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    atomic_uint_fast64_t deadline_ns;
+    atomic_bool recording;
+    atomic_bool running;
+    char* trace_file_path;
+    char* summary_file_path;
+    ClassLoadTimelineFinishedFn* finished_fn;
+    void* finished_arg;
+    ThreadBufferSet* events;
+    atomic_uint next_thread_id;
+    ClassLoaderName loaders[MAX_CLASS_LOADERS];
+    size_t loaders_count;
+    pthread_mutex_t loaders_mutex;
+    // merged by timeline thread only
+    StrArena* names;
+    LoadThread* threads;
+    size_t threads_capacity;
+    LoadSlice* slices;
+    size_t slices_count;
+    size_t slices_capacity;
+    LoadMark* marks;
+    size_t marks_count;
+    size_t marks_capacity;
+    pthread_t timeline_thread;
+} ClassLoadTimeline;
+
+ClassLoadTimeline* class_load_timeline_start(JavaVM* jvm, int duration_s, const char* trace_file_path,
+        const char* summary_file_path, ClassLoadTimelineFinishedFn* finished_fn, void* finished_arg);
+
+void class_load_timeline_vm_initialized(ClassLoadTimeline* timeline);
+
+void class_load_timeline_hook(ClassLoadTimeline* timeline, jvmtiEnv* jvmti, JNIEnv* jni, jobject loader,
+        const char* class_name, jint class_bytes_count);
+
+void class_load_timeline_class_loaded(ClassLoadTimeline* timeline, jvmtiEnv* jvmti, JNIEnv* jni, jclass klass);
+
+void class_load_timeline_class_prepared(ClassLoadTimeline* timeline, jvmtiEnv* jvmti, JNIEnv* jni, jclass klass);
+
+bool class_load_timeline_recording(ClassLoadTimeline* timeline);
+
+void class_load_timeline_stop(ClassLoadTimeline* timeline);
+
+#endif
@@ -0,0 +1,511 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <sched.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "agent.h"
+#include "hashmap.h"
+#include "stacktable.h"
+#include "tlbuf.h"
+#include "classload.h"
+#include "instrument.h"
+#include "methodprobe.h"
+
+#define ACC_PUBLIC 0x0001
+#define ACC_STATIC 0x0008
+#define ACC_FINAL 0x0010
+#define ACC_SUPER 0x0020
+#define ACC_NATIVE 0x0100
+
+#define PROBES_CLASS_NAME "jvmtiagent/MethodProbes"
+#define PROBE_METHOD_DESCRIPTOR "(I)V"
+
+// probe id is pushed with 'sipush'
+#define MAX_PROBES 32767
+
+#define PROBE_KEY_MAX_LENGTH 1024
+
+// deeper probed calls are counted but not timed
+#define PROBE_STACK_MAX_DEPTH 128
+
+// per thread buffer capacity, timings are dropped when drain thread falls behind
+#define TIMINGS_CAPACITY 1024
+
+static const long DRAIN_PERIOD_NS = 100000000L;
+
+typedef struct {
+    jint probe_id;
+    uint64_t duration_ns;
+} MethodTiming;
+
+typedef struct {
+    jint probe_id;
+    uint64_t enter_ns;
+} ProbeFrame;
+
+typedef struct {
+    jint class_bytes_count;
+    unsigned char class_bytes[];
+} OriginalClass;
+
+typedef struct {
+    char* class_name;
+    OriginalClass* original_class;
+} OriginalClassCopy;
+
+typedef struct {
+    OriginalClassCopy* copies;
+    size_t count;
+    size_t capacity;
+} OriginalClassCopies;
+
+// natives of probes class have no way to get profiler state other than this
+static _Atomic(MethodProbes*) active_method_probes = NULL;
+// probe natives which may still use probes they loaded, probes are freed once none is left
+static atomic_uint probes_in_flight = 0;
+
+static __thread ProbeFrame probe_stack[PROBE_STACK_MAX_DEPTH];
+static __thread size_t probe_stack_depth = 0;
+
+static uint64_t monotonic_time_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void JNICALL probe_enter(JNIEnv* jni, jclass probes_class, jint probe_id) {
+    if (probe_stack_depth < PROBE_STACK_MAX_DEPTH) {
+        probe_stack[probe_stack_depth].probe_id = probe_id;
+        probe_stack[probe_stack_depth].enter_ns = monotonic_time_ns();
+    }
+
+    probe_stack_depth += 1;
+}
+
+static void JNICALL probe_exit(JNIEnv* jni, jclass probes_class, jint probe_id) {
+    if (probe_stack_depth > PROBE_STACK_MAX_DEPTH) {
+        probe_stack_depth -= 1;
+        return;
+    }
+
+    uint64_t exit_ns = monotonic_time_ns();
+
+    // methods completed by exception never run exit probe, so their frames are popped along the way
+    while (probe_stack_depth > 0) {
+        probe_stack_depth -= 1;
+
+        const ProbeFrame* frame = &probe_stack[probe_stack_depth];
+        if (frame->probe_id != probe_id) {
+            continue;
+        }
+
+        atomic_fetch_add(&probes_in_flight, 1);
+
+        MethodProbes* method_probes = atomic_load(&active_method_probes);
+        if (method_probes != NULL) {
+            ThreadBuffer* buffer = NULL;
+            MethodTiming* timing = thread_buffer_reserve(method_probes->timings, &buffer);
+            if (timing != NULL) {
+                timing->probe_id = probe_id;
+                timing->duration_ns = exit_ns - frame->enter_ns;
+
+                thread_buffer_commit(buffer);
+            }
+        }
+
+        atomic_fetch_sub(&probes_in_flight, 1);
+
+        return;
+    }
+}
+
+// probes class is defined by bootstrap class loader, so it's visible to classes of every loader
+bool method_probes_define_helper(MethodProbes* method_probes, JNIEnv* jni) {
+    JClass* probes_jclass = jclass_new(PROBES_CLASS_NAME, "java/lang/Object", ACC_PUBLIC | ACC_FINAL | ACC_SUPER);
+    if (probes_jclass == NULL) {
+        return false;
+    }
+
+    size_t class_bytes_count = 0;
+    uint8_t* class_bytes = NULL;
+    if (jclass_add_method(probes_jclass, ACC_PUBLIC | ACC_STATIC | ACC_NATIVE, "enter", PROBE_METHOD_DESCRIPTOR) != NULL
+            && jclass_add_method(probes_jclass, ACC_PUBLIC | ACC_STATIC | ACC_NATIVE, "exit", PROBE_METHOD_DESCRIPTOR) != NULL) {
+        class_bytes = jclass_write(probes_jclass, &class_bytes_count);
+    }
+
+    jclass_free(probes_jclass);
+
+    if (class_bytes == NULL) {
+        return false;
+    }
+
+    jclass probes_class = (*jni)->DefineClass(jni, PROBES_CLASS_NAME, NULL, (const jbyte*)class_bytes, class_bytes_count);
+    free(class_bytes);
+
+    if (probes_class == NULL) {
+        // defined already by previous agent attachment
+        (*jni)->ExceptionClear(jni);
+
+        probes_class = (*jni)->FindClass(jni, PROBES_CLASS_NAME);
+        if (probes_class == NULL) {
+            (*jni)->ExceptionClear(jni);
+            log_debug("failed to define '%s' class", PROBES_CLASS_NAME);
+            return false;
+        }
+    }
+
+    JNINativeMethod probe_methods[] = {
+        { "enter", PROBE_METHOD_DESCRIPTOR, (void*)probe_enter },
+        { "exit", PROBE_METHOD_DESCRIPTOR, (void*)probe_exit }
+    };
+
+    jint register_status = (*jni)->RegisterNatives(jni, probes_class, probe_methods, 2);
+    (*jni)->DeleteLocalRef(jni, probes_class);
+
+    if (register_status != JNI_OK) {
+        (*jni)->ExceptionClear(jni);
+        log_debug("failed to register '%s' natives", PROBES_CLASS_NAME);
+        return false;
+    }
+
+    atomic_store(&method_probes->helper_defined, true);
+
+    return true;
+}
+
+// probe id is bound to method name and descriptor, so redefined class gets the same ids
+static jint method_probes_probe_id(MethodProbes* method_probes, const char* class_name, const char* method_name, const char* descriptor) {
+    char probe_key[PROBE_KEY_MAX_LENGTH];
+    int probe_key_len = snprintf(probe_key, sizeof(probe_key), "%s.%s%s", class_name, method_name, descriptor);
+    if (probe_key_len < 0 || probe_key_len >= sizeof(probe_key)) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&method_probes->probe_names_mutex);
+
+    jint probe_id = (jint)(intptr_t)hash_map_get(method_probes->probe_ids, probe_key) - 1;
+    if (probe_id < 0 && method_probes->probe_names_count < MAX_PROBES) {
+        char** new_probe_names = realloc(method_probes->probe_names, (method_probes->probe_names_count + 1) * sizeof(char*));
+        if (new_probe_names != NULL) {
+            method_probes->probe_names = new_probe_names;
+
+            // timings are aggregated by displayed name, so it keeps descriptor and overloads get histograms of their own
+            char* probe_name = strdup(probe_key);
+            if (probe_name != NULL) {
+                probe_id = method_probes->probe_names_count;
+                if (hash_map_put(method_probes->probe_ids, probe_key, (void*)(intptr_t)(probe_id + 1))) {
+                    method_probes->probe_names[probe_id] = probe_name;
+                    method_probes->probe_names_count += 1;
+                } else {
+                    free(probe_name);
+                    probe_id = -1;
+                }
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&method_probes->probe_names_mutex);
+
+    return probe_id;
+}
+
+static void method_probes_keep_original(MethodProbes* method_probes, const char* class_name,
+        jint class_bytes_count, const unsigned char* class_bytes) {
+    OriginalClass* original_class = malloc(sizeof(OriginalClass) + class_bytes_count);
+    if (original_class == NULL) {
+        return;
+    }
+
+    original_class->class_bytes_count = class_bytes_count;
+    memcpy(original_class->class_bytes, class_bytes, class_bytes_count);
+
+    free(hash_map_remove(method_probes->original_classes, class_name));
+
+    if (!hash_map_put(method_probes->original_classes, class_name, original_class)) {
+        free(original_class);
+    }
+}
+
+// called from 'ClassFileLoadHook' event handler, returns true when class bytes were replaced
+bool method_probes_transform(MethodProbes* method_probes, jvmtiEnv* jvmti, const char* class_name,
+        jint class_bytes_count, const unsigned char* class_bytes, jint* new_class_bytes_count, unsigned char** new_class_bytes) {
+    if (class_name == NULL || !atomic_load(&method_probes->helper_defined)
+            || fnmatch(method_probes->class_pattern, class_name, 0) != 0
+            || strcmp(class_name, PROBES_CLASS_NAME) == 0) {
+        return false;
+    }
+
+    // original bytes are kept to remove probes later, and to install them again
+    method_probes_keep_original(method_probes, class_name, class_bytes_count, class_bytes);
+
+    if (!atomic_load(&method_probes->enabled)) {
+        return false;
+    }
+
+    JClass* jclass = jclass_load(class_bytes, class_bytes_count);
+    if (jclass == NULL) {
+        log_debug("failed to parse '%s' class", class_name);
+        return false;
+    }
+
+    uint16_t enter_method_ref = jclass_cp_add_method_ref(jclass, PROBES_CLASS_NAME, "enter", PROBE_METHOD_DESCRIPTOR);
+    uint16_t exit_method_ref = jclass_cp_add_method_ref(jclass, PROBES_CLASS_NAME, "exit", PROBE_METHOD_DESCRIPTOR);
+    if (enter_method_ref == 0 || exit_method_ref == 0) {
+        jclass_free(jclass);
+        return false;
+    }
+
+    size_t instrumented_count = 0;
+    for (uint16_t method_idx = 0;method_idx < jclass->methods_count;method_idx++) {
+        JMember* method = &jclass->methods[method_idx];
+
+        const char* method_name = jclass_cp_utf8(jclass, method->name_index);
+        const char* descriptor = jclass_cp_utf8(jclass, method->descriptor_index);
+        if (method_name == NULL || descriptor == NULL || fnmatch(method_probes->method_pattern, method_name, 0) != 0) {
+            continue;
+        }
+
+        jint probe_id = method_probes_probe_id(method_probes, class_name, method_name, descriptor);
+        if (probe_id < 0) {
+            continue;
+        }
+
+        if (instrument_method(jclass, method, probe_id, enter_method_ref, exit_method_ref)) {
+            instrumented_count += 1;
+        } else {
+            log_debug("skipped probing '%s.%s%s' method", class_name, method_name, descriptor);
+        }
+    }
+
+    bool transformed = false;
+    if (instrumented_count > 0) {
+        size_t instrumented_bytes_count = 0;
+        uint8_t* instrumented_bytes = jclass_write(jclass, &instrumented_bytes_count);
+
+        // new class bytes must be allocated by jvmti
+        unsigned char* jvmti_class_bytes = NULL;
+        if (instrumented_bytes != NULL
+                && (*jvmti)->Allocate(jvmti, instrumented_bytes_count, &jvmti_class_bytes) == JVMTI_ERROR_NONE) {
+            memcpy(jvmti_class_bytes, instrumented_bytes, instrumented_bytes_count);
+
+            *new_class_bytes = jvmti_class_bytes;
+            *new_class_bytes_count = instrumented_bytes_count;
+            transformed = true;
+
+            log_debug("probed %zu methods of '%s' class", instrumented_count, class_name);
+        }
+
+        free(instrumented_bytes);
+    }
+
+    jclass_free(jclass);
+
+    return transformed;
+}
+
+// probes are installed or removed once classes are redefined
+void method_probes_set_enabled(MethodProbes* method_probes, bool enabled) {
+    atomic_store(&method_probes->enabled, enabled);
+}
+
+static void copy_original_class(const char* class_name, void* value, void* arg) {
+    OriginalClassCopies* copies = arg;
+    const OriginalClass* original_class = value;
+
+    if (copies->count == copies->capacity) {
+        size_t new_capacity = copies->capacity == 0 ? 16 : copies->capacity * 2;
+        OriginalClassCopy* new_copies = realloc(copies->copies, new_capacity * sizeof(OriginalClassCopy));
+        if (new_copies == NULL) {
+            return;
+        }
+
+        copies->copies = new_copies;
+        copies->capacity = new_capacity;
+    }
+
+    size_t original_class_size = sizeof(OriginalClass) + original_class->class_bytes_count;
+
+    OriginalClassCopy* copy = &copies->copies[copies->count];
+    copy->class_name = strdup(class_name);
+    copy->original_class = malloc(original_class_size);
+    if (copy->class_name == NULL || copy->original_class == NULL) {
+        free(copy->class_name);
+        free(copy->original_class);
+        return;
+    }
+
+    memcpy(copy->original_class, original_class, original_class_size);
+    copies->count += 1;
+}
+
+// original classes are copied first, callback usually redefines classes which updates originals map
+void method_probes_for_each_original(MethodProbes* method_probes, OriginalClassFn* original_class_fn, void* arg) {
+    OriginalClassCopies copies = { NULL, 0, 0 };
+    hash_map_for_each(method_probes->original_classes, copy_original_class, &copies);
+
+    for (size_t copy_idx = 0;copy_idx < copies.count;copy_idx++) {
+        OriginalClassCopy* copy = &copies.copies[copy_idx];
+        original_class_fn(copy->class_name, copy->original_class->class_bytes, copy->original_class->class_bytes_count, arg);
+
+        free(copy->class_name);
+        free(copy->original_class);
+    }
+
+    free(copies.copies);
+}
+
+static void aggregate_timing(const void* record, void* arg) {
+    MethodProbes* method_probes = arg;
+    const MethodTiming* timing = record;
+
+    pthread_mutex_lock(&method_probes->probe_names_mutex);
+    const char* probe_name = timing->probe_id < method_probes->probe_names_count
+            ? method_probes->probe_names[timing->probe_id] : NULL;
+    pthread_mutex_unlock(&method_probes->probe_names_mutex);
+
+    stack_table_add(method_probes->sites, method_probes->jvmti, NULL, 0, probe_name, timing->duration_ns);
+}
+
+static void* method_probes_activity(void* arg) {
+    MethodProbes* method_probes = arg;
+
+    JNIEnv* jni = NULL;
+    jint attach_thread_status = (*method_probes->jvm)->AttachCurrentThreadAsDaemon(method_probes->jvm, (void**)&jni, NULL);
+    if (attach_thread_status != JNI_OK) {
+        log_debug("failed to attach 'method probes' thread");
+        return NULL;
+    }
+
+    log_debug("'method probes' thread is running");
+
+    const struct timespec drain_period = { 0, DRAIN_PERIOD_NS };
+
+    while (atomic_load(&method_probes->draining)) {
+        nanosleep(&drain_period, NULL);
+
+        thread_buffer_set_drain(method_probes->timings, aggregate_timing, method_probes);
+    }
+
+    log_debug("'method probes' thread stopping...");
+
+    (*method_probes->jvm)->DetachCurrentThread(method_probes->jvm);
+
+    return NULL;
+}
+
+static void free_original_class(const char* class_name, void* value, void* arg) {
+    free(value);
+}
+
+static void method_probes_free(MethodProbes* method_probes) {
+    if (method_probes->original_classes != NULL) {
+        hash_map_for_each(method_probes->original_classes, free_original_class, NULL);
+        hash_map_free(method_probes->original_classes);
+    }
+
+    if (method_probes->probe_ids != NULL) {
+        hash_map_free(method_probes->probe_ids);
+    }
+
+    if (method_probes->timings != NULL) {
+        thread_buffer_set_free(method_probes->timings);
+    }
+
+    if (method_probes->sites != NULL) {
+        stack_table_free(method_probes->sites);
+    }
+
+    for (size_t probe_name_idx = 0;probe_name_idx < method_probes->probe_names_count;probe_name_idx++) {
+        free(method_probes->probe_names[probe_name_idx]);
+    }
+
+    free(method_probes->probe_names);
+    free(method_probes->class_pattern);
+    free(method_probes->method_pattern);
+
+    pthread_mutex_destroy(&method_probes->probe_names_mutex);
+
+    free(method_probes);
+}
+
+// pattern is "<class glob>.<method glob>" in internal form, e.g. "com/acme/*Service.get*"
+MethodProbes* method_probes_start(JavaVM* jvm, jvmtiEnv* jvmti, const char* pattern) {
+    MethodProbes* method_probes = calloc(1, sizeof(MethodProbes));
+    if (method_probes == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&method_probes->probe_names_mutex, NULL);
+
+    method_probes->jvm = jvm;
+    method_probes->jvmti = jvmti;
+
+    const char* method_pattern = strrchr(pattern, '.');
+    if (method_pattern != NULL) {
+        method_probes->class_pattern = strndup(pattern, method_pattern - pattern);
+        method_probes->method_pattern = strdup(method_pattern + 1);
+    } else {
+        method_probes->class_pattern = strdup(pattern);
+        method_probes->method_pattern = strdup("*");
+    }
+
+    method_probes->sites = stack_table_new(jvm);
+    method_probes->timings = thread_buffer_set_new(sizeof(MethodTiming), TIMINGS_CAPACITY);
+    method_probes->probe_ids = hash_map_new(1024, NULL);
+    method_probes->original_classes = hash_map_new(64, NULL);
+
+    if (method_probes->class_pattern == NULL || method_probes->method_pattern == NULL
+            || method_probes->sites == NULL || method_probes->timings == NULL
+            || method_probes->probe_ids == NULL || method_probes->original_classes == NULL) {
+        method_probes_free(method_probes);
+        return NULL;
+    }
+
+    atomic_store(&method_probes->enabled, true);
+    atomic_store(&method_probes->draining, true);
+
+    int thread_create_status = pthread_create(&method_probes->drain_thread, NULL, method_probes_activity, method_probes);
+    if (thread_create_status != 0) {
+        method_probes_free(method_probes);
+        return NULL;
+    }
+
+    atomic_store(&active_method_probes, method_probes);
+
+    return method_probes;
+}
+
+// histograms file holds latency distribution per probed method
+bool method_probes_dump(MethodProbes* method_probes, const char* histograms_file_path) {
+    log_debug("method timings dropped: %llu",
+            (unsigned long long)thread_buffer_set_dropped(method_probes->timings));
+
+    return stack_table_dump_histograms(method_probes->sites, histograms_file_path);
+}
+
+// class file load hook should be disabled before probes are stopped, probed methods keep calling natives
+// which only record timings while probes are active
+void method_probes_stop(MethodProbes* method_probes) {
+    atomic_store(&active_method_probes, NULL);
+
+    // probe which loaded probes right before they were deactivated may still be recording its timing
+    while (atomic_load(&probes_in_flight) > 0) {
+        sched_yield();
+    }
+
+    atomic_store(&method_probes->draining, false);
+
+    pthread_join(method_probes->drain_thread, NULL);
+
+    method_probes_free(method_probes);
+}
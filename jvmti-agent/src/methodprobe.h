@@ -0,0 +1,47 @@
+#ifndef _METHODPROBE_H_
+#define _METHODPROBE_H_
+
+#include <jvmti.h>
+
+#include "hashmap.h"
+#include "stacktable.h"
+#include "tlbuf.h"
+
+typedef struct {
+    JavaVM* jvm;
+    jvmtiEnv* jvmti;
+    char* class_pattern;
+    char* method_pattern;
+    StackTable* sites;
+    ThreadBufferSet* timings;
+    // probe id -> "pkg/Cls.method" name, ids are kept across redefinitions of the class
+    HashMap* probe_ids;
+    char** probe_names;
+    size_t probe_names_count;
+    pthread_mutex_t probe_names_mutex;
+    // class name -> bytes the class had before instrumentation
+    HashMap* original_classes;
+    atomic_bool helper_defined;
+    atomic_bool enabled;
+    pthread_t drain_thread;
+    atomic_bool draining;
+} MethodProbes;
+
+typedef void OriginalClassFn(const char* class_name, const unsigned char* class_bytes, jint class_bytes_count, void* arg);
+
+MethodProbes* method_probes_start(JavaVM* jvm, jvmtiEnv* jvmti, const char* pattern);
+
+bool method_probes_define_helper(MethodProbes* method_probes, JNIEnv* jni);
+
+bool method_probes_transform(MethodProbes* method_probes, jvmtiEnv* jvmti, const char* class_name,
+        jint class_bytes_count, const unsigned char* class_bytes, jint* new_class_bytes_count, unsigned char** new_class_bytes);
+
+void method_probes_set_enabled(MethodProbes* method_probes, bool enabled);
+
+void method_probes_for_each_original(MethodProbes* method_probes, OriginalClassFn* original_class_fn, void* arg);
+
+bool method_probes_dump(MethodProbes* method_probes, const char* histograms_file_path);
+
+void method_probes_stop(MethodProbes* method_probes);
+
+#endif
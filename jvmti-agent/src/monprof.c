@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "agent.h"
+#include "hashmap.h"
+#include "stacktable.h"
+#include "tlbuf.h"
+#include "monprof.h"
+
+#define MONITOR_PROFILER_MAX_FRAMES 32
+
+#define MONITOR_CLASS_NAME_MAX_LENGTH 128
+
+// per thread buffer capacity, contentions are dropped when drain thread falls behind
+#define CONTENTIONS_CAPACITY 128
+
+static const long DRAIN_PERIOD_NS = 100000000L;
+
+typedef struct {
+    uint64_t blocked_ns;
+    jint frame_count;
+    jmethodID frames[MONITOR_PROFILER_MAX_FRAMES];
+    char class_name[MONITOR_CLASS_NAME_MAX_LENGTH];
+} Contention;
+
+// thread can wait for a single monitor at a time, so enter timestamp is all the state event pair needs
+static __thread uint64_t contended_enter_ns = 0;
+
+static uint64_t monotonic_time_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// called from 'MonitorContendedEnter' event handler on the blocked thread
+void monitor_profiler_contended_enter(MonitorProfiler* monitor_profiler) {
+    contended_enter_ns = monotonic_time_ns();
+}
+
+// called from 'MonitorContendedEntered' event handler on the thread which acquired monitor
+void monitor_profiler_contended_entered(MonitorProfiler* monitor_profiler, jvmtiEnv* jvmti, JNIEnv* jni, jobject monitor) {
+    if (contended_enter_ns == 0) {
+        // profiler was started while thread was already blocked
+        return;
+    }
+
+    uint64_t blocked_ns = monotonic_time_ns() - contended_enter_ns;
+    contended_enter_ns = 0;
+
+    ThreadBuffer* buffer = NULL;
+    Contention* contention = thread_buffer_reserve(monitor_profiler->contentions, &buffer);
+    if (contention == NULL) {
+        return;
+    }
+
+    jvmtiFrameInfo frames[MONITOR_PROFILER_MAX_FRAMES];
+    jint frame_count = 0;
+    if ((*jvmti)->GetStackTrace(jvmti, NULL, 0, MONITOR_PROFILER_MAX_FRAMES, frames, &frame_count) != JVMTI_ERROR_NONE) {
+        frame_count = 0;
+    }
+
+    for (jint frame_idx = 0;frame_idx < frame_count;frame_idx++) {
+        contention->frames[frame_idx] = frames[frame_idx].method;
+    }
+
+    contention->frame_count = frame_count;
+    contention->blocked_ns = blocked_ns;
+    contention->class_name[0] = '\0';
+
+    jclass monitor_class = (*jni)->GetObjectClass(jni, monitor);
+
+    char* class_signature = NULL;
+    if ((*jvmti)->GetClassSignature(jvmti, monitor_class, &class_signature, NULL) == JVMTI_ERROR_NONE) {
+        stack_table_class_name(class_signature, contention->class_name, sizeof(contention->class_name));
+        (*jvmti)->Deallocate(jvmti, (unsigned char*)class_signature);
+    }
+
+    (*jni)->DeleteLocalRef(jni, monitor_class);
+
+    thread_buffer_commit(buffer);
+}
+
+static void aggregate_contention(const void* record, void* arg) {
+    MonitorProfiler* monitor_profiler = arg;
+    const Contention* contention = record;
+
+    // monitor class becomes the leaf frame of the waiting stack
+    const char* class_name = contention->class_name[0] != '\0' ? contention->class_name : NULL;
+
+    stack_table_add(monitor_profiler->sites, monitor_profiler->jvmti, contention->frames, contention->frame_count,
+            class_name, contention->blocked_ns);
+}
+
+static void* monitor_profiler_activity(void* arg) {
+    MonitorProfiler* monitor_profiler = arg;
+
+    JNIEnv* jni = NULL;
+    jint attach_thread_status = (*monitor_profiler->jvm)->AttachCurrentThreadAsDaemon(monitor_profiler->jvm, (void**)&jni, NULL);
+    if (attach_thread_status != JNI_OK) {
+        log_debug("failed to attach 'monitor profiler' thread");
+        return NULL;
+    }
+
+    log_debug("'monitor profiler' thread is running");
+
+    const struct timespec drain_period = { 0, DRAIN_PERIOD_NS };
+
+    while (atomic_load(&monitor_profiler->draining)) {
+        nanosleep(&drain_period, NULL);
+
+        thread_buffer_set_drain(monitor_profiler->contentions, aggregate_contention, monitor_profiler);
+    }
+
+    log_debug("'monitor profiler' thread stopping...");
+
+    (*monitor_profiler->jvm)->DetachCurrentThread(monitor_profiler->jvm);
+
+    return NULL;
+}
+
+static void monitor_profiler_free(MonitorProfiler* monitor_profiler) {
+    if (monitor_profiler->contentions != NULL) {
+        thread_buffer_set_free(monitor_profiler->contentions);
+    }
+
+    if (monitor_profiler->sites != NULL) {
+        stack_table_free(monitor_profiler->sites);
+    }
+
+    free(monitor_profiler);
+}
+
+MonitorProfiler* monitor_profiler_start(JavaVM* jvm, jvmtiEnv* jvmti) {
+    MonitorProfiler* monitor_profiler = calloc(1, sizeof(MonitorProfiler));
+    if (monitor_profiler == NULL) {
+        return NULL;
+    }
+
+    monitor_profiler->jvm = jvm;
+    monitor_profiler->jvmti = jvmti;
+    monitor_profiler->sites = stack_table_new(jvm);
+    monitor_profiler->contentions = thread_buffer_set_new(sizeof(Contention), CONTENTIONS_CAPACITY);
+
+    if (monitor_profiler->sites == NULL || monitor_profiler->contentions == NULL) {
+        monitor_profiler_free(monitor_profiler);
+        return NULL;
+    }
+
+    atomic_store(&monitor_profiler->draining, true);
+
+    int thread_create_status = pthread_create(&monitor_profiler->drain_thread, NULL, monitor_profiler_activity, monitor_profiler);
+    if (thread_create_status != 0) {
+        monitor_profiler_free(monitor_profiler);
+        return NULL;
+    }
+
+    return monitor_profiler;
+}
+
+// collapsed profile holds blocked nanoseconds per waiting stack, histograms file holds blocked time distribution per site
+bool monitor_profiler_dump(MonitorProfiler* monitor_profiler, const char* file_path, const char* histograms_file_path) {
+    log_debug("monitor contentions dropped: %llu",
+            (unsigned long long)thread_buffer_set_dropped(monitor_profiler->contentions));
+
+    return stack_table_dump(monitor_profiler->sites, file_path, StackSiteTotal)
+            && stack_table_dump_histograms(monitor_profiler->sites, histograms_file_path);
+}
+
+// contended monitor events should be disabled before profiler is stopped
+void monitor_profiler_stop(MonitorProfiler* monitor_profiler) {
+    atomic_store(&monitor_profiler->draining, false);
+
+    pthread_join(monitor_profiler->drain_thread, NULL);
+
+    monitor_profiler_free(monitor_profiler);
+}
@@ -0,0 +1,28 @@
+#ifndef _MONPROF_H_
+#define _MONPROF_H_
+
+#include <jvmti.h>
+
+#include "stacktable.h"
+#include "tlbuf.h"
+
+typedef struct {
+    JavaVM* jvm;
+    jvmtiEnv* jvmti;
+    StackTable* sites;
+    ThreadBufferSet* contentions;
+    pthread_t drain_thread;
+    atomic_bool draining;
+} MonitorProfiler;
+
+MonitorProfiler* monitor_profiler_start(JavaVM* jvm, jvmtiEnv* jvmti);
+
+void monitor_profiler_contended_enter(MonitorProfiler* monitor_profiler);
+
+void monitor_profiler_contended_entered(MonitorProfiler* monitor_profiler, jvmtiEnv* jvmti, JNIEnv* jni, jobject monitor);
+
+bool monitor_profiler_dump(MonitorProfiler* monitor_profiler, const char* file_path, const char* histograms_file_path);
+
+void monitor_profiler_stop(MonitorProfiler* monitor_profiler);
+
+#endif
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <limits.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "agent.h"
+#include "strarena.h"
+#include "patchtable.h"
+
+PatchTable* patch_table_new(StrArena* class_names) {
+    PatchTable* patch_table = calloc(1, sizeof(PatchTable));
+    if (patch_table == NULL) {
+        return NULL;
+    }
+
+    patch_table->patches = symbol_map_new();
+    if (patch_table->patches == NULL) {
+        free(patch_table);
+        return NULL;
+    }
+
+    patch_table->class_names = class_names;
+    atomic_init(&patch_table->patches_count, 0);
+
+    pthread_mutex_init(&patch_table->mutex, NULL);
+
+    return patch_table;
+}
+
+// class name is in internal form, e.g. "com/acme/Service", patch of the same class replaces the previous one
+bool patch_table_put(PatchTable* patch_table, const char* class_name, const unsigned char* class_bytes, jint class_bytes_count) {
+    StrHandle class_name_handle = str_arena_intern(patch_table->class_names, class_name, strnlen(class_name, PATH_MAX));
+    if (class_name_handle == 0) {
+        return false;
+    }
+
+    ClassPatch* patch = malloc(sizeof(ClassPatch) + class_bytes_count);
+    if (patch == NULL) {
+        return false;
+    }
+
+    patch->class_bytes_count = class_bytes_count;
+    memcpy(patch->class_bytes, class_bytes, class_bytes_count);
+
+    pthread_mutex_lock(&patch_table->mutex);
+
+    void* previous_patch = NULL;
+    bool stored = symbol_map_put(patch_table->patches, class_name_handle, patch, &previous_patch);
+    if (stored && previous_patch == NULL) {
+        atomic_fetch_add(&patch_table->patches_count, 1);
+    }
+
+    pthread_mutex_unlock(&patch_table->mutex);
+
+    if (!stored) {
+        free(patch);
+        return false;
+    }
+
+    free(previous_patch);
+
+    return true;
+}
+
+// called from 'ClassFileLoadHook' event handler, patched bytes are copied to memory allocated by jvmti,
+// so VM can release them once class is defined
+bool patch_table_apply(PatchTable* patch_table, jvmtiEnv* jvmti, const char* class_name,
+        jint* new_class_bytes_count, unsigned char** new_class_bytes) {
+    if (class_name == NULL || atomic_load(&patch_table->patches_count) == 0) {
+        return false;
+    }
+
+    // names which were never interned have no patches
+    StrHandle class_name_handle = str_arena_find(patch_table->class_names, class_name, strnlen(class_name, PATH_MAX));
+    if (class_name_handle == 0) {
+        return false;
+    }
+
+    bool applied = false;
+
+    pthread_mutex_lock(&patch_table->mutex);
+
+    const ClassPatch* patch = symbol_map_get(patch_table->patches, class_name_handle);
+    if (patch != NULL) {
+        unsigned char* class_bytes = NULL;
+        if ((*jvmti)->Allocate(jvmti, patch->class_bytes_count, &class_bytes) == JVMTI_ERROR_NONE) {
+            memcpy(class_bytes, patch->class_bytes, patch->class_bytes_count);
+
+            *new_class_bytes_count = patch->class_bytes_count;
+            *new_class_bytes = class_bytes;
+            applied = true;
+        }
+    }
+
+    pthread_mutex_unlock(&patch_table->mutex);
+
+    return applied;
+}
+
+size_t patch_table_count(PatchTable* patch_table) {
+    return atomic_load(&patch_table->patches_count);
+}
+
+static void free_patch(StrHandle class_name, void* patch, void* arg) {
+    free(patch);
+}
+
+// class file load hook should be disabled before table is freed
+void patch_table_free(PatchTable* patch_table) {
+    symbol_map_for_each(patch_table->patches, free_patch, NULL);
+    symbol_map_free(patch_table->patches);
+
+    pthread_mutex_destroy(&patch_table->mutex);
+
+    free(patch_table);
+}
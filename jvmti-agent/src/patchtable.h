@@ -0,0 +1,38 @@
+#ifndef _PATCHTABLE_H_
+#define _PATCHTABLE_H_
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "strarena.h"
+
+typedef struct {
+    jint class_bytes_count;
+    unsigned char class_bytes[];
+} ClassPatch;
+
+// latest class bytes delivered by the watcher per class name, applied when class is defined
+typedef struct {
+    StrArena* class_names;
+    SymbolMap* patches;
+    atomic_size_t patches_count;
+    // patch can be replaced while it is copied by class file load hook
+    pthread_mutex_t mutex;
+} PatchTable;
+
+PatchTable* patch_table_new(StrArena* class_names);
+
+bool patch_table_put(PatchTable* patch_table, const char* class_name, const unsigned char* class_bytes, jint class_bytes_count);
+
+bool patch_table_apply(PatchTable* patch_table, jvmtiEnv* jvmti, const char* class_name,
+        jint* new_class_bytes_count, unsigned char** new_class_bytes);
+
+size_t patch_table_count(PatchTable* patch_table);
+
+void patch_table_free(PatchTable* patch_table);
+
+#endif
@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/inotify.h>
+
+#include "classload.h"
+#include "shmring.h"
+#include "classread.h"
+
+// reload daemon, watches classes directory once per host and publishes changed classes to shared memory ring,
+// agents started with 'shm_ring=<name>' option redefine classes published to the ring, the daemon has to run
+// as the same user as the agents, or as the one agents are given with 'shm_ring_owner_uid=<uid>' option
+//
+// reloadd <classes dir> <ring name> [slots count] [slot size]
+
+#define DEFAULT_SLOTS_COUNT 64
+#define DEFAULT_SLOT_SIZE (256 * 1024)
+
+// compiler writes class files one by one, events arriving within this period go to the same batch
+#define BATCH_SETTLE_MS 50
+
+#define CLASS_FILE_MAGIC 0xCAFEBABE
+
+// class files of a batch are read into registered buffers of this size, larger files are read separately
+#define CLASS_FILE_BUFFER_SIZE (64 * 1024)
+
+static volatile sig_atomic_t running = 1;
+
+typedef struct {
+    char* file_names[DEFAULT_SLOTS_COUNT * 16];
+    size_t count;
+    size_t capacity;
+} ChangedFiles;
+
+static void handle_stop_signal(int signal) {
+    running = 0;
+}
+
+static void add_changed_file(ChangedFiles* changed_files, const char* file_name) {
+    size_t file_name_len = strlen(file_name);
+    if (file_name_len < 7 || strcmp(file_name + file_name_len - 6, ".class") != 0) {
+        return;
+    }
+
+    for (size_t file_idx = 0;file_idx < changed_files->count;file_idx++) {
+        if (strcmp(changed_files->file_names[file_idx], file_name) == 0) {
+            return;
+        }
+    }
+
+    if (changed_files->count < changed_files->capacity) {
+        changed_files->file_names[changed_files->count] = strdup(file_name);
+        if (changed_files->file_names[changed_files->count] != NULL) {
+            changed_files->count += 1;
+        }
+    }
+}
+
+// parsing class once per host, agents get class name along with bytes and don't parse it again
+static bool parse_class(const ClassFileRead* class_file, ShmRingClass* ring_class) {
+    if (class_file->error != 0) {
+        fprintf(stderr, "failed to read class file %s: %s\n", class_file->path, strerror(class_file->error));
+        return false;
+    }
+
+    const uint8_t* class_bytes = class_file->bytes;
+    uint32_t magic = class_file->bytes_count < 10 ? 0
+            : ((uint32_t)class_bytes[0] << 24) | (class_bytes[1] << 16) | (class_bytes[2] << 8) | class_bytes[3];
+
+    JClass* jclass = magic == CLASS_FILE_MAGIC ? jclass_load(class_bytes, class_file->bytes_count) : NULL;
+    if (jclass == NULL || jclass->name == NULL) {
+        fprintf(stderr, "invalid class file: %s\n", class_file->path);
+        if (jclass != NULL) {
+            jclass_free(jclass);
+        }
+
+        return false;
+    }
+
+    ring_class->class_name = strdup(jclass->name);
+    ring_class->class_bytes = class_bytes;
+    ring_class->class_bytes_count = class_file->bytes_count;
+
+    jclass_free(jclass);
+
+    return ring_class->class_name != NULL;
+}
+
+// class bytes stay in reader buffers until they are copied to the ring
+static void publish_changed_files(ShmRing* ring, ClassFileReader* class_file_reader, const char* classes_dir,
+        ChangedFiles* changed_files) {
+    ClassFileRead class_files[changed_files->count];
+    char* class_file_paths[changed_files->count];
+    size_t class_files_count = 0;
+
+    for (size_t file_idx = 0;file_idx < changed_files->count;file_idx++) {
+        if (asprintf(&class_file_paths[class_files_count], "%s/%s", classes_dir, changed_files->file_names[file_idx]) != -1) {
+            class_files[class_files_count].path = class_file_paths[class_files_count];
+            class_files_count += 1;
+        }
+
+        free(changed_files->file_names[file_idx]);
+    }
+
+    changed_files->count = 0;
+
+    class_file_reader_read(class_file_reader, class_files, class_files_count);
+
+    ShmRingClass ring_classes[class_files_count];
+    uint32_t classes_count = 0;
+
+    for (size_t file_idx = 0;file_idx < class_files_count;file_idx++) {
+        if (!parse_class(&class_files[file_idx], &ring_classes[classes_count])) {
+            continue;
+        }
+
+        // ring rejects the whole batch with an oversized class, so such class is left out alone
+        ShmRingClass* ring_class = &ring_classes[classes_count];
+        if (strlen(ring_class->class_name) + ring_class->class_bytes_count > ring->header->slot_size) {
+            fprintf(stderr, "class file %s doesn't fit the ring slot of %u bytes\n", class_files[file_idx].path,
+                    ring->header->slot_size);
+            free((char*)ring_class->class_name);
+            continue;
+        }
+
+        classes_count += 1;
+    }
+
+    if (classes_count > 0) {
+        uint64_t batch_id = shm_ring_publish(ring, ring_classes, classes_count);
+        if (batch_id == 0) {
+            fprintf(stderr, "failed to publish %u classes - batch doesn't fit the ring\n", classes_count);
+        } else {
+            printf("published batch %llu: %u classes\n", (unsigned long long)batch_id, classes_count);
+            fflush(stdout);
+        }
+    }
+
+    for (uint32_t class_idx = 0;class_idx < classes_count;class_idx++) {
+        free((char*)ring_classes[class_idx].class_name);
+    }
+
+    for (size_t file_idx = 0;file_idx < class_files_count;file_idx++) {
+        free(class_file_paths[file_idx]);
+    }
+}
+
+// reading all events already queued, inotify read returns as many events as fit the buffer,
+// full batch is published right away, so the rest of the events go to the next batch instead of being dropped
+static bool read_events(int inotify_fd, ChangedFiles* changed_files, ShmRing* ring, ClassFileReader* class_file_reader,
+        const char* classes_dir) {
+    char event_buf[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    ssize_t events_size = read(inotify_fd, event_buf, sizeof(event_buf));
+    if (events_size <= 0) {
+        return errno == EINTR;
+    }
+
+    for (char* event_pos = event_buf;event_pos < event_buf + events_size;) {
+        struct inotify_event* event = (struct inotify_event*)event_pos;
+        if (event->len > 0) {
+            if (changed_files->count == changed_files->capacity) {
+                publish_changed_files(ring, class_file_reader, classes_dir, changed_files);
+            }
+
+            add_changed_file(changed_files, event->name);
+        }
+
+        event_pos += sizeof(struct inotify_event) + event->len;
+    }
+
+    return true;
+}
+
+static uint32_t parse_uint_arg(const char* arg, uint32_t default_value) {
+    char* arg_end = NULL;
+    unsigned long value = strtoul(arg, &arg_end, 10);
+    if (arg_end == arg || *arg_end != '\0' || value == 0 || value > UINT32_MAX) {
+        return default_value;
+    }
+
+    return value;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <classes dir> <ring name> [slots count] [slot size]\n", argv[0]);
+        return 1;
+    }
+
+    const char* classes_dir = argv[1];
+    const char* ring_name = argv[2];
+    uint32_t slots_count = argc > 3 ? parse_uint_arg(argv[3], DEFAULT_SLOTS_COUNT) : DEFAULT_SLOTS_COUNT;
+    uint32_t slot_size = argc > 4 ? parse_uint_arg(argv[4], DEFAULT_SLOT_SIZE) : DEFAULT_SLOT_SIZE;
+
+    struct sigaction stop_action;
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+
+    int inotify_fd = inotify_init();
+    if (inotify_fd == -1 || inotify_add_watch(inotify_fd, classes_dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        fprintf(stderr, "failed to watch classes dir: %s\n", classes_dir);
+        return 1;
+    }
+
+    ShmRing* ring = shm_ring_create(ring_name, slots_count, slot_size);
+    if (ring == NULL) {
+        fprintf(stderr, "failed to create shared memory ring: %s\n", ring_name);
+        close(inotify_fd);
+        return 1;
+    }
+
+    ChangedFiles changed_files = { .count = 0, .capacity = slots_count < DEFAULT_SLOTS_COUNT * 16 ? slots_count : DEFAULT_SLOTS_COUNT * 16 };
+
+    ClassFileReader* class_file_reader = class_file_reader_new(changed_files.capacity, CLASS_FILE_BUFFER_SIZE);
+    if (class_file_reader == NULL) {
+        fprintf(stderr, "failed to create class file reader\n");
+        shm_ring_close(ring);
+        close(inotify_fd);
+        return 1;
+    }
+
+    printf("watching %s, publishing to %s - %u slots of %u bytes, io_uring reads: %s\n", classes_dir, ring_name,
+            slots_count, slot_size, class_file_reader_uses_io_uring(class_file_reader) ? "enabled" : "disabled");
+    fflush(stdout);
+
+    struct pollfd inotify_poll = { inotify_fd, POLLIN, 0 };
+    while (running) {
+        // waiting for the first event without timeout, then until events settle
+        int poll_status = poll(&inotify_poll, 1, changed_files.count == 0 ? -1 : BATCH_SETTLE_MS);
+        if (poll_status == -1 && errno != EINTR) {
+            fprintf(stderr, "failed to poll inotify descriptor\n");
+            break;
+        }
+
+        if (poll_status > 0) {
+            if (!read_events(inotify_fd, &changed_files, ring, class_file_reader, classes_dir)) {
+                fprintf(stderr, "failed to read inotify events\n");
+                break;
+            }
+
+            if (changed_files.count == changed_files.capacity) {
+                publish_changed_files(ring, class_file_reader, classes_dir, &changed_files);
+            }
+        } else if (poll_status == 0) {
+            publish_changed_files(ring, class_file_reader, classes_dir, &changed_files);
+        }
+    }
+
+    for (size_t file_idx = 0;file_idx < changed_files.count;file_idx++) {
+        free(changed_files.file_names[file_idx]);
+    }
+
+    class_file_reader_free(class_file_reader);
+    shm_ring_close(ring);
+    close(inotify_fd);
+
+    printf("reload daemon stopped\n");
+
+    return 0;
+}
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "agent.h"
+#include "reloadtrace.h"
+
+static uint64_t clock_time_ns(clockid_t clock_id) {
+    struct timespec now;
+    clock_gettime(clock_id, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void free_class_names(ReloadTrace* reload_trace) {
+    for (size_t class_idx = 0;class_idx < reload_trace->classes_count;class_idx++) {
+        free(reload_trace->class_names[class_idx]);
+    }
+
+    free(reload_trace->class_names);
+
+    reload_trace->class_names = NULL;
+    reload_trace->classes_count = 0;
+}
+
+// should be called while holding reload trace mutex
+static void close_window(ReloadTrace* reload_trace) {
+    atomic_store(&reload_trace->window_active, false);
+
+    ReloadRecord* record = &reload_trace->record;
+    record->methods_unloaded = atomic_load(&reload_trace->methods_unloaded);
+    record->methods_recompiled = atomic_load(&reload_trace->methods_recompiled);
+    record->gc_pauses = atomic_load(&reload_trace->gc_pauses);
+    record->gc_pause_ns = atomic_load(&reload_trace->gc_pause_ns);
+
+    uint64_t last_recompile_ns = atomic_load(&reload_trace->last_recompile_ns);
+    uint64_t redefine_end_ns = record->redefine_start_ns + record->redefine_duration_ns;
+    record->recompile_ns = last_recompile_ns > redefine_end_ns ? last_recompile_ns - redefine_end_ns : 0;
+
+    if (fwrite(record, sizeof(ReloadRecord), 1, reload_trace->file) < 1) {
+        log_debug("failed to write reload trace record");
+    }
+
+    fflush(reload_trace->file);
+
+    log_debug("reload traced - redefine: %llu ns, methods unloaded: %u, recompiled: %u in %llu ns, gc pauses: %u (%llu ns)",
+            (unsigned long long)record->redefine_duration_ns, record->methods_unloaded, record->methods_recompiled,
+            (unsigned long long)record->recompile_ns, record->gc_pauses, (unsigned long long)record->gc_pause_ns);
+
+    free_class_names(reload_trace);
+
+    reload_trace->window_open = false;
+}
+
+static void* reload_trace_activity(void* arg) {
+    ReloadTrace* reload_trace = arg;
+
+    pthread_mutex_lock(&reload_trace->mutex);
+
+    while (reload_trace->running) {
+        if (!reload_trace->window_open || reload_trace->window_end_ns == 0) {
+            pthread_cond_wait(&reload_trace->window_cond, &reload_trace->mutex);
+            continue;
+        }
+
+        uint64_t window_end_ns = reload_trace->window_end_ns;
+        if (clock_time_ns(CLOCK_MONOTONIC) >= window_end_ns) {
+            close_window(reload_trace);
+            continue;
+        }
+
+        struct timespec window_end = { window_end_ns / 1000000000ULL, window_end_ns % 1000000000ULL };
+        pthread_cond_timedwait(&reload_trace->window_cond, &reload_trace->mutex, &window_end);
+    }
+
+    if (reload_trace->window_open) {
+        close_window(reload_trace);
+    }
+
+    pthread_mutex_unlock(&reload_trace->mutex);
+
+    return NULL;
+}
+
+ReloadTrace* reload_trace_start(const char* file_path, uint64_t window_ms) {
+    ReloadTrace* reload_trace = calloc(1, sizeof(ReloadTrace));
+    if (reload_trace == NULL) {
+        return NULL;
+    }
+
+    reload_trace->file = fopen(file_path, "wb");
+    if (reload_trace->file == NULL) {
+        free(reload_trace);
+        return NULL;
+    }
+
+    ReloadTraceHeader header;
+    memset(&header, 0, sizeof(ReloadTraceHeader));
+    memcpy(header.magic, RELOAD_TRACE_MAGIC, sizeof(header.magic));
+    header.version = RELOAD_TRACE_VERSION;
+    header.record_size = sizeof(ReloadRecord);
+    header.monotonic_base_ns = clock_time_ns(CLOCK_MONOTONIC);
+    header.realtime_base_ns = clock_time_ns(CLOCK_REALTIME);
+
+    if (fwrite(&header, sizeof(ReloadTraceHeader), 1, reload_trace->file) < 1) {
+        fclose(reload_trace->file);
+        free(reload_trace);
+        return NULL;
+    }
+
+    reload_trace->window_ns = window_ms * 1000000ULL;
+    reload_trace->running = true;
+
+    pthread_mutex_init(&reload_trace->mutex, NULL);
+
+    pthread_condattr_t window_cond_attr;
+    pthread_condattr_init(&window_cond_attr);
+    pthread_condattr_setclock(&window_cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&reload_trace->window_cond, &window_cond_attr);
+    pthread_condattr_destroy(&window_cond_attr);
+
+    int thread_create_status = pthread_create(&reload_trace->flush_thread, NULL, reload_trace_activity, reload_trace);
+    if (thread_create_status != 0) {
+        pthread_cond_destroy(&reload_trace->window_cond);
+        pthread_mutex_destroy(&reload_trace->mutex);
+        fclose(reload_trace->file);
+        free(reload_trace);
+        return NULL;
+    }
+
+    return reload_trace;
+}
+
+// opening record right before 'RedefineClasses' call, record of the previous reload is written out first
+void reload_trace_begin(ReloadTrace* reload_trace, const char* const* class_names, size_t classes_count) {
+    pthread_mutex_lock(&reload_trace->mutex);
+
+    if (reload_trace->window_open) {
+        close_window(reload_trace);
+    }
+
+    reload_trace->class_names = calloc(classes_count, sizeof(char*));
+    if (reload_trace->class_names != NULL) {
+        for (size_t class_idx = 0;class_idx < classes_count;class_idx++) {
+            reload_trace->class_names[class_idx] = strdup(class_names[class_idx]);
+        }
+
+        reload_trace->classes_count = classes_count;
+    }
+
+    memset(&reload_trace->record, 0, sizeof(ReloadRecord));
+    reload_trace->record.classes_count = classes_count;
+
+    atomic_store(&reload_trace->methods_unloaded, 0);
+    atomic_store(&reload_trace->methods_recompiled, 0);
+    atomic_store(&reload_trace->gc_pauses, 0);
+    atomic_store(&reload_trace->gc_pause_ns, 0);
+    atomic_store(&reload_trace->last_recompile_ns, 0);
+
+    reload_trace->window_open = true;
+    reload_trace->window_end_ns = 0;
+    reload_trace->record.redefine_start_ns = clock_time_ns(CLOCK_MONOTONIC);
+
+    atomic_store(&reload_trace->redefine_start_ns, reload_trace->record.redefine_start_ns);
+    atomic_store(&reload_trace->window_active, true);
+
+    pthread_mutex_unlock(&reload_trace->mutex);
+}
+
+// starting observation window right after 'RedefineClasses' returned
+void reload_trace_end(ReloadTrace* reload_trace, jvmtiError redefine_error) {
+    uint64_t redefine_end_ns = clock_time_ns(CLOCK_MONOTONIC);
+
+    pthread_mutex_lock(&reload_trace->mutex);
+
+    if (reload_trace->window_open) {
+        reload_trace->record.redefine_duration_ns = redefine_end_ns - reload_trace->record.redefine_start_ns;
+        reload_trace->record.redefine_error = redefine_error;
+        reload_trace->window_end_ns = redefine_end_ns + reload_trace->window_ns;
+
+        pthread_cond_signal(&reload_trace->window_cond);
+    }
+
+    pthread_mutex_unlock(&reload_trace->mutex);
+}
+
+// GC callbacks are not allowed to block, so pause accounting is done with atomics only
+void reload_trace_gc_start(ReloadTrace* reload_trace) {
+    atomic_store(&reload_trace->gc_start_ns, clock_time_ns(CLOCK_MONOTONIC));
+}
+
+void reload_trace_gc_finish(ReloadTrace* reload_trace) {
+    uint64_t gc_start_ns = atomic_exchange(&reload_trace->gc_start_ns, 0);
+    if (gc_start_ns == 0 || !atomic_load(&reload_trace->window_active)) {
+        return;
+    }
+
+    // pause started before redefinition is accounted from redefinition start only
+    uint64_t redefine_start_ns = atomic_load(&reload_trace->redefine_start_ns);
+    uint64_t overlap_start_ns = gc_start_ns > redefine_start_ns ? gc_start_ns : redefine_start_ns;
+    uint64_t gc_finish_ns = clock_time_ns(CLOCK_MONOTONIC);
+
+    if (gc_finish_ns > overlap_start_ns) {
+        atomic_fetch_add(&reload_trace->gc_pauses, 1);
+        atomic_fetch_add(&reload_trace->gc_pause_ns, gc_finish_ns - overlap_start_ns);
+    }
+}
+
+// redefined classes are passed in internal form, so "Lcom/acme/Service;" signature matches "com/acme/Service"
+static bool is_redefined_class(ReloadTrace* reload_trace, const char* class_signature) {
+    if (class_signature[0] != 'L') {
+        return false;
+    }
+
+    for (size_t class_idx = 0;class_idx < reload_trace->classes_count;class_idx++) {
+        const char* class_name = reload_trace->class_names[class_idx];
+        if (class_name == NULL) {
+            continue;
+        }
+
+        size_t class_name_len = strlen(class_name);
+        if (strncmp(class_name, class_signature + 1, class_name_len) == 0
+                && strcmp(class_signature + 1 + class_name_len, ";") == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// counting methods of redefined classes compiled again while window is open
+void reload_trace_method_load(ReloadTrace* reload_trace, jvmtiEnv* jvmti, jmethodID method) {
+    if (!atomic_load(&reload_trace->window_active)) {
+        return;
+    }
+
+    jclass declaring_class = NULL;
+    if ((*jvmti)->GetMethodDeclaringClass(jvmti, method, &declaring_class) != JVMTI_ERROR_NONE) {
+        return;
+    }
+
+    char* class_signature = NULL;
+    if ((*jvmti)->GetClassSignature(jvmti, declaring_class, &class_signature, NULL) != JVMTI_ERROR_NONE) {
+        return;
+    }
+
+    pthread_mutex_lock(&reload_trace->mutex);
+
+    if (reload_trace->window_open && is_redefined_class(reload_trace, class_signature)) {
+        atomic_fetch_add(&reload_trace->methods_recompiled, 1);
+        atomic_store(&reload_trace->last_recompile_ns, clock_time_ns(CLOCK_MONOTONIC));
+    }
+
+    pthread_mutex_unlock(&reload_trace->mutex);
+
+    (*jvmti)->Deallocate(jvmti, (unsigned char*)class_signature);
+}
+
+// compiled code of any method flushed while window is open is attributed to the reload,
+// deoptimized code of redefined methods is flushed lazily, so window should be long enough
+void reload_trace_method_unload(ReloadTrace* reload_trace) {
+    if (atomic_load(&reload_trace->window_active)) {
+        atomic_fetch_add(&reload_trace->methods_unloaded, 1);
+    }
+}
+
+// events should be disabled before trace is stopped, open record is written out
+void reload_trace_stop(ReloadTrace* reload_trace) {
+    pthread_mutex_lock(&reload_trace->mutex);
+
+    reload_trace->running = false;
+    pthread_cond_signal(&reload_trace->window_cond);
+
+    pthread_mutex_unlock(&reload_trace->mutex);
+
+    pthread_join(reload_trace->flush_thread, NULL);
+
+    fclose(reload_trace->file);
+
+    pthread_cond_destroy(&reload_trace->window_cond);
+    pthread_mutex_destroy(&reload_trace->mutex);
+
+    free(reload_trace);
+}
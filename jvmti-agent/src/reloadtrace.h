@@ -0,0 +1,73 @@
+#ifndef _RELOADTRACE_H_
+#define _RELOADTRACE_H_
+
+#include <jvmti.h>
+
+#define RELOAD_TRACE_MAGIC "JVMTRELD"
+#define RELOAD_TRACE_VERSION 1
+
+// trace file starts with header followed by fixed size records,
+// all timestamps are CLOCK_MONOTONIC nanoseconds, values are in host byte order
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t monotonic_base_ns;
+    uint64_t realtime_base_ns;
+} ReloadTraceHeader;
+
+typedef struct {
+    uint64_t redefine_start_ns;
+    uint64_t redefine_duration_ns;
+    // time from redefinition end until last recompiled method of redefined classes
+    uint64_t recompile_ns;
+    // part of GC pauses overlapping redefinition and the observation window after it
+    uint64_t gc_pause_ns;
+    uint32_t classes_count;
+    uint32_t methods_unloaded;
+    uint32_t methods_recompiled;
+    uint32_t gc_pauses;
+    int32_t redefine_error;
+    uint32_t reserved;
+} ReloadRecord;
+
+typedef struct {
+    FILE* file;
+    uint64_t window_ns;
+    pthread_mutex_t mutex;
+    pthread_cond_t window_cond;
+    pthread_t flush_thread;
+    bool running;
+    bool window_open;
+    uint64_t window_end_ns;
+    ReloadRecord record;
+    char** class_names;
+    size_t classes_count;
+    atomic_bool window_active;
+    atomic_uint methods_unloaded;
+    atomic_uint methods_recompiled;
+    atomic_uint gc_pauses;
+    atomic_uint_fast64_t gc_pause_ns;
+    atomic_uint_fast64_t gc_start_ns;
+    // copy of record start read by GC callbacks, which can't take the mutex
+    atomic_uint_fast64_t redefine_start_ns;
+    atomic_uint_fast64_t last_recompile_ns;
+} ReloadTrace;
+
+ReloadTrace* reload_trace_start(const char* file_path, uint64_t window_ms);
+
+void reload_trace_begin(ReloadTrace* reload_trace, const char* const* class_names, size_t classes_count);
+
+void reload_trace_end(ReloadTrace* reload_trace, jvmtiError redefine_error);
+
+void reload_trace_gc_start(ReloadTrace* reload_trace);
+
+void reload_trace_gc_finish(ReloadTrace* reload_trace);
+
+void reload_trace_method_load(ReloadTrace* reload_trace, jvmtiEnv* jvmti, jmethodID method);
+
+void reload_trace_method_unload(ReloadTrace* reload_trace);
+
+void reload_trace_stop(ReloadTrace* reload_trace);
+
+#endif
@@ -0,0 +1,371 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shmring.h"
+
+// "JVMTRING"
+#define SHM_RING_MAGIC 0x4A564D5452494E47ULL
+
+#define CACHE_LINE_SIZE 64
+
+static size_t align_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+static size_t header_size(void) {
+    return align_up(sizeof(ShmRingHeader), CACHE_LINE_SIZE);
+}
+
+static ShmRingSlot* ring_slot(const ShmRing* ring, uint64_t seq) {
+    size_t slot_idx = seq % ring->header->slots_count;
+
+    return (ShmRingSlot*)((uint8_t*)ring->header + header_size() + slot_idx * ring->header->slot_stride);
+}
+
+// futex word lives in shared mapping, so futex operations can't be process private
+static long futex(atomic_uint* futex_word, int op, unsigned int value, const struct timespec* timeout) {
+    return syscall(SYS_futex, futex_word, op, value, timeout, NULL, 0);
+}
+
+static void shm_ring_free(ShmRing* ring) {
+    if (ring->header != NULL) {
+        munmap(ring->header, ring->size);
+    }
+
+    if (ring->fd != -1) {
+        close(ring->fd);
+    }
+
+    free(ring->name);
+    free(ring);
+}
+
+static ShmRing* shm_ring_alloc(const char* name) {
+    ShmRing* ring = calloc(1, sizeof(ShmRing));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->fd = -1;
+    ring->name = strdup(name);
+    if (ring->name == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+// creating ring for writing, name is POSIX shared memory object name, e.g. "/jvmti-reload"
+ShmRing* shm_ring_create(const char* name, uint32_t slots_count, uint32_t slot_size) {
+    if (slots_count == 0 || slot_size == 0) {
+        return NULL;
+    }
+
+    ShmRing* ring = shm_ring_alloc(name);
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->writer = true;
+
+    // stale ring of previous daemon run is replaced, its consumers have to reattach
+    shm_unlink(name);
+
+    // class bytes are readable by daemon group at most, consumers of other users can't read them
+    ring->fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0640);
+    if (ring->fd == -1) {
+        shm_ring_free(ring);
+        return NULL;
+    }
+
+    uint32_t slot_stride = align_up(sizeof(ShmRingSlot) + slot_size, CACHE_LINE_SIZE);
+    ring->size = header_size() + (size_t)slots_count * slot_stride;
+
+    if (ftruncate(ring->fd, ring->size) == -1) {
+        shm_unlink(name);
+        shm_ring_free(ring);
+        return NULL;
+    }
+
+    ring->header = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (ring->header == MAP_FAILED) {
+        ring->header = NULL;
+        shm_unlink(name);
+        shm_ring_free(ring);
+        return NULL;
+    }
+
+    ring->header->version = SHM_RING_VERSION;
+    ring->header->slots_count = slots_count;
+    ring->header->slot_size = slot_size;
+    ring->header->slot_stride = slot_stride;
+    atomic_store(&ring->header->futex_word, 0);
+    atomic_store(&ring->header->head, 0);
+
+    // consumers validate magic, so it's published last
+    atomic_thread_fence(memory_order_release);
+    ring->header->magic = SHM_RING_MAGIC;
+
+    ring->next_batch_id = 1;
+
+    return ring;
+}
+
+// opening existing ring for reading
+ShmRing* shm_ring_open(const char* name, uid_t owner_uid) {
+    ShmRing* ring = shm_ring_alloc(name);
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->fd = shm_open(name, O_RDONLY, 0);
+    if (ring->fd == -1) {
+        shm_ring_free(ring);
+        return NULL;
+    }
+
+    struct stat ring_stat;
+    if (fstat(ring->fd, &ring_stat) == -1 || (size_t)ring_stat.st_size < header_size()) {
+        shm_ring_free(ring);
+        return NULL;
+    }
+
+    // any local user can create an object of the same name in /dev/shm, classes of such ring aren't redefined
+    if (ring_stat.st_uid != owner_uid || (ring_stat.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        shm_ring_free(ring);
+        errno = EPERM;
+        return NULL;
+    }
+
+    ring->size = ring_stat.st_size;
+    ring->device = ring_stat.st_dev;
+    ring->inode = ring_stat.st_ino;
+
+    ring->header = mmap(NULL, ring->size, PROT_READ, MAP_SHARED, ring->fd, 0);
+    if (ring->header == MAP_FAILED) {
+        ring->header = NULL;
+        shm_ring_free(ring);
+        return NULL;
+    }
+
+    const ShmRingHeader* header = ring->header;
+    if (header->magic != SHM_RING_MAGIC || header->version != SHM_RING_VERSION || header->slots_count == 0
+            || header_size() + (size_t)header->slots_count * header->slot_stride > ring->size) {
+        shm_ring_free(ring);
+        return NULL;
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+
+    return ring;
+}
+
+uint64_t shm_ring_head(const ShmRing* ring) {
+    return atomic_load_explicit(&ring->header->head, memory_order_acquire);
+}
+
+// publishing classes as a single batch, consumers see either the whole batch or nothing,
+// returns batch id or 0 when batch doesn't fit the ring
+uint64_t shm_ring_publish(ShmRing* ring, const ShmRingClass* classes, uint32_t classes_count) {
+    ShmRingHeader* header = ring->header;
+    if (!ring->writer || classes_count == 0 || classes_count > header->slots_count) {
+        return 0;
+    }
+
+    for (uint32_t class_idx = 0;class_idx < classes_count;class_idx++) {
+        if (strlen(classes[class_idx].class_name) + classes[class_idx].class_bytes_count > header->slot_size) {
+            return 0;
+        }
+    }
+
+    uint64_t batch_id = ring->next_batch_id++;
+    uint64_t head = atomic_load_explicit(&header->head, memory_order_relaxed);
+
+    for (uint32_t class_idx = 0;class_idx < classes_count;class_idx++) {
+        const ShmRingClass* ring_class = &classes[class_idx];
+        uint64_t seq = head + class_idx;
+
+        ShmRingSlot* slot = ring_slot(ring, seq);
+
+        atomic_store_explicit(&slot->seq, 2 * seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        size_t class_name_length = strlen(ring_class->class_name);
+
+        slot->batch_id = batch_id;
+        slot->batch_index = class_idx;
+        slot->batch_size = classes_count;
+        slot->class_name_length = class_name_length;
+        slot->class_bytes_count = ring_class->class_bytes_count;
+        memcpy(slot->data, ring_class->class_name, class_name_length);
+        memcpy(slot->data + class_name_length, ring_class->class_bytes, ring_class->class_bytes_count);
+
+        atomic_store_explicit(&slot->seq, 2 * seq + 2, memory_order_release);
+    }
+
+    atomic_store_explicit(&header->head, head + classes_count, memory_order_release);
+
+    atomic_fetch_add(&header->futex_word, 1);
+    futex(&header->futex_word, FUTEX_WAKE, INT_MAX, NULL);
+
+    return batch_id;
+}
+
+static bool batch_add_class(ShmRingBatch* batch, size_t* data_size, const uint8_t* slot_data,
+        uint32_t class_name_length, uint32_t class_bytes_count) {
+    ShmRingClass* new_classes = realloc(batch->classes, (batch->classes_count + 1) * sizeof(ShmRingClass));
+    if (new_classes == NULL) {
+        return false;
+    }
+
+    batch->classes = new_classes;
+
+    // class name is null terminated in consumer copy
+    size_t class_data_size = class_name_length + 1 + class_bytes_count;
+    uint8_t* new_data = realloc(batch->data, *data_size + class_data_size);
+    if (new_data == NULL) {
+        return false;
+    }
+
+    // class pointers are fixed up once all slots are copied, data buffer may move until then
+    batch->data = new_data;
+    memcpy(batch->data + *data_size, slot_data, class_name_length);
+    batch->data[*data_size + class_name_length] = '\0';
+    memcpy(batch->data + *data_size + class_name_length + 1, slot_data + class_name_length, class_bytes_count);
+
+    ShmRingClass* ring_class = &batch->classes[batch->classes_count];
+    ring_class->class_name = (const char*)(uintptr_t)*data_size;
+    ring_class->class_bytes = (const uint8_t*)(uintptr_t)(*data_size + class_name_length + 1);
+    ring_class->class_bytes_count = class_bytes_count;
+
+    batch->classes_count += 1;
+    *data_size += class_data_size;
+
+    return true;
+}
+
+// copying slot under seqlock, false is returned when producer has overwritten the slot meanwhile
+static bool read_slot(const ShmRing* ring, uint64_t seq, ShmRingBatch* batch, size_t* data_size, uint32_t* batch_size) {
+    ShmRingSlot* slot = ring_slot(ring, seq);
+
+    uint64_t slot_seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (slot_seq != 2 * seq + 2) {
+        return false;
+    }
+
+    uint64_t batch_id = slot->batch_id;
+    uint32_t class_name_length = slot->class_name_length;
+    uint32_t class_bytes_count = slot->class_bytes_count;
+    *batch_size = slot->batch_size;
+
+    if ((size_t)class_name_length + class_bytes_count > ring->header->slot_size) {
+        return false;
+    }
+
+    if (!batch_add_class(batch, data_size, slot->data, class_name_length, class_bytes_count)) {
+        return false;
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != slot_seq) {
+        batch->classes_count -= 1;
+        return false;
+    }
+
+    batch->batch_id = batch_id;
+
+    return true;
+}
+
+// restarted writer unlinks the ring and creates a new one under the same name, consumer waiting on
+// the old mapping would never be woken up again, so the name is checked whenever wait times out
+static ShmRingStatus wait_timeout_status(const ShmRing* ring) {
+    int fd = shm_open(ring->name, O_RDONLY, 0);
+    if (fd == -1) {
+        return ShmRingError;
+    }
+
+    struct stat ring_stat;
+    bool replaced = fstat(fd, &ring_stat) == -1 || (uint64_t)ring_stat.st_dev != ring->device
+            || (uint64_t)ring_stat.st_ino != ring->inode;
+
+    close(fd);
+
+    return replaced ? ShmRingError : ShmRingTimeout;
+}
+
+// waiting for the batch following cursor, cursor is advanced past returned or lost batches
+ShmRingStatus shm_ring_wait_batch(ShmRing* ring, uint64_t* cursor, int timeout_ms, ShmRingBatch* batch) {
+    ShmRingHeader* header = ring->header;
+
+    memset(batch, 0, sizeof(ShmRingBatch));
+
+    unsigned int futex_value = atomic_load(&header->futex_word);
+    uint64_t head = shm_ring_head(ring);
+    if (head == *cursor) {
+        struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+        if (futex(&header->futex_word, FUTEX_WAIT, futex_value, &timeout) == -1 && errno != EAGAIN && errno != EINTR) {
+            return errno == ETIMEDOUT ? wait_timeout_status(ring) : ShmRingError;
+        }
+
+        head = shm_ring_head(ring);
+        if (head == *cursor) {
+            return wait_timeout_status(ring);
+        }
+    }
+
+    if (head - *cursor > header->slots_count) {
+        *cursor = head;
+        return ShmRingOverrun;
+    }
+
+    size_t data_size = 0;
+    uint32_t batch_size = 1;
+    for (uint32_t batch_index = 0;batch_index < batch_size;batch_index++) {
+        if (!read_slot(ring, *cursor + batch_index, batch, &data_size, &batch_size)) {
+            shm_ring_batch_free(batch);
+            *cursor = shm_ring_head(ring);
+            return ShmRingOverrun;
+        }
+    }
+
+    *cursor += batch_size;
+
+    for (uint32_t class_idx = 0;class_idx < batch->classes_count;class_idx++) {
+        ShmRingClass* ring_class = &batch->classes[class_idx];
+        ring_class->class_name = (const char*)(batch->data + (uintptr_t)ring_class->class_name);
+        ring_class->class_bytes = batch->data + (uintptr_t)ring_class->class_bytes;
+    }
+
+    return ShmRingBatchReady;
+}
+
+void shm_ring_batch_free(ShmRingBatch* batch) {
+    free(batch->classes);
+    free(batch->data);
+
+    memset(batch, 0, sizeof(ShmRingBatch));
+}
+
+// ring created by writer is unlinked, consumers keep their mappings until they close the ring
+void shm_ring_close(ShmRing* ring) {
+    if (ring->writer) {
+        shm_unlink(ring->name);
+    }
+
+    shm_ring_free(ring);
+}
@@ -0,0 +1,89 @@
+#ifndef _SHMRING_H_
+#define _SHMRING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include <sys/types.h>
+
+#define SHM_RING_VERSION 1
+
+// ring is laid out as header followed by fixed size slots, every slot holds a single class
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slots_count;
+    uint32_t slot_size;
+    uint32_t slot_stride;
+    // bumped on every published batch, consumers wait on it with futex
+    atomic_uint futex_word;
+    uint32_t padding;
+    // sequence number of the next slot to publish, advanced once the whole batch is written
+    atomic_uint_fast64_t head;
+} ShmRingHeader;
+
+typedef struct {
+    // seqlock, odd while slot is written, 2 * (slot sequence number + 1) once written
+    atomic_uint_fast64_t seq;
+    uint64_t batch_id;
+    uint32_t batch_index;
+    uint32_t batch_size;
+    uint32_t class_name_length;
+    uint32_t class_bytes_count;
+    // class name followed by class bytes
+    uint8_t data[];
+} ShmRingSlot;
+
+typedef struct {
+    char* name;
+    int fd;
+    bool writer;
+    size_t size;
+    ShmRingHeader* header;
+    uint64_t next_batch_id;
+    // identity of the mapped ring, consumer compares it with the ring currently behind the name
+    uint64_t device;
+    uint64_t inode;
+} ShmRing;
+
+typedef struct {
+    const char* class_name;
+    const uint8_t* class_bytes;
+    uint32_t class_bytes_count;
+} ShmRingClass;
+
+// consumer copy of published batch
+typedef struct {
+    uint64_t batch_id;
+    uint32_t classes_count;
+    ShmRingClass* classes;
+    uint8_t* data;
+} ShmRingBatch;
+
+typedef enum {
+    ShmRingBatchReady,
+    ShmRingTimeout,
+    // consumer fell behind a whole ring, batches were lost
+    ShmRingOverrun,
+    // also returned once writer removed or replaced the ring, consumer should open it again
+    ShmRingError
+} ShmRingStatus;
+
+ShmRing* shm_ring_create(const char* name, uint32_t slots_count, uint32_t slot_size);
+
+// ring is trusted only if it's owned by owner_uid and isn't writable by group or others,
+// NULL is returned with errno set to EPERM otherwise
+ShmRing* shm_ring_open(const char* name, uid_t owner_uid);
+
+uint64_t shm_ring_head(const ShmRing* ring);
+
+uint64_t shm_ring_publish(ShmRing* ring, const ShmRingClass* classes, uint32_t classes_count);
+
+ShmRingStatus shm_ring_wait_batch(ShmRing* ring, uint64_t* cursor, int timeout_ms, ShmRingBatch* batch);
+
+void shm_ring_batch_free(ShmRingBatch* batch);
+
+void shm_ring_close(ShmRing* ring);
+
+#endif
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "hashmap.h"
+#include "stacktable.h"
+
+// collapsed stacks longer than this are truncated at the leaf side
+#define STACK_KEY_MAX_LENGTH 8192
+
+// enough for "%p" formatted jmethodID
+#define METHOD_KEY_MAX_LENGTH 32
+
+static const char* const UNKNOWN_METHOD_NAME = "[unknown]";
+
+StackTable* stack_table_new(JavaVM* jvm) {
+    StackTable* stack_table = malloc(sizeof(StackTable));
+    if (stack_table == NULL) {
+        return NULL;
+    }
+
+    stack_table->jvm = jvm;
+
+    stack_table->method_names = hash_map_new(1024, NULL);
+    if (stack_table->method_names == NULL) {
+        free(stack_table);
+        return NULL;
+    }
+
+    stack_table->sites = hash_map_new(1024, NULL);
+    if (stack_table->sites == NULL) {
+        hash_map_free(stack_table->method_names);
+        free(stack_table);
+        return NULL;
+    }
+
+    pthread_mutex_init(&stack_table->mutex, NULL);
+
+    return stack_table;
+}
+
+// converting class signature and method name to 'com/acme/Service.get' frame name,
+// returned name should be freed by client
+static char* method_frame_name(JavaVM* jvm, jvmtiEnv* jvmti, jmethodID method) {
+    char* method_name = NULL;
+    jvmtiError error = (*jvmti)->GetMethodName(jvmti, method, &method_name, NULL, NULL);
+    if (error != JVMTI_ERROR_NONE) {
+        return NULL;
+    }
+
+    char* class_signature = NULL;
+    jclass declaring_class = NULL;
+    error = (*jvmti)->GetMethodDeclaringClass(jvmti, method, &declaring_class);
+    if (error == JVMTI_ERROR_NONE) {
+        error = (*jvmti)->GetClassSignature(jvmti, declaring_class, &class_signature, NULL);
+
+        // profiler threads are attached, but they don't return to Java to free local refs
+        JNIEnv* jni = NULL;
+        if ((*jvm)->GetEnv(jvm, (void**)&jni, JNI_VERSION_1_6) == JNI_OK) {
+            (*jni)->DeleteLocalRef(jni, declaring_class);
+        }
+    }
+
+    char* frame_name = NULL;
+    if (error == JVMTI_ERROR_NONE) {
+        // skipping leading 'L' and trailing ';' of the class signature
+        size_t class_name_len = strlen(class_signature);
+        if (class_signature[0] == 'L' && class_name_len >= 2) {
+            class_name_len -= 2;
+        }
+
+        size_t frame_name_size = class_name_len + 1 + strlen(method_name) + 1;
+        frame_name = malloc(frame_name_size);
+        if (frame_name != NULL) {
+            const char* class_name = class_signature[0] == 'L' ? class_signature + 1 : class_signature;
+            snprintf(frame_name, frame_name_size, "%.*s.%s", (int)class_name_len, class_name, method_name);
+        }
+
+        (*jvmti)->Deallocate(jvmti, (unsigned char*)class_signature);
+    }
+
+    (*jvmti)->Deallocate(jvmti, (unsigned char*)method_name);
+
+    return frame_name;
+}
+
+// method names are resolved once and cached by method id, resolution failures are not cached
+static const char* stack_table_method_name(StackTable* stack_table, jvmtiEnv* jvmti, jmethodID method) {
+    char method_key[METHOD_KEY_MAX_LENGTH];
+    snprintf(method_key, sizeof(method_key), "%p", (void*)method);
+
+    const char* cached_name = hash_map_get(stack_table->method_names, method_key);
+    if (cached_name != NULL) {
+        return cached_name;
+    }
+
+    char* frame_name = method_frame_name(stack_table->jvm, jvmti, method);
+    if (frame_name == NULL) {
+        return UNKNOWN_METHOD_NAME;
+    }
+
+    if (!hash_map_put(stack_table->method_names, method_key, frame_name)) {
+        free(frame_name);
+        return UNKNOWN_METHOD_NAME;
+    }
+
+    return frame_name;
+}
+
+// copying cached frame name of the method, e.g. for reports written outside of the table
+void stack_table_frame_name(StackTable* stack_table, jvmtiEnv* jvmti, jmethodID method, char* buf, size_t size) {
+    pthread_mutex_lock(&stack_table->mutex);
+
+    snprintf(buf, size, "%s", stack_table_method_name(stack_table, jvmti, method));
+
+    pthread_mutex_unlock(&stack_table->mutex);
+}
+
+static const char* primitive_type_name(char type) {
+    switch (type) {
+        case 'B': return "byte";
+        case 'C': return "char";
+        case 'D': return "double";
+        case 'F': return "float";
+        case 'I': return "int";
+        case 'J': return "long";
+        case 'S': return "short";
+        case 'Z': return "boolean";
+    }
+
+    return NULL;
+}
+
+// class signature can't be used as a frame as is, since ';' separates frames,
+// e.g. "Ljava/lang/String;" becomes "java/lang/String" and "[[I" becomes "int[][]"
+void stack_table_class_name(const char* class_signature, char* buf, size_t size) {
+    size_t dimensions = 0;
+    while (class_signature[dimensions] == '[') {
+        dimensions += 1;
+    }
+
+    const char* element_signature = class_signature + dimensions;
+    size_t element_signature_len = strlen(element_signature);
+    const char* primitive_name = element_signature_len == 1 ? primitive_type_name(element_signature[0]) : NULL;
+
+    int name_len = 0;
+    if (element_signature[0] == 'L' && element_signature_len > 2 && element_signature[element_signature_len - 1] == ';') {
+        name_len = snprintf(buf, size, "%.*s", (int)(element_signature_len - 2), element_signature + 1);
+    } else {
+        name_len = snprintf(buf, size, "%s", primitive_name != NULL ? primitive_name : element_signature);
+    }
+
+    for (size_t dimension = 0;dimension < dimensions && name_len >= 0 && (size_t)name_len + 2 < size;dimension++) {
+        name_len += snprintf(buf + name_len, size - name_len, "[]");
+    }
+}
+
+static size_t histogram_bucket(uint64_t weight) {
+    size_t bucket = weight == 0 ? 0 : 64 - __builtin_clzll(weight);
+
+    return bucket < STACK_SITE_HISTOGRAM_BUCKETS ? bucket : STACK_SITE_HISTOGRAM_BUCKETS - 1;
+}
+
+// methods go from the top frame to the bottom one, optional leaf name is appended to the collapsed stack,
+// returned site may be updated by client while holding stack table mutex
+StackSite* stack_table_add(StackTable* stack_table, jvmtiEnv* jvmti, const jmethodID* methods, jint method_count,
+        const char* leaf_name, uint64_t weight) {
+    char stack_key[STACK_KEY_MAX_LENGTH];
+    size_t stack_key_len = 0;
+
+    pthread_mutex_lock(&stack_table->mutex);
+
+    // collapsed stack goes from root frame to leaf frame, frames are separated by ';', leaf name comes last
+    for (jint method_idx = method_count - 1;method_idx >= -1;method_idx--) {
+        const char* frame_name = NULL;
+        if (method_idx == -1) {
+            frame_name = leaf_name;
+        } else {
+            frame_name = stack_table_method_name(stack_table, jvmti, methods[method_idx]);
+        }
+
+        if (frame_name == NULL) {
+            continue;
+        }
+
+        int frame_len = snprintf(stack_key + stack_key_len, sizeof(stack_key) - stack_key_len,
+                stack_key_len == 0 ? "%s" : ";%s", frame_name);
+        if (frame_len < 0 || stack_key_len + frame_len >= sizeof(stack_key)) {
+            // dropping partially written frame
+            stack_key[stack_key_len] = '\0';
+            break;
+        }
+
+        stack_key_len += frame_len;
+    }
+
+    if (stack_key_len == 0) {
+        strcpy(stack_key, UNKNOWN_METHOD_NAME);
+    }
+
+    StackSite* site = hash_map_get(stack_table->sites, stack_key);
+    if (site == NULL) {
+        site = calloc(1, sizeof(StackSite));
+        if (site != NULL && !hash_map_put(stack_table->sites, stack_key, site)) {
+            free(site);
+            site = NULL;
+        }
+    }
+
+    if (site != NULL) {
+        site->count += 1;
+        site->total += weight;
+        site->histogram[histogram_bucket(weight)] += 1;
+    }
+
+    pthread_mutex_unlock(&stack_table->mutex);
+
+    return site;
+}
+
+typedef struct {
+    FILE* file;
+    StackSiteValue site_value;
+} SiteWriter;
+
+static void write_site(const char* stack_key, void* value, void* arg) {
+    SiteWriter* site_writer = arg;
+    StackSite* site = value;
+
+    uint64_t site_value = site_writer->site_value == StackSiteLiveTotal ? site->live_total : site->total;
+    if (site_value > 0) {
+        fprintf(site_writer->file, "%s %llu\n", stack_key, (unsigned long long)site_value);
+    }
+}
+
+// writing stacks in collapsed format accepted by flamegraph.pl
+bool stack_table_dump(StackTable* stack_table, const char* file_path, StackSiteValue site_value) {
+    FILE* file = fopen(file_path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    SiteWriter site_writer = { file, site_value };
+
+    pthread_mutex_lock(&stack_table->mutex);
+
+    hash_map_for_each(stack_table->sites, write_site, &site_writer);
+
+    pthread_mutex_unlock(&stack_table->mutex);
+
+    return fclose(file) == 0;
+}
+
+static void write_site_histogram(const char* stack_key, void* value, void* file) {
+    StackSite* site = value;
+
+    fprintf(file, "%llu\t%llu\t", (unsigned long long)site->count, (unsigned long long)site->total);
+
+    // trailing empty buckets are omitted
+    size_t buckets_count = STACK_SITE_HISTOGRAM_BUCKETS;
+    while (buckets_count > 0 && site->histogram[buckets_count - 1] == 0) {
+        buckets_count--;
+    }
+
+    for (size_t bucket = 0;bucket < buckets_count;bucket++) {
+        fprintf(file, bucket == 0 ? "%llu" : ",%llu", (unsigned long long)site->histogram[bucket]);
+    }
+
+    fprintf(file, "\t%s\n", stack_key);
+}
+
+// writing per site weight histograms, bucket N counts events with weight in [2^(N-1), 2^N)
+bool stack_table_dump_histograms(StackTable* stack_table, const char* file_path) {
+    FILE* file = fopen(file_path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    fprintf(file, "# count\ttotal\tlog2 histogram\tstack\n");
+
+    pthread_mutex_lock(&stack_table->mutex);
+
+    hash_map_for_each(stack_table->sites, write_site_histogram, file);
+
+    pthread_mutex_unlock(&stack_table->mutex);
+
+    return fclose(file) == 0;
+}
+
+static void free_value(const char* key, void* value, void* arg) {
+    free(value);
+}
+
+void stack_table_free(StackTable* stack_table) {
+    hash_map_for_each(stack_table->method_names, free_value, NULL);
+    hash_map_free(stack_table->method_names);
+
+    hash_map_for_each(stack_table->sites, free_value, NULL);
+    hash_map_free(stack_table->sites);
+
+    pthread_mutex_destroy(&stack_table->mutex);
+
+    free(stack_table);
+}
@@ -0,0 +1,47 @@
+#ifndef _STACKTABLE_H_
+#define _STACKTABLE_H_
+
+#include <jvmti.h>
+
+#include "hashmap.h"
+
+// log2 buckets of single event weight, last bucket collects everything above
+#define STACK_SITE_HISTOGRAM_BUCKETS 40
+
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t live_count;
+    uint64_t live_total;
+    uint64_t histogram[STACK_SITE_HISTOGRAM_BUCKETS];
+} StackSite;
+
+typedef enum {
+    StackSiteTotal,
+    StackSiteLiveTotal
+} StackSiteValue;
+
+typedef struct {
+    // declaring class refs of resolved methods are released through JNI env of the calling thread
+    JavaVM* jvm;
+    HashMap* method_names;
+    HashMap* sites;
+    pthread_mutex_t mutex;
+} StackTable;
+
+StackTable* stack_table_new(JavaVM* jvm);
+
+StackSite* stack_table_add(StackTable* stack_table, jvmtiEnv* jvmti, const jmethodID* methods, jint method_count,
+        const char* leaf_name, uint64_t weight);
+
+void stack_table_frame_name(StackTable* stack_table, jvmtiEnv* jvmti, jmethodID method, char* buf, size_t size);
+
+void stack_table_class_name(const char* class_signature, char* buf, size_t size);
+
+bool stack_table_dump(StackTable* stack_table, const char* file_path, StackSiteValue site_value);
+
+bool stack_table_dump_histograms(StackTable* stack_table, const char* file_path);
+
+void stack_table_free(StackTable* stack_table);
+
+#endif
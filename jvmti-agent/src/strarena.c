@@ -0,0 +1,413 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "strarena.h"
+
+#define INITIAL_BYTES_CAPACITY 65536
+
+#define INITIAL_SLOTS_CAPACITY 1024
+
+#define INITIAL_SYMBOL_MAP_CAPACITY 1024
+
+static uint32_t fnv1a_hash(uint32_t hash, const char* str, size_t length) {
+    for (size_t char_idx = 0;char_idx < length;char_idx++) {
+        hash ^= (uint8_t)str[char_idx];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static uint32_t str_hash(const char* str, size_t length) {
+    return fnv1a_hash(2166136261u, str, length);
+}
+
+// package prefix includes trailing '/', so "com/acme/Service" is split into "com/acme/" and "Service"
+static size_t prefix_length(const char* str, size_t length) {
+    for (size_t char_idx = length;char_idx > 0;char_idx--) {
+        if (str[char_idx - 1] == '/') {
+            return char_idx;
+        }
+    }
+
+    return 0;
+}
+
+static const StrArenaEntry* arena_entry(const StrArena* arena, StrHandle handle) {
+    return &arena->entries[handle - 1];
+}
+
+static size_t entry_length(const StrArena* arena, const StrArenaEntry* entry) {
+    size_t length = entry->length;
+    if (entry->prefix != 0) {
+        length += arena_entry(arena, entry->prefix)->length;
+    }
+
+    return length;
+}
+
+static bool entry_equals(const StrArena* arena, const StrArenaEntry* entry, const char* str, size_t length, uint32_t hash) {
+    if (entry->hash != hash || entry_length(arena, entry) != length) {
+        return false;
+    }
+
+    size_t suffix_offset = 0;
+    if (entry->prefix != 0) {
+        const StrArenaEntry* prefix_entry = arena_entry(arena, entry->prefix);
+        if (memcmp(arena->bytes + prefix_entry->offset, str, prefix_entry->length) != 0) {
+            return false;
+        }
+
+        suffix_offset = prefix_entry->length;
+    }
+
+    return memcmp(arena->bytes + entry->offset, str + suffix_offset, entry->length) == 0;
+}
+
+// slot holding the string handle or empty slot the string should go to
+static StrHandle* arena_slot(const StrArena* arena, const char* str, size_t length, uint32_t hash) {
+    size_t slot_mask = arena->slots_capacity - 1;
+    size_t slot_idx = hash & slot_mask;
+
+    for (;;) {
+        StrHandle* slot = &arena->slots[slot_idx];
+        if (*slot == 0 || entry_equals(arena, arena_entry(arena, *slot), str, length, hash)) {
+            return slot;
+        }
+
+        slot_idx = (slot_idx + 1) & slot_mask;
+    }
+}
+
+static bool arena_grow_slots(StrArena* arena) {
+    size_t new_slots_capacity = arena->slots_capacity * 2;
+    StrHandle* new_slots = calloc(new_slots_capacity, sizeof(StrHandle));
+    if (new_slots == NULL) {
+        return false;
+    }
+
+    size_t slot_mask = new_slots_capacity - 1;
+    for (size_t entry_idx = 0;entry_idx < arena->entries_count;entry_idx++) {
+        size_t slot_idx = arena->entries[entry_idx].hash & slot_mask;
+        while (new_slots[slot_idx] != 0) {
+            slot_idx = (slot_idx + 1) & slot_mask;
+        }
+
+        new_slots[slot_idx] = entry_idx + 1;
+    }
+
+    free(arena->slots);
+    arena->slots = new_slots;
+    arena->slots_capacity = new_slots_capacity;
+
+    return true;
+}
+
+// entries keep offsets rather than pointers, so bytes buffer can be moved when it grows
+static bool arena_store(StrArena* arena, const char* str, size_t length, uint32_t* offset) {
+    if (arena->bytes_count + length > UINT32_MAX) {
+        return false;
+    }
+
+    if (arena->bytes_count + length > arena->bytes_capacity) {
+        size_t new_bytes_capacity = arena->bytes_capacity == 0 ? INITIAL_BYTES_CAPACITY : arena->bytes_capacity * 2;
+        while (new_bytes_capacity < arena->bytes_count + length) {
+            new_bytes_capacity *= 2;
+        }
+
+        char* new_bytes = realloc(arena->bytes, new_bytes_capacity);
+        if (new_bytes == NULL) {
+            return false;
+        }
+
+        arena->bytes = new_bytes;
+        arena->bytes_capacity = new_bytes_capacity;
+    }
+
+    memcpy(arena->bytes + arena->bytes_count, str, length);
+
+    *offset = arena->bytes_count;
+    arena->bytes_count += length;
+
+    return true;
+}
+
+static StrHandle arena_add(StrArena* arena, const char* str, size_t length, bool share_prefix) {
+    uint32_t hash = str_hash(str, length);
+
+    StrHandle* slot = arena_slot(arena, str, length, hash);
+    if (*slot != 0) {
+        return *slot;
+    }
+
+    StrHandle prefix = 0;
+    size_t prefix_len = share_prefix ? prefix_length(str, length) : 0;
+    if (prefix_len > 0) {
+        prefix = arena_add(arena, str, prefix_len, false);
+        if (prefix == 0) {
+            return 0;
+        }
+    }
+
+    // adding prefix may have grown slots table, load factor is kept under 3/4
+    if ((arena->entries_count + 1) * 4 > arena->slots_capacity * 3) {
+        if (!arena_grow_slots(arena)) {
+            return 0;
+        }
+    }
+
+    slot = arena_slot(arena, str, length, hash);
+
+    if (arena->entries_count == arena->entries_capacity) {
+        size_t new_entries_capacity = arena->entries_capacity == 0 ? 256 : arena->entries_capacity * 2;
+        StrArenaEntry* new_entries = realloc(arena->entries, new_entries_capacity * sizeof(StrArenaEntry));
+        if (new_entries == NULL) {
+            return 0;
+        }
+
+        arena->entries = new_entries;
+        arena->entries_capacity = new_entries_capacity;
+    }
+
+    uint32_t offset = 0;
+    if (!arena_store(arena, str + prefix_len, length - prefix_len, &offset)) {
+        return 0;
+    }
+
+    StrArenaEntry* entry = &arena->entries[arena->entries_count];
+    entry->offset = offset;
+    entry->prefix = prefix;
+    entry->length = length - prefix_len;
+    entry->hash = hash;
+
+    arena->entries_count += 1;
+    *slot = arena->entries_count;
+
+    return *slot;
+}
+
+StrArena* str_arena_new(void) {
+    StrArena* arena = calloc(1, sizeof(StrArena));
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    arena->slots = calloc(INITIAL_SLOTS_CAPACITY, sizeof(StrHandle));
+    if (arena->slots == NULL) {
+        free(arena);
+        return NULL;
+    }
+
+    arena->slots_capacity = INITIAL_SLOTS_CAPACITY;
+
+    pthread_mutex_init(&arena->mutex, NULL);
+
+    return arena;
+}
+
+// interning string of passed in length, it doesn't have to be null terminated, 0 is returned on allocation failure
+StrHandle str_arena_intern(StrArena* arena, const char* str, size_t length) {
+    if (length > UINT32_MAX) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&arena->mutex);
+
+    StrHandle handle = arena_add(arena, str, length, true);
+
+    pthread_mutex_unlock(&arena->mutex);
+
+    return handle;
+}
+
+// looking up handle of already interned string, 0 is returned when string wasn't interned
+StrHandle str_arena_find(StrArena* arena, const char* str, size_t length) {
+    pthread_mutex_lock(&arena->mutex);
+
+    StrHandle handle = *arena_slot(arena, str, length, str_hash(str, length));
+
+    pthread_mutex_unlock(&arena->mutex);
+
+    return handle;
+}
+
+// copying interned string to null terminated buffer, returns full string length like snprintf
+size_t str_arena_copy(StrArena* arena, StrHandle handle, char* buf, size_t buf_size) {
+    pthread_mutex_lock(&arena->mutex);
+
+    if (handle == 0 || handle > arena->entries_count) {
+        pthread_mutex_unlock(&arena->mutex);
+
+        if (buf_size > 0) {
+            buf[0] = '\0';
+        }
+
+        return 0;
+    }
+
+    const StrArenaEntry* entry = arena_entry(arena, handle);
+
+    size_t length = 0;
+    size_t copied_length = 0;
+
+    const StrArenaEntry* parts[] = { entry->prefix != 0 ? arena_entry(arena, entry->prefix) : NULL, entry };
+    for (size_t part_idx = 0;part_idx < 2;part_idx++) {
+        const StrArenaEntry* part = parts[part_idx];
+        if (part == NULL) {
+            continue;
+        }
+
+        if (buf_size > 0 && copied_length < buf_size - 1) {
+            size_t part_copy_length = part->length;
+            if (part_copy_length > buf_size - 1 - copied_length) {
+                part_copy_length = buf_size - 1 - copied_length;
+            }
+
+            memcpy(buf + copied_length, arena->bytes + part->offset, part_copy_length);
+            copied_length += part_copy_length;
+        }
+
+        length += part->length;
+    }
+
+    pthread_mutex_unlock(&arena->mutex);
+
+    if (buf_size > 0) {
+        buf[copied_length] = '\0';
+    }
+
+    return length;
+}
+
+// number of interned strings, package prefixes included
+size_t str_arena_count(StrArena* arena) {
+    pthread_mutex_lock(&arena->mutex);
+
+    size_t count = arena->entries_count;
+
+    pthread_mutex_unlock(&arena->mutex);
+
+    return count;
+}
+
+// memory held by the arena, bytes, entries and slots
+size_t str_arena_size_bytes(StrArena* arena) {
+    pthread_mutex_lock(&arena->mutex);
+
+    size_t size_bytes = arena->bytes_capacity + arena->entries_capacity * sizeof(StrArenaEntry)
+            + arena->slots_capacity * sizeof(StrHandle);
+
+    pthread_mutex_unlock(&arena->mutex);
+
+    return size_bytes;
+}
+
+void str_arena_free(StrArena* arena) {
+    free(arena->bytes);
+    free(arena->entries);
+    free(arena->slots);
+
+    pthread_mutex_destroy(&arena->mutex);
+
+    free(arena);
+}
+
+SymbolMap* symbol_map_new(void) {
+    SymbolMap* symbol_map = calloc(1, sizeof(SymbolMap));
+    if (symbol_map == NULL) {
+        return NULL;
+    }
+
+    symbol_map->values = calloc(INITIAL_SYMBOL_MAP_CAPACITY, sizeof(void*));
+    if (symbol_map->values == NULL) {
+        free(symbol_map);
+        return NULL;
+    }
+
+    symbol_map->capacity = INITIAL_SYMBOL_MAP_CAPACITY;
+
+    pthread_mutex_init(&symbol_map->mutex, NULL);
+
+    return symbol_map;
+}
+
+void* symbol_map_get(SymbolMap* symbol_map, StrHandle symbol) {
+    pthread_mutex_lock(&symbol_map->mutex);
+
+    void* value = symbol < symbol_map->capacity ? symbol_map->values[symbol] : NULL;
+
+    pthread_mutex_unlock(&symbol_map->mutex);
+
+    return value;
+}
+
+// value is retained while the map is locked, so value replaced right after can be released by the writer,
+// returns what retain_fn returned or NULL when there is no value
+void* symbol_map_get_retained(SymbolMap* symbol_map, StrHandle symbol, SymbolMapRetainFn* retain_fn, void* arg) {
+    pthread_mutex_lock(&symbol_map->mutex);
+
+    void* value = symbol < symbol_map->capacity ? symbol_map->values[symbol] : NULL;
+    void* retained_value = value != NULL ? retain_fn(value, arg) : NULL;
+
+    pthread_mutex_unlock(&symbol_map->mutex);
+
+    return retained_value;
+}
+
+// previous value of the symbol is passed out when requested, NULL value removes the symbol,
+// map is left as is when it can't grow
+bool symbol_map_put(SymbolMap* symbol_map, StrHandle symbol, void* value, void** previous_value) {
+    pthread_mutex_lock(&symbol_map->mutex);
+
+    if (symbol >= symbol_map->capacity) {
+        size_t new_capacity = symbol_map->capacity;
+        while (new_capacity <= symbol) {
+            new_capacity *= 2;
+        }
+
+        void** new_values = realloc(symbol_map->values, new_capacity * sizeof(void*));
+        if (new_values == NULL) {
+            pthread_mutex_unlock(&symbol_map->mutex);
+            return false;
+        }
+
+        memset(new_values + symbol_map->capacity, 0, (new_capacity - symbol_map->capacity) * sizeof(void*));
+
+        symbol_map->values = new_values;
+        symbol_map->capacity = new_capacity;
+    }
+
+    if (previous_value != NULL) {
+        *previous_value = symbol_map->values[symbol];
+    }
+
+    symbol_map->values[symbol] = value;
+
+    pthread_mutex_unlock(&symbol_map->mutex);
+
+    return true;
+}
+
+void symbol_map_for_each(SymbolMap* symbol_map, SymbolMapEntryFn* entry_fn, void* arg) {
+    pthread_mutex_lock(&symbol_map->mutex);
+
+    for (size_t symbol = 1;symbol < symbol_map->capacity;symbol++) {
+        if (symbol_map->values[symbol] != NULL) {
+            entry_fn(symbol, symbol_map->values[symbol], arg);
+        }
+    }
+
+    pthread_mutex_unlock(&symbol_map->mutex);
+}
+
+void symbol_map_free(SymbolMap* symbol_map) {
+    free(symbol_map->values);
+
+    pthread_mutex_destroy(&symbol_map->mutex);
+
+    free(symbol_map);
+}
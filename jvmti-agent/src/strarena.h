@@ -0,0 +1,69 @@
+#ifndef _STRARENA_H_
+#define _STRARENA_H_
+
+#include <stdbool.h>
+
+#include <pthread.h>
+
+// handle of interned string, 0 is never a valid handle
+typedef uint32_t StrHandle;
+
+typedef struct {
+    uint32_t offset;
+    // handle of interned package prefix, strings of the same package share its bytes
+    StrHandle prefix;
+    uint32_t length;
+    uint32_t hash;
+} StrArenaEntry;
+
+// append only arena of interned strings, handles stay valid until arena is freed
+typedef struct {
+    char* bytes;
+    size_t bytes_count;
+    size_t bytes_capacity;
+    StrArenaEntry* entries;
+    size_t entries_count;
+    size_t entries_capacity;
+    StrHandle* slots;
+    size_t slots_capacity;
+    pthread_mutex_t mutex;
+} StrArena;
+
+// values indexed by handles, handles are dense so values are kept in array
+typedef struct {
+    void** values;
+    size_t capacity;
+    pthread_mutex_t mutex;
+} SymbolMap;
+
+typedef void SymbolMapEntryFn(StrHandle symbol, void* value, void* arg);
+
+typedef void* SymbolMapRetainFn(void* value, void* arg);
+
+StrArena* str_arena_new(void);
+
+StrHandle str_arena_intern(StrArena* arena, const char* str, size_t length);
+
+StrHandle str_arena_find(StrArena* arena, const char* str, size_t length);
+
+size_t str_arena_copy(StrArena* arena, StrHandle handle, char* buf, size_t buf_size);
+
+size_t str_arena_count(StrArena* arena);
+
+size_t str_arena_size_bytes(StrArena* arena);
+
+void str_arena_free(StrArena* arena);
+
+SymbolMap* symbol_map_new(void);
+
+void* symbol_map_get(SymbolMap* symbol_map, StrHandle symbol);
+
+void* symbol_map_get_retained(SymbolMap* symbol_map, StrHandle symbol, SymbolMapRetainFn* retain_fn, void* arg);
+
+bool symbol_map_put(SymbolMap* symbol_map, StrHandle symbol, void* value, void** previous_value);
+
+void symbol_map_for_each(SymbolMap* symbol_map, SymbolMapEntryFn* entry_fn, void* arg);
+
+void symbol_map_free(SymbolMap* symbol_map);
+
+#endif
@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "agent.h"
+#include "stacktable.h"
+#include "threadcpu.h"
+
+#define THREAD_CPU_MAX_FRAMES 32
+
+#define MAX_TOP_THREADS 64
+
+#define FRAME_NAME_MAX_LENGTH 512
+
+static const long NANOS_PER_SECOND = 1000000000L;
+
+// thread local storage holds sampler id in the upper half and slot index + 1 in the lower half,
+// so slots stored by sampler of the previous attach are not mistaken for slots of the current one
+#define SLOT_BITS 32
+#define SLOT_MASK 0xFFFFFFFFULL
+
+static atomic_uint next_sampler_id = ATOMIC_VAR_INIT(1);
+
+typedef struct {
+    jint thread_idx;
+    jlong cpu_delta_ns;
+} HotThread;
+
+static void advance_time(struct timespec* time, long nanos) {
+    time->tv_nsec += nanos;
+    while (time->tv_nsec >= NANOS_PER_SECOND) {
+        time->tv_nsec -= NANOS_PER_SECOND;
+        time->tv_sec += 1;
+    }
+}
+
+static ThreadCpuSlot* acquire_slot(ThreadCpuSampler* thread_cpu_sampler, jthread thread, bool* new_slot) {
+    jvmtiEnv* jvmti = thread_cpu_sampler->jvmti;
+
+    void* slot_ref = NULL;
+    if ((*jvmti)->GetThreadLocalStorage(jvmti, thread, &slot_ref) != JVMTI_ERROR_NONE) {
+        return NULL;
+    }
+
+    uint64_t slot_value = (uintptr_t)slot_ref;
+    size_t slot_idx = slot_value & SLOT_MASK;
+    if ((slot_value >> SLOT_BITS) == thread_cpu_sampler->sampler_id && slot_idx > 0
+            && slot_idx <= thread_cpu_sampler->slots_capacity && thread_cpu_sampler->slots[slot_idx - 1].used) {
+        *new_slot = false;
+        return &thread_cpu_sampler->slots[slot_idx - 1];
+    }
+
+    // free slots are looked up linearly, threads come and go rarely comparing to sampling
+    size_t free_slot_idx = 0;
+    while (free_slot_idx < thread_cpu_sampler->slots_capacity && thread_cpu_sampler->slots[free_slot_idx].used) {
+        free_slot_idx++;
+    }
+
+    if (free_slot_idx == thread_cpu_sampler->slots_capacity) {
+        size_t new_capacity = thread_cpu_sampler->slots_capacity == 0 ? 256 : thread_cpu_sampler->slots_capacity * 2;
+        ThreadCpuSlot* new_slots = realloc(thread_cpu_sampler->slots, new_capacity * sizeof(ThreadCpuSlot));
+        if (new_slots == NULL) {
+            return NULL;
+        }
+
+        memset(new_slots + thread_cpu_sampler->slots_capacity, 0,
+                (new_capacity - thread_cpu_sampler->slots_capacity) * sizeof(ThreadCpuSlot));
+
+        thread_cpu_sampler->slots = new_slots;
+        thread_cpu_sampler->slots_capacity = new_capacity;
+    }
+
+    slot_value = ((uint64_t)thread_cpu_sampler->sampler_id << SLOT_BITS) | (free_slot_idx + 1);
+    if ((*jvmti)->SetThreadLocalStorage(jvmti, thread, (void*)(uintptr_t)slot_value) != JVMTI_ERROR_NONE) {
+        return NULL;
+    }
+
+    ThreadCpuSlot* slot = &thread_cpu_sampler->slots[free_slot_idx];
+    memset(slot, 0, sizeof(ThreadCpuSlot));
+    slot->used = true;
+
+    *new_slot = true;
+
+    return slot;
+}
+
+// keeping hottest threads sorted by cpu time, top list is short so insertion is cheap
+static void add_hot_thread(HotThread* hot_threads, int* hot_threads_count, int max_hot_threads, jint thread_idx, jlong cpu_delta_ns) {
+    int position = *hot_threads_count;
+    while (position > 0 && hot_threads[position - 1].cpu_delta_ns < cpu_delta_ns) {
+        position--;
+    }
+
+    if (position >= max_hot_threads) {
+        return;
+    }
+
+    int moved_count = (*hot_threads_count < max_hot_threads ? *hot_threads_count : max_hot_threads - 1) - position;
+    memmove(&hot_threads[position + 1], &hot_threads[position], moved_count * sizeof(HotThread));
+
+    hot_threads[position].thread_idx = thread_idx;
+    hot_threads[position].cpu_delta_ns = cpu_delta_ns;
+
+    if (*hot_threads_count < max_hot_threads) {
+        *hot_threads_count += 1;
+    }
+}
+
+static const char* thread_state_name(jint state) {
+    if ((state & JVMTI_THREAD_STATE_BLOCKED_ON_MONITOR_ENTER) != 0) {
+        return "blocked";
+    } else if ((state & JVMTI_THREAD_STATE_WAITING) != 0) {
+        return "waiting";
+    } else if ((state & JVMTI_THREAD_STATE_RUNNABLE) != 0) {
+        return "runnable";
+    }
+
+    return "terminated";
+}
+
+static void write_thread_name(jvmtiEnv* jvmti, JNIEnv* jni, FILE* file, jthread thread) {
+    jvmtiThreadInfo thread_info;
+    memset(&thread_info, 0, sizeof(jvmtiThreadInfo));
+    if ((*jvmti)->GetThreadInfo(jvmti, thread, &thread_info) != JVMTI_ERROR_NONE) {
+        fprintf(file, "[unknown]");
+        return;
+    }
+
+    fprintf(file, "%s", thread_info.name != NULL ? thread_info.name : "[unknown]");
+
+    (*jvmti)->Deallocate(jvmti, (unsigned char*)thread_info.name);
+    (*jni)->DeleteLocalRef(jni, thread_info.thread_group);
+    (*jni)->DeleteLocalRef(jni, thread_info.context_class_loader);
+}
+
+// report is rewritten every sample, so it always shows threads hottest during the last period,
+// it is written aside and renamed, so readers never see it half written
+static void write_report(ThreadCpuSampler* thread_cpu_sampler, JNIEnv* jni, const jthread* threads,
+        const HotThread* hot_threads, const jvmtiStackInfo* stack_infos, int hot_threads_count,
+        jint threads_count, jlong total_cpu_delta_ns, long interval_ns) {
+    jvmtiEnv* jvmti = thread_cpu_sampler->jvmti;
+
+    size_t tmp_file_path_size = strlen(thread_cpu_sampler->report_file_path) + 5;
+    char tmp_file_path[tmp_file_path_size];
+    snprintf(tmp_file_path, tmp_file_path_size, "%s.tmp", thread_cpu_sampler->report_file_path);
+
+    FILE* file = fopen(tmp_file_path, "w");
+    if (file == NULL) {
+        return;
+    }
+
+    fprintf(file, "# sample %llu, interval %ld ms, threads: %d, cpu: %lld ms\n",
+            (unsigned long long)thread_cpu_sampler->sample_number, interval_ns / 1000000L, threads_count,
+            (long long)(total_cpu_delta_ns / 1000000LL));
+
+    char frame_name[FRAME_NAME_MAX_LENGTH];
+    for (int hot_idx = 0;hot_idx < hot_threads_count;hot_idx++) {
+        const HotThread* hot_thread = &hot_threads[hot_idx];
+        const jvmtiStackInfo* stack_info = stack_infos != NULL ? &stack_infos[hot_idx] : NULL;
+
+        // cpu usage is given in percents of a single core
+        fprintf(file, "%.3f ms\t%.1f%%\t%s\t", hot_thread->cpu_delta_ns / 1000000.0,
+                100.0 * hot_thread->cpu_delta_ns / interval_ns, stack_info != NULL ? thread_state_name(stack_info->state) : "");
+        write_thread_name(jvmti, jni, file, threads[hot_thread->thread_idx]);
+        fprintf(file, "\n");
+
+        for (jint frame_idx = 0;stack_info != NULL && frame_idx < stack_info->frame_count;frame_idx++) {
+            stack_table_frame_name(thread_cpu_sampler->stacks, jvmti, stack_info->frame_buffer[frame_idx].method,
+                    frame_name, sizeof(frame_name));
+            fprintf(file, "\t%s\n", frame_name);
+        }
+    }
+
+    if (fclose(file) != 0 || rename(tmp_file_path, thread_cpu_sampler->report_file_path) != 0) {
+        log_debug("failed to write thread cpu report: %s", thread_cpu_sampler->report_file_path);
+    }
+}
+
+// cpu time of every live thread is read once per sample, stacks are taken for the hottest threads only,
+// so the cost per thread stays at a couple of cheap calls however many threads there are
+static void sample_threads(ThreadCpuSampler* thread_cpu_sampler, JNIEnv* jni, long interval_ns) {
+    jvmtiEnv* jvmti = thread_cpu_sampler->jvmti;
+
+    jthread* threads = NULL;
+    jint threads_count = 0;
+    if ((*jvmti)->GetAllThreads(jvmti, &threads_count, &threads) != JVMTI_ERROR_NONE) {
+        return;
+    }
+
+    thread_cpu_sampler->sample_number += 1;
+    uint64_t sample_number = thread_cpu_sampler->sample_number;
+
+    HotThread hot_threads[MAX_TOP_THREADS];
+    int hot_threads_count = 0;
+    jlong total_cpu_delta_ns = 0;
+
+    for (jint thread_idx = 0;thread_idx < threads_count;thread_idx++) {
+        bool new_slot = false;
+        ThreadCpuSlot* slot = acquire_slot(thread_cpu_sampler, threads[thread_idx], &new_slot);
+        if (slot == NULL) {
+            continue;
+        }
+
+        slot->sample_number = sample_number;
+
+        jlong cpu_time_ns = 0;
+        if ((*jvmti)->GetThreadCpuTime(jvmti, threads[thread_idx], &cpu_time_ns) != JVMTI_ERROR_NONE) {
+            continue;
+        }
+
+        // thread started since the previous sample burnt all its cpu time during the period,
+        // threads seen by the very first sample have no baseline yet
+        jlong cpu_delta_ns = 0;
+        if (!new_slot) {
+            cpu_delta_ns = cpu_time_ns - slot->cpu_time_ns;
+        } else if (sample_number > 1) {
+            cpu_delta_ns = cpu_time_ns;
+        }
+
+        slot->cpu_time_ns = cpu_time_ns;
+
+        if (cpu_delta_ns > 0) {
+            total_cpu_delta_ns += cpu_delta_ns;
+            add_hot_thread(hot_threads, &hot_threads_count, thread_cpu_sampler->top_threads_count, thread_idx, cpu_delta_ns);
+        }
+    }
+
+    // slots of threads which weren't seen have ended
+    for (size_t slot_idx = 0;slot_idx < thread_cpu_sampler->slots_capacity;slot_idx++) {
+        ThreadCpuSlot* slot = &thread_cpu_sampler->slots[slot_idx];
+        if (slot->used && slot->sample_number != sample_number) {
+            slot->used = false;
+        }
+    }
+
+    jvmtiStackInfo* stack_infos = NULL;
+    if (hot_threads_count > 0) {
+        jthread hot_thread_refs[MAX_TOP_THREADS];
+        for (int hot_idx = 0;hot_idx < hot_threads_count;hot_idx++) {
+            hot_thread_refs[hot_idx] = threads[hot_threads[hot_idx].thread_idx];
+        }
+
+        if ((*jvmti)->GetThreadListStackTraces(jvmti, hot_threads_count, hot_thread_refs, THREAD_CPU_MAX_FRAMES,
+                &stack_infos) != JVMTI_ERROR_NONE) {
+            stack_infos = NULL;
+        }
+    }
+
+    for (int hot_idx = 0;stack_infos != NULL && hot_idx < hot_threads_count;hot_idx++) {
+        const jvmtiStackInfo* stack_info = &stack_infos[hot_idx];
+
+        jmethodID methods[THREAD_CPU_MAX_FRAMES];
+        for (jint frame_idx = 0;frame_idx < stack_info->frame_count;frame_idx++) {
+            methods[frame_idx] = stack_info->frame_buffer[frame_idx].method;
+        }
+
+        stack_table_add(thread_cpu_sampler->stacks, jvmti, methods, stack_info->frame_count, NULL, hot_threads[hot_idx].cpu_delta_ns);
+    }
+
+    if (thread_cpu_sampler->report_file_path != NULL) {
+        write_report(thread_cpu_sampler, jni, threads, hot_threads, stack_infos, hot_threads_count,
+                threads_count, total_cpu_delta_ns, interval_ns);
+    }
+
+    // stack info array and frame buffers are allocated as a single block
+    (*jvmti)->Deallocate(jvmti, (unsigned char*)stack_infos);
+
+    for (jint thread_idx = 0;thread_idx < threads_count;thread_idx++) {
+        (*jni)->DeleteLocalRef(jni, threads[thread_idx]);
+    }
+
+    (*jvmti)->Deallocate(jvmti, (unsigned char*)threads);
+}
+
+static void* thread_cpu_sampler_activity(void* arg) {
+    ThreadCpuSampler* thread_cpu_sampler = arg;
+
+    JNIEnv* jni = NULL;
+    jint attach_thread_status = (*thread_cpu_sampler->jvm)->AttachCurrentThreadAsDaemon(thread_cpu_sampler->jvm, (void**)&jni, NULL);
+    if (attach_thread_status != JNI_OK) {
+        log_debug("failed to attach 'thread cpu sampler' thread");
+        return NULL;
+    }
+
+    log_debug("'thread cpu sampler' thread is running");
+
+    struct timespec last_sample_time;
+    clock_gettime(CLOCK_MONOTONIC, &last_sample_time);
+
+    struct timespec next_sample_time = last_sample_time;
+
+    while (atomic_load(&thread_cpu_sampler->sampling)) {
+        // sleeping until absolute deadline, so sampling cost doesn't shift sampling period
+        advance_time(&next_sample_time, thread_cpu_sampler->sampling_period_ns);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_sample_time, NULL);
+
+        struct timespec sample_time;
+        clock_gettime(CLOCK_MONOTONIC, &sample_time);
+
+        long interval_ns = (sample_time.tv_sec - last_sample_time.tv_sec) * NANOS_PER_SECOND
+                + (sample_time.tv_nsec - last_sample_time.tv_nsec);
+        last_sample_time = sample_time;
+
+        sample_threads(thread_cpu_sampler, jni, interval_ns > 0 ? interval_ns : 1);
+    }
+
+    log_debug("'thread cpu sampler' thread stopping...");
+
+    (*thread_cpu_sampler->jvm)->DetachCurrentThread(thread_cpu_sampler->jvm);
+
+    return NULL;
+}
+
+static void thread_cpu_sampler_free(ThreadCpuSampler* thread_cpu_sampler) {
+    if (thread_cpu_sampler->stacks != NULL) {
+        stack_table_free(thread_cpu_sampler->stacks);
+    }
+
+    free(thread_cpu_sampler->slots);
+    free(thread_cpu_sampler->report_file_path);
+    free(thread_cpu_sampler);
+}
+
+ThreadCpuSampler* thread_cpu_sampler_start(JavaVM* jvm, jvmtiEnv* jvmti, int sampling_period_ms, int top_threads_count,
+        const char* report_file_path) {
+    if (sampling_period_ms <= 0 || top_threads_count <= 0) {
+        return NULL;
+    }
+
+    ThreadCpuSampler* thread_cpu_sampler = calloc(1, sizeof(ThreadCpuSampler));
+    if (thread_cpu_sampler == NULL) {
+        return NULL;
+    }
+
+    thread_cpu_sampler->jvm = jvm;
+    thread_cpu_sampler->jvmti = jvmti;
+    thread_cpu_sampler->sampling_period_ns = sampling_period_ms * 1000000L;
+    thread_cpu_sampler->top_threads_count = top_threads_count < MAX_TOP_THREADS ? top_threads_count : MAX_TOP_THREADS;
+    thread_cpu_sampler->sampler_id = atomic_fetch_add(&next_sampler_id, 1);
+    thread_cpu_sampler->stacks = stack_table_new(jvm);
+    thread_cpu_sampler->report_file_path = report_file_path != NULL ? strdup(report_file_path) : NULL;
+
+    if (thread_cpu_sampler->stacks == NULL || (report_file_path != NULL && thread_cpu_sampler->report_file_path == NULL)) {
+        thread_cpu_sampler_free(thread_cpu_sampler);
+        return NULL;
+    }
+
+    atomic_store(&thread_cpu_sampler->sampling, true);
+
+    int thread_create_status = pthread_create(&thread_cpu_sampler->sampling_thread, NULL, thread_cpu_sampler_activity, thread_cpu_sampler);
+    if (thread_create_status != 0) {
+        thread_cpu_sampler_free(thread_cpu_sampler);
+        return NULL;
+    }
+
+    return thread_cpu_sampler;
+}
+
+// collapsed profile holds cpu nanoseconds burnt by the hottest threads per stack
+bool thread_cpu_sampler_dump(ThreadCpuSampler* thread_cpu_sampler, const char* file_path) {
+    return stack_table_dump(thread_cpu_sampler->stacks, file_path, StackSiteTotal);
+}
+
+void thread_cpu_sampler_stop(ThreadCpuSampler* thread_cpu_sampler) {
+    atomic_store(&thread_cpu_sampler->sampling, false);
+
+    pthread_join(thread_cpu_sampler->sampling_thread, NULL);
+
+    thread_cpu_sampler_free(thread_cpu_sampler);
+}
@@ -0,0 +1,45 @@
+#ifndef _THREADCPU_H_
+#define _THREADCPU_H_
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+#include <jvmti.h>
+
+#include "stacktable.h"
+
+typedef struct {
+    jlong cpu_time_ns;
+    // number of the sample thread was last seen in, slots of threads which are gone are reused
+    uint64_t sample_number;
+    bool used;
+} ThreadCpuSlot;
+
+typedef struct {
+    JavaVM* jvm;
+    jvmtiEnv* jvmti;
+    long sampling_period_ns;
+    int top_threads_count;
+    char* report_file_path;
+    // identifies slot indexes stored in thread local storage by this sampler
+    uint32_t sampler_id;
+    uint64_t sample_number;
+    // indexed by slot stored in thread local storage, accessed by sampling thread only
+    ThreadCpuSlot* slots;
+    size_t slots_capacity;
+    // stacks of the hottest threads weighted by cpu time burnt
+    StackTable* stacks;
+    pthread_t sampling_thread;
+    atomic_bool sampling;
+} ThreadCpuSampler;
+
+ThreadCpuSampler* thread_cpu_sampler_start(JavaVM* jvm, jvmtiEnv* jvmti, int sampling_period_ms, int top_threads_count,
+        const char* report_file_path);
+
+bool thread_cpu_sampler_dump(ThreadCpuSampler* thread_cpu_sampler, const char* file_path);
+
+void thread_cpu_sampler_stop(ThreadCpuSampler* thread_cpu_sampler);
+
+#endif
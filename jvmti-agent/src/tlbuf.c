@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "tlbuf.h"
+
+// buffer is released on thread exit and can be claimed by another thread once drained
+static void thread_buffer_release(void* buffer) {
+    atomic_store_explicit(&((ThreadBuffer*)buffer)->in_use, false, memory_order_release);
+}
+
+ThreadBufferSet* thread_buffer_set_new(size_t record_size, size_t capacity) {
+    // capacity should be a power of two, so ring positions can be masked
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return NULL;
+    }
+
+    ThreadBufferSet* buffer_set = malloc(sizeof(ThreadBufferSet));
+    if (buffer_set == NULL) {
+        return NULL;
+    }
+
+    if (pthread_key_create(&buffer_set->thread_key, thread_buffer_release) != 0) {
+        free(buffer_set);
+        return NULL;
+    }
+
+    buffer_set->record_size = record_size;
+    buffer_set->capacity = capacity;
+    atomic_init(&buffer_set->buffers, NULL);
+
+    return buffer_set;
+}
+
+static ThreadBuffer* thread_buffer_claim(ThreadBufferSet* buffer_set) {
+    // reusing buffer left by exited thread, records it still holds are drained as usual
+    for (ThreadBuffer* buffer = atomic_load(&buffer_set->buffers);buffer != NULL;buffer = buffer->next) {
+        bool in_use = false;
+        if (atomic_compare_exchange_strong(&buffer->in_use, &in_use, true)) {
+            return buffer;
+        }
+    }
+
+    ThreadBuffer* buffer = malloc(sizeof(ThreadBuffer) + buffer_set->record_size * buffer_set->capacity);
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    buffer->capacity = buffer_set->capacity;
+    atomic_init(&buffer->head, 0);
+    atomic_init(&buffer->tail, 0);
+    atomic_init(&buffer->in_use, true);
+    atomic_init(&buffer->dropped, 0);
+
+    // buffers are never unlinked until the whole set is freed
+    ThreadBuffer* buffers_head = atomic_load(&buffer_set->buffers);
+    do {
+        buffer->next = buffers_head;
+    } while (!atomic_compare_exchange_weak(&buffer_set->buffers, &buffers_head, buffer));
+
+    return buffer;
+}
+
+// returning free record slot of the calling thread buffer or NULL when buffer is full,
+// reserved record becomes visible to consumer after commit
+void* thread_buffer_reserve(ThreadBufferSet* buffer_set, ThreadBuffer** buffer_ref) {
+    ThreadBuffer* buffer = pthread_getspecific(buffer_set->thread_key);
+    if (buffer == NULL) {
+        buffer = thread_buffer_claim(buffer_set);
+        if (buffer == NULL) {
+            return NULL;
+        }
+
+        pthread_setspecific(buffer_set->thread_key, buffer);
+    }
+
+    size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+    if (head - tail == buffer->capacity) {
+        atomic_fetch_add_explicit(&buffer->dropped, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    *buffer_ref = buffer;
+
+    return buffer->records + (head & (buffer->capacity - 1)) * buffer_set->record_size;
+}
+
+void thread_buffer_commit(ThreadBuffer* buffer) {
+    size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+// passing all committed records to record function, should be called by single consumer thread only
+size_t thread_buffer_set_drain(ThreadBufferSet* buffer_set, ThreadBufferRecordFn* record_fn, void* arg) {
+    size_t records_drained = 0;
+
+    for (ThreadBuffer* buffer = atomic_load(&buffer_set->buffers);buffer != NULL;buffer = buffer->next) {
+        size_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+
+        for (;tail != head;tail++) {
+            record_fn(buffer->records + (tail & (buffer->capacity - 1)) * buffer_set->record_size, arg);
+            records_drained++;
+        }
+
+        atomic_store_explicit(&buffer->tail, tail, memory_order_release);
+    }
+
+    return records_drained;
+}
+
+uint64_t thread_buffer_set_dropped(ThreadBufferSet* buffer_set) {
+    uint64_t dropped = 0;
+
+    for (ThreadBuffer* buffer = atomic_load(&buffer_set->buffers);buffer != NULL;buffer = buffer->next) {
+        dropped += atomic_load_explicit(&buffer->dropped, memory_order_relaxed);
+    }
+
+    return dropped;
+}
+
+// producers should be stopped before set is freed
+void thread_buffer_set_free(ThreadBufferSet* buffer_set) {
+    pthread_key_delete(buffer_set->thread_key);
+
+    ThreadBuffer* buffer = atomic_load(&buffer_set->buffers);
+    while (buffer != NULL) {
+        ThreadBuffer* next_buffer = buffer->next;
+        free(buffer);
+        buffer = next_buffer;
+    }
+
+    free(buffer_set);
+}
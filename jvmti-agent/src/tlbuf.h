@@ -0,0 +1,39 @@
+#ifndef _TLBUF_H_
+#define _TLBUF_H_
+
+#include <pthread.h>
+
+// single producer single consumer ring of fixed size records owned by one thread
+typedef struct ThreadBuffer {
+    size_t capacity;
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_bool in_use;
+    atomic_uint_fast64_t dropped;
+    struct ThreadBuffer* next;
+    uint8_t records[];
+} ThreadBuffer;
+
+// registry of thread buffers, records are produced lock free and drained by a single consumer thread
+typedef struct {
+    size_t record_size;
+    size_t capacity;
+    pthread_key_t thread_key;
+    _Atomic(ThreadBuffer*) buffers;
+} ThreadBufferSet;
+
+typedef void ThreadBufferRecordFn(const void* record, void* arg);
+
+ThreadBufferSet* thread_buffer_set_new(size_t record_size, size_t capacity);
+
+void* thread_buffer_reserve(ThreadBufferSet* buffer_set, ThreadBuffer** buffer);
+
+void thread_buffer_commit(ThreadBuffer* buffer);
+
+size_t thread_buffer_set_drain(ThreadBufferSet* buffer_set, ThreadBufferRecordFn* record_fn, void* arg);
+
+uint64_t thread_buffer_set_dropped(ThreadBufferSet* buffer_set);
+
+void thread_buffer_set_free(ThreadBufferSet* buffer_set);
+
+#endif